@@ -0,0 +1,276 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Throughput benchmarks. Every benchmark splits a buffer of fixed-length lines
+   line by line and reports one CSV record:
+
+   version,benchmark,function,kernel,buffer_size,line_length,density,alignment,
+   iterations,seconds,gb_per_s,ns_per_line
+
+   Set LINESCAN_BENCH_MIN_TIME (seconds, default 0.02) to trade run time for
+   stability.
+*/
+
+#define _GNU_SOURCE
+
+#include <linescan.h>
+#include <time.h>
+
+#ifndef LINESCAN_BENCH_VERSION
+#define LINESCAN_BENCH_VERSION "unknown"
+#endif
+
+static const char DELIM = ',';
+
+typedef struct bench_config {
+  const char* benchmark;
+  size_t buffer_size;
+  size_t line_length;
+  // Fraction of delimiters among the characters of a line
+  double density;
+  // Offset of the buffer from a 64-byte boundary
+  size_t alignment;
+} bench_config;
+
+typedef struct bench_input {
+  char* mem;
+  char* buf;
+  size_t n;
+  size_t lines;
+  linescan* r;
+  linescan_index* index;
+  linescan_adaptive adaptive;
+  // Every line as a buffer of its own, for linescan_find_batch
+  const char** bufs;
+  size_t* ns;
+  linescan_batch* batch;
+} bench_input;
+
+typedef size_t (*bench_fn)(bench_input* in);
+
+static double bench_min_time = 0.02;
+
+static double bench_now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_input_init(bench_input* in, const bench_config* c){
+  in->mem = aligned_alloc(64, c->buffer_size + 128);
+  in->buf = in->mem + c->alignment;
+  in->n = c->buffer_size / c->line_length * c->line_length;
+  in->lines = in->n / c->line_length;
+  size_t every = c->density > 0 ? (size_t)(1.0 / c->density + 0.5) : 0;
+  for(size_t i = 0; i < in->n; i++){
+    size_t col = i % c->line_length;
+    if(col == c->line_length - 1) in->buf[i] = '\n';
+    else if(every > 0 && col % every == every - 1) in->buf[i] = DELIM;
+    else in->buf[i] = 'a' + i % 26;
+  }
+  // strpbrk needs a terminated string
+  in->buf[in->n] = '\0';
+  in->r = linescan_create(c->line_length + 2);
+  // Grows to its final size during the warm-up run
+  in->index = linescan_index_create(1024, 1024);
+  // Trials run during the warm-up run
+  linescan_adaptive_init(&in->adaptive);
+  in->bufs = malloc(in->lines * sizeof(const char*));
+  in->ns = malloc(in->lines * sizeof(size_t));
+  for(size_t i = 0; i < in->lines; i++){
+    in->bufs[i] = in->buf + i * c->line_length;
+    in->ns[i] = c->line_length;
+  }
+  in->batch = linescan_batch_create(1024, 1024);
+}
+
+static void bench_input_free(bench_input* in){
+  free(in->mem);
+  linescan_free(in->r);
+  linescan_index_free(in->index);
+  free(in->bufs);
+  free(in->ns);
+  linescan_batch_free(in->batch);
+}
+
+static size_t bench_find(bench_input* in){
+  uint64_t cmask = linescan_create_mask(DELIM);
+  size_t lines = 0;
+  for(size_t pos = 0; pos < in->n; lines++){
+    linescan_find(in->buf + pos, cmask, in->n - pos, in->r);
+    pos += in->r->size;
+  }
+  return lines;
+}
+
+static size_t bench_find_adaptive(bench_input* in){
+  uint64_t cmask = linescan_create_mask(DELIM);
+  size_t lines = 0;
+  for(size_t pos = 0; pos < in->n; lines++){
+    linescan_find_adaptive(in->buf + pos, cmask, in->n - pos, in->r, &in->adaptive);
+    pos += in->r->size;
+  }
+  return lines;
+}
+
+/* Compare with bench_find, which reuses one scanner for the same lines but lets
+   every search run up to the end of the buffer instead of the end of the line. */
+static size_t bench_find_batch(bench_input* in){
+  linescan_find_batch(in->bufs, in->ns, in->lines, linescan_create_mask(DELIM), in->batch);
+  return in->batch->buffers_n;
+}
+
+static size_t bench_rfind(bench_input* in){
+  uint64_t cmask = linescan_create_mask(DELIM);
+  size_t lines = 0;
+  // Skip the final newline, every search ends at the newline of the previous line
+  for(size_t end = in->n - 1; end > 0; lines++){
+    linescan_rfind(in->buf, cmask, end, in->r);
+    end -= in->r->size;
+  }
+  return lines;
+}
+
+static size_t bench_find_all(bench_input* in){
+  linescan_find_all(in->buf, linescan_create_mask(DELIM), in->n, in->index);
+  return in->index->lines_n;
+}
+
+static size_t bench_memchr(bench_input* in){
+  size_t lines = 0;
+  for(const char* p = in->buf; p < in->buf + in->n; lines++){
+    p = (const char*)memchr(p, '\n', in->buf + in->n - p) + 1;
+  }
+  return lines;
+}
+
+static size_t bench_memrchr(bench_input* in){
+  size_t lines = 0;
+  for(size_t end = in->n - 1; end > 0; lines++){
+    const char* p = memrchr(in->buf, '\n', end);
+    end = p == NULL ? 0 : (size_t)(p - in->buf);
+  }
+  return lines;
+}
+
+static size_t bench_strpbrk(bench_input* in){
+  size_t lines = 0;
+  for(const char* p = in->buf; (p = strpbrk(p, ",\n")) != NULL; p++){
+    lines += *p == '\n';
+  }
+  return lines;
+}
+
+typedef struct bench_function {
+  const char* name;
+  bench_fn fn;
+  // Runs once per kernel
+  int kernels;
+} bench_function;
+
+static const bench_function bench_functions[] = {
+  { "linescan_find", bench_find, 1 },
+  { "linescan_rfind", bench_rfind, 1 },
+  { "linescan_find_all", bench_find_all, 1 },
+  { "linescan_find_batch", bench_find_batch, 1 },
+  // Kernel column: kernel chosen by the adaptive scanner
+  { "linescan_find_adaptive", bench_find_adaptive, 0 },
+  { "memchr", bench_memchr, 0 },
+  { "memrchr", bench_memrchr, 0 },
+  { "strpbrk", bench_strpbrk, 0 },
+};
+
+static void bench_run(const bench_config* c, bench_input* in, const bench_function* f,
+		      const char* kernel){
+  // Warm up caches and page tables
+  size_t lines = f->fn(in);
+  if(lines != in->lines){
+    fprintf(stderr, "%s: found %zu lines, expected %zu\n", f->name, lines, in->lines);
+  }
+
+  size_t iterations = 0;
+  double start = bench_now();
+  double elapsed;
+  do {
+    f->fn(in);
+    iterations++;
+    elapsed = bench_now() - start;
+  } while(elapsed < bench_min_time);
+
+  if(f->fn == bench_find_adaptive) kernel = linescan_kernel_name(in->adaptive.kernel);
+  printf("%s,%s,%s,%s,%zu,%zu,%.4f,%zu,%zu,%.6f,%.3f,%.3f\n",
+	 LINESCAN_BENCH_VERSION, c->benchmark, f->name, kernel,
+	 in->n, c->line_length, c->density, c->alignment,
+	 iterations, elapsed,
+	 (double)in->n * iterations / elapsed * 1e-9,
+	 elapsed * 1e9 / ((double)in->lines * iterations));
+  fflush(stdout);
+}
+
+static void bench_all(const bench_config* c){
+  bench_input in;
+  bench_input_init(&in, c);
+  for(size_t i = 0; i < sizeof(bench_functions) / sizeof(bench_functions[0]); i++){
+    const bench_function* f = &bench_functions[i];
+    if(!f->kernels){
+      bench_run(c, &in, f, "");
+      continue;
+    }
+    for(int k = LINESCAN_KERNEL_SWAR; k < LINESCAN_KERNEL_N; k++){
+      if(linescan_set_kernel((linescan_kernel)k) != 0) continue;
+      bench_run(c, &in, f, linescan_kernel_name((linescan_kernel)k));
+    }
+    linescan_set_kernel(LINESCAN_KERNEL_AUTO);
+  }
+  bench_input_free(&in);
+}
+
+int main(void){
+  const char* min_time = getenv("LINESCAN_BENCH_MIN_TIME");
+  if(min_time != NULL) bench_min_time = atof(min_time);
+
+  const size_t l1 = 16 << 10;
+  const size_t l2 = 256 << 10;
+  const size_t llc = 8 << 20;
+  const size_t dram = 256 << 20;
+  const size_t line_lengths[] = { 16, 64, 256, 4096 };
+  const double densities[] = { 0, 1.0 / 32, 1.0 / 8, 1.0 / 4, 1.0 / 2 };
+  const size_t buffer_sizes[] = { l1, l2, llc, dram };
+
+  printf("version,benchmark,function,kernel,buffer_size,line_length,density,alignment,"
+	 "iterations,seconds,gb_per_s,ns_per_line\n");
+
+  for(size_t i = 0; i < sizeof(line_lengths) / sizeof(line_lengths[0]); i++){
+    bench_config c = { "line_length", l2, line_lengths[i], 1.0 / 16, 0 };
+    bench_all(&c);
+  }
+  for(size_t i = 0; i < sizeof(densities) / sizeof(densities[0]); i++){
+    bench_config c = { "density", l2, 256, densities[i], 0 };
+    bench_all(&c);
+  }
+  // Unaligned starts exercise the Step 1 prologue of the word kernel
+  for(size_t alignment = 0; alignment < 8; alignment++){
+    bench_config c = { "alignment", l1, 64, 1.0 / 16, alignment };
+    bench_all(&c);
+  }
+  for(size_t i = 0; i < sizeof(buffer_sizes) / sizeof(buffer_sizes[0]); i++){
+    bench_config c = { "buffer_size", buffer_sizes[i], 256, 1.0 / 16, 0 };
+    bench_all(&c);
+  }
+  return 0;
+}
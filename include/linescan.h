@@ -1,3 +1,6 @@
+#ifndef LINESCAN_H
+#define LINESCAN_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -35,6 +38,12 @@ extern "C" {
     size_t offsets_n;
     // Maximum number of offsets to store (not enforced)
     size_t offsets_size;
+    /* Set to 1 to validate UTF-8 while linescan_find and linescan_find_term
+       search a line (0 after linescan_create) */
+    int utf8;
+    /* Offset of the first invalid or truncated UTF-8 sequence in [0, size);
+       size if the line is valid. Only written if utf8 is set. */
+    size_t utf8_invalid;
 
     #ifdef LINESCAN_DEBUG
     size_t debug_steps_1;
@@ -48,6 +57,118 @@ extern "C" {
   void linescan_free(linescan* r);
   void linescan_reset(linescan* r);
 
+  /* Container for linescan_find_all results. Lines and their offsets are stored in
+     compressed sparse row format: the offsets of line i are
+     offsets[lines[i]] .. offsets[lines[i+1] - 1], laid out like linescan.offsets
+     (line start, cmask matches, newline). All offsets are relative to buf. */
+  typedef struct linescan_index {
+    // Input search buffer
+    const char* buf;
+    // Number of characters between buf and the end of the last complete line
+    size_t size;
+    // Offsets of all lines
+    size_t* offsets;
+    // Number of offsets found
+    size_t offsets_n;
+    // Capacity of offsets (grows on demand)
+    size_t offsets_size;
+    /* Position of the first offset of every line in offsets.
+       Contains lines_n + 1 entries; lines[lines_n] == offsets_n */
+    size_t* lines;
+    // Number of complete lines found
+    size_t lines_n;
+    // Capacity of lines (grows on demand)
+    size_t lines_size;
+  } linescan_index;
+
+  linescan_index* linescan_index_create(size_t offsets_size, size_t lines_size);
+  void linescan_index_free(linescan_index* index);
+  void linescan_index_reset(linescan_index* index);
+
+  /* Container for linescan_find_bitmap results. Bit (i % 64) of word (i / 64) is set
+     if buf[i] matches cmask (delims) or is a newline (newlines). */
+  typedef struct linescan_bitmap {
+    // Input search buffer
+    const char* buf;
+    // Number of characters covered by the bitmaps
+    size_t size;
+    // cmask matches, one bit per character
+    uint64_t* delims;
+    // Newlines, one bit per character
+    uint64_t* newlines;
+    // Capacity of delims and newlines in words (grows on demand)
+    size_t words_size;
+  } linescan_bitmap;
+
+  // @param[size] Initial capacity in characters
+  linescan_bitmap* linescan_bitmap_create(size_t size);
+  void linescan_bitmap_free(linescan_bitmap* bm);
+  void linescan_bitmap_reset(linescan_bitmap* bm);
+
+  /* Caller-supplied memory block that result arrays can be carved from. 
+     Allocations are never freed individually; reset the arena to reuse it. */
+  typedef struct linescan_arena {
+    char* base;
+    size_t size;
+    size_t used;
+  } linescan_arena;
+
+  void linescan_arena_init(linescan_arena* arena, void* base, size_t size);
+  void linescan_arena_reset(linescan_arena* arena);
+  /* @returns Pointer to size bytes aligned to align (a power of 2); NULL if
+     the arena is exhausted. */
+  void* linescan_arena_alloc(linescan_arena* arena, size_t size, size_t align);
+
+  // Bytes per offset stored in linescan_bounded
+  typedef enum linescan_width {
+    LINESCAN_WIDTH_16 = 2,
+    LINESCAN_WIDTH_32 = 4,
+    LINESCAN_WIDTH_64 = 8
+  } linescan_width;
+
+  // Return code of linescan_find_bounded if offsets ran out of capacity
+  #define LINESCAN_FULL 2
+
+  /* Container for linescan_find_bounded results. Unlike linescan, offsets_size is
+     enforced and offsets can be stored in 16 or 32 bits. */
+  typedef struct linescan_bounded {
+    // Input search buffer
+    const char* buf;
+    /* Number of characters between buf and end of search. If the search stopped
+       with LINESCAN_FULL, the search continues at (buf + size). */
+    size_t size;
+    /* Offsets laid out like linescan.offsets; array of uint16_t, uint32_t or 
+       uint64_t depending on width. Use linescan_bounded_offset to read them. */
+    void* offsets;
+    // Number of offsets found (including start and end locations)
+    size_t offsets_n;
+    // Maximum number of offsets to store
+    size_t offsets_size;
+    // Bytes per offset
+    linescan_width width;
+    // If not NULL, offsets grow from this arena instead of stopping the search
+    linescan_arena* arena;
+  } linescan_bounded;
+
+  /* @param[offsets_size] Capacity; must be >= 2
+     @param[width] Bytes per offset
+     @param[arena] Arena to allocate offsets from; NULL to allocate offsets 
+     once with calloc and never grow them.
+     @returns NULL if offsets could not be allocated (e.g. the arena is exhausted).
+  */
+  linescan_bounded* linescan_bounded_create(size_t offsets_size, linescan_width width,
+					    linescan_arena* arena);
+  void linescan_bounded_free(linescan_bounded* r);
+  void linescan_bounded_reset(linescan_bounded* r);
+
+  static inline size_t linescan_bounded_offset(const linescan_bounded* r, size_t i){
+    switch(r->width){
+    case LINESCAN_WIDTH_16: return ((const uint16_t*)r->offsets)[i];
+    case LINESCAN_WIDTH_32: return ((const uint32_t*)r->offsets)[i];
+    default: return (size_t)((const uint64_t*)r->offsets)[i];
+    }
+  }
+
   /* Create mask to speed up character searches.
      @param[c] Character to create mask for.
      @returns Word containing c in every byte.
@@ -55,7 +176,9 @@ extern "C" {
   uint64_t linescan_create_mask(char c);
 
   /* Search buffer left-to-right for occurences of character (described by cmask) for
-     max n characters or until newline \n is encountered.
+     max n characters or until newline \n is encountered. The vector kernels load
+     the last partial vector of a short buffer past buf + n, but never across a page
+     boundary, so buf may end right at the end of a mapping.
      @param[buf] Buffer to search
      @param[cmask] Character mask to match (see linescan_create_mask).
      @param[n] Maximum number of characters to search; must be >= 0
@@ -74,6 +197,455 @@ extern "C" {
   */
   int linescan_rfind(const char* buf, uint64_t cmask, size_t n, linescan* result);
 
+  /* Like linescan_find and linescan_rfind, but lines end with the terminator
+     described by tmask instead of newline (e.g. '\0' for find -print0 lists or
+     0x1e for RS framed records). Run on the same kernels as linescan_find.
+     @param[tmask] Terminator mask (see linescan_create_mask); must differ from cmask
+  */
+  int linescan_find_term(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+  int linescan_rfind_term(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+
+  /* Like linescan_find for lines ending with \r\n. If the newline follows a \r,
+     the last offset points to the \r, so the last field ends in front of it;
+     result->size still includes the \r\n. Lines ending with a bare \n are
+     reported like linescan_find does.
+     @param[cmask] Character mask to match; must not match \r
+  */
+  int linescan_find_crlf(const char* buf, uint64_t cmask, size_t n, linescan* result);
+  /* Search buffer left-to-right for all lines and their occurences of character
+     (described by cmask) in a single pass. Characters after the last newline are
+     not indexed. index arrays are grown as needed.
+     @param[buf] Buffer to search
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[n] Number of characters to search; must be >= 0
+     @param[index] Index to which results are written.
+     @returns 1 if buf ends with a newline (all n characters are indexed); 0 if characters 
+     remain after the last newline. -1 indicates an error.
+  */
+  int linescan_find_all(const char* buf, uint64_t cmask, size_t n, linescan_index* index);
+  /* Search buffer for all occurences of character (described by cmask) and newline \n,
+     storing one bit per character. The compare results of the kernels are written
+     directly, no offsets are materialized. Bitmaps are grown as needed.
+     @param[buf] Buffer to search
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[n] Number of characters to search; must be >= 0
+     @param[bm] Bitmaps to which results are written.
+     @returns 1 if buf ends with a newline; 0 otherwise. -1 indicates an error.
+  */
+  int linescan_find_bitmap(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm);
+  /* Same as linescan_find, but never stores more than result->offsets_size offsets.
+     If offsets are full and cannot be grown from result->arena, the search stops
+     after the last stored match and can be resumed at (buf + result->size); 
+     offsets[0] of the resumed search is then the start of the next field. The
+     search also stops if the next offset would not fit into result->width bytes.
+     @param[buf] Buffer to search
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[n] Maximum number of characters to search; must be >= 0
+     @param[result] Struct to which results are written.
+     @returns 1 if newline is encountered; 0 if no newline was found after n steps;
+     LINESCAN_FULL if the search stopped early. -1 indicates an error.
+  */
+  int linescan_find_bounded(const char* buf, uint64_t cmask, size_t n, linescan_bounded* result);
+
+  /* Container for linescan_find_projection results: spans of selected fields of
+     a line. Fields are numbered from 0 and separated by cmask matches. */
+  typedef struct linescan_projection {
+    // Input search buffer
+    const char* buf;
+    // Number of characters between buf and end of search
+    size_t size;
+    // Wanted field numbers in ascending order, without duplicates
+    size_t* columns;
+    // Number of wanted fields
+    size_t columns_n;
+    /* Field columns[i] covers the characters from spans[2*i] up to (excluding)
+       spans[2*i+1], relative to buf. Holds 2 * columns_n entries. */
+    size_t* spans;
+    /* Number of wanted fields found; the line has fewer fields than columns[spans_n].
+       Spans of fields not found are undefined. */
+    size_t spans_n;
+  } linescan_projection;
+
+  /* @param[columns] Wanted field numbers, in any order; duplicates are ignored
+     @param[columns_n] Number of entries in columns
+     @returns New projection; NULL on error.
+  */
+  linescan_projection* linescan_projection_create(const size_t* columns, size_t columns_n);
+  void linescan_projection_free(linescan_projection* p);
+  void linescan_projection_reset(linescan_projection* p);
+
+  /* Search a line like linescan_find, but store the spans of the wanted fields
+     only. Once the last wanted field is closed, the rest of the line is searched
+     for the newline alone (memchr).
+     @param[buf] Buffer to search
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[n] Maximum number of characters to search; must be >= 0
+     @param[p] Projection to which results are written.
+     @returns 1 if newline is encountered; 0 if no newline was found after n steps
+     (the last field then ends at n). -1 indicates an error.
+  */
+  int linescan_find_projection(const char* buf, uint64_t cmask, size_t n, linescan_projection* p);
+
+  /* Container for linescan_count and linescan_count_all results. Only counts are
+     stored, no offsets. */
+  typedef struct linescan_counts {
+    // Input search buffer
+    const char* buf;
+    // Number of characters between buf and end of search
+    size_t size;
+    // Number of newlines found
+    size_t lines_n;
+    // Number of cmask matches found
+    size_t delims_n;
+    /* Maximum number of fields (cmask matches + 1) of a line, including the
+       characters after the last newline if there are any */
+    size_t fields_max;
+  } linescan_counts;
+
+  /* Count occurences of character (described by cmask) like linescan_find does,
+     without storing their offsets.
+     @param[buf] Buffer to search
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[n] Maximum number of characters to search; must be >= 0
+     @param[counts] Struct to which results are written; lines_n is 1 if the
+     newline was found, 0 otherwise.
+     @returns 1 if newline is encountered; 0 if no newline was found after n steps. -1 indicates an error.
+  */
+  int linescan_count(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts);
+  /* Count all lines and occurences of character (described by cmask) in buf,
+     using the popcount of the kernel compare results. Can be used to size
+     the result arrays of linescan_find_all exactly before the search.
+     @param[buf] Buffer to search
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[n] Number of characters to search; must be >= 0
+     @param[counts] Struct to which results are written.
+     @returns 1 if buf ends with a newline; 0 otherwise. -1 indicates an error.
+  */
+  int linescan_count_all(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts);
+
+  /* Quote state of linescan_find_quoted, linescan_find_all_quoted and
+     linescan_find_bitmap_quoted (RFC 4180 CSV). Matches and newlines between
+     a quote and the next quote are not reported; an escaped quote ("") closes
+     and reopens the quoted section, so it needs no special treatment. */
+  typedef struct linescan_quote {
+    // Quote character mask (see linescan_create_mask)
+    uint64_t qmask;
+    /* ~0 if the search continues inside a quoted section, 0 otherwise.
+       Updated by every search to the state where the next search continues. */
+    uint64_t inside;
+  } linescan_quote;
+
+  // Sets the quote character and starts outside of quotes.
+  void linescan_quote_init(linescan_quote* q, char quote);
+
+  /* Same as linescan_find, but ignores cmask matches and newlines inside quotes.
+     If no newline is found, q describes the state at (buf + n), so the line can
+     be continued in the next buffer.
+     @param[cmask] Character mask to match; must differ from q->qmask
+     @param[q] Quote state at buf, updated to the state at (buf + result->size).
+  */
+  int linescan_find_quoted(const char* buf, uint64_t cmask, size_t n, linescan* result,
+			   linescan_quote* q);
+  /* Same as linescan_find_all, but ignores cmask matches and newlines inside quotes.
+     @param[q] Quote state at buf, updated to the state at (buf + index->size).
+  */
+  int linescan_find_all_quoted(const char* buf, uint64_t cmask, size_t n, linescan_index* index,
+			       linescan_quote* q);
+  /* Same as linescan_find_bitmap, but clears the bits of cmask matches and newlines
+     inside quotes. Buffers split at arbitrary positions can be searched one
+     after another with the same q.
+     @param[q] Quote state at buf, updated to the state at (buf + n).
+  */
+  int linescan_find_bitmap_quoted(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm,
+				  linescan_quote* q);
+
+  /* Delimiter of 1 to 8 characters (e.g. "||" or "::") for linescan_find_delim
+     and linescan_find_all_delim. */
+  typedef struct linescan_delim {
+    char chars[8];
+    size_t n;
+    // Masks of the first and the last character (see linescan_create_mask)
+    uint64_t first;
+    uint64_t last;
+  } linescan_delim;
+
+  /* @param[d] Delimiter to initialize
+     @param[chars] Characters of the delimiter; must not contain a newline
+     @param[n] Number of characters; must be between 1 and 8
+     @returns 0 on success; -1 if the delimiter is invalid.
+  */
+  int linescan_delim_init(linescan_delim* d, const char* chars, size_t n);
+
+  /* Same as linescan_find, but matches a multi-character delimiter. Candidates
+     are positions where both the first and the last character match (compared
+     by the block kernels a whole vector at a time), verified with memcmp.
+     Matches do not overlap: the search continues behind every match. Offsets
+     of matches point at the last character of the delimiter, so fields start
+     at (offsets[i] + 1) as with single characters. A field followed by another
+     delimiter ends at (offsets[i + 1] - d->n + 1).
+  */
+  int linescan_find_delim(const char* buf, const linescan_delim* d, size_t n, linescan* result);
+  // Same as linescan_find_all, but matches a multi-character delimiter (see linescan_find_delim).
+  int linescan_find_all_delim(const char* buf, const linescan_delim* d, size_t n, linescan_index* index);
+
+  /* Tests of linescan_predicate */
+  typedef enum linescan_predicate_op {
+    // Field equals value
+    LINESCAN_PREDICATE_EQUAL,
+    // Field starts with value
+    LINESCAN_PREDICATE_PREFIX,
+    // Field contains at least one of the characters of value
+    LINESCAN_PREDICATE_BYTES
+  } linescan_predicate_op;
+
+  /* Condition on one field of a line for linescan_find_all_filter. */
+  typedef struct linescan_predicate {
+    // Field number (starting at 0)
+    size_t field;
+    linescan_predicate_op op;
+    // Compared characters (EQUAL and PREFIX); not copied
+    const char* value;
+    size_t value_n;
+    // Bit c is set for every character c of value (BYTES)
+    uint64_t bytes[4];
+  } linescan_predicate;
+
+  /* @param[p] Predicate to initialize
+     @param[field] Field number (starting at 0)
+     @param[op] Test to apply to the field
+     @param[value] Characters to compare to; must stay valid while p is used
+     @param[value_n] Number of characters of value
+  */
+  void linescan_predicate_init(linescan_predicate* p, size_t field, linescan_predicate_op op,
+			       const char* value, size_t value_n);
+
+  /* Same as linescan_find_all, but stores only lines whose field p->field passes
+     the test of p. Every line is searched only up to the end of that field; if
+     the test fails (or the line has fewer fields), the search continues behind
+     the next newline, found with memchr. Offsets of passing lines are complete.
+     @param[p] Predicate to test
+     @returns 1 if buf ends with a newline (all n characters are searched); 0 if characters
+     remain after the last newline. index->size is the end of the last complete line,
+     whether it passed or not. -1 indicates an error.
+  */
+  int linescan_find_all_filter(const char* buf, uint64_t cmask, size_t n, const linescan_predicate* p,
+			       linescan_index* index);
+
+  /* Set of characters, split into classes, for linescan_find_class. Membership
+     is looked up by nibbles: c is in the set if bit (c >> 4) % 8 of
+     (lo[t][c & 15] & hi[t][c >> 4]) is set, where t = c >> 7. As every bit stands
+     for one high nibble, the lookup is exact for any set of characters. */
+  typedef struct linescan_class {
+    uint8_t lo[2][16];
+    uint8_t hi[2][16];
+    // Number of tables in use: 2 if the set holds characters >= 0x80, 1 otherwise
+    size_t tables;
+    // Class number + 1 of every character; 0 for characters not in the set
+    uint8_t classes[256];
+    size_t classes_n;
+  } linescan_class;
+
+  // Starts with an empty set.
+  void linescan_class_init(linescan_class* cl);
+  /* Add a class of characters (e.g. all field separators of key=value;... logs).
+     @param[cl] Set to add the class to
+     @param[chars] Characters of the class
+     @param[n] Number of characters
+     @returns Class number (starting at 0); -1 if a character is in another class
+     already or there are 255 classes.
+  */
+  int linescan_class_add(linescan_class* cl, const char* chars, size_t n);
+
+  /* Container for linescan_find_class results */
+  typedef struct linescan_hits {
+    // Input search buffer
+    const char* buf;
+    // Number of characters searched
+    size_t size;
+    // Offsets of the characters in the set
+    size_t* offsets;
+    // Class number of every hit
+    uint8_t* classes;
+    // Number of hits found
+    size_t hits_n;
+    // Capacity of offsets and classes (grows on demand)
+    size_t hits_size;
+  } linescan_hits;
+
+  linescan_hits* linescan_hits_create(size_t hits_size);
+  void linescan_hits_free(linescan_hits* hits);
+  void linescan_hits_reset(linescan_hits* hits);
+
+  /* Search buffer for all characters of a set in one pass. The AVX2 and AVX-512BW
+     kernels classify a vector at once with two byte shuffles per nibble table
+     (vpshufb); the other kernels look up every character.
+     @param[buf] Buffer to search
+     @param[cl] Set of characters to find
+     @param[n] Number of characters to search; must be >= 0
+     @param[hits] Struct to which the offsets and classes of all hits are written.
+     @returns 0 on success; -1 indicates an error.
+  */
+  int linescan_find_class(const char* buf, const linescan_class* cl, size_t n, linescan_hits* hits);
+
+  /* Container for linescan_find_batch results, one linescan_find per buffer in
+     structure-of-arrays layout. The offsets of buffer i are
+     offsets[starts[i]] .. offsets[starts[i+1] - 1], laid out like linescan.offsets
+     and relative to buffer i. */
+  typedef struct linescan_batch {
+    // Offsets of all buffers
+    size_t* offsets;
+    // Number of offsets found
+    size_t offsets_n;
+    // Capacity of offsets (grows on demand)
+    size_t offsets_size;
+    // Index of the first offset of every buffer; buffers_n + 1 entries
+    size_t* starts;
+    // Number of characters searched in every buffer, up to and including the newline
+    size_t* sizes;
+    // Return code of linescan_find for every buffer: 1 if a newline was found, 0 if not
+    int8_t* status;
+    // Number of buffers searched
+    size_t buffers_n;
+    // Capacity of starts, sizes and status (grows on demand)
+    size_t buffers_size;
+  } linescan_batch;
+
+  linescan_batch* linescan_batch_create(size_t buffers_size, size_t offsets_size);
+  void linescan_batch_free(linescan_batch* batch);
+  void linescan_batch_reset(linescan_batch* batch);
+
+  /* Search many independent buffers (e.g. one message each) for their first line,
+     like one linescan_find per buffer. Buffers are taken in groups of four: the
+     first 64 characters of all buffers of a group are compared before any result
+     is used, so their loads overlap, and lines ending within them are stored
+     straight from the bitmaps. Buffers with longer lines are searched again as a
+     whole, one at a time. The next group is prefetched meanwhile; dispatch, checks
+     and statistics are done once per call, and all results go to one arena.
+     @param[bufs] Buffers to search
+     @param[ns] Number of characters to search in every buffer
+     @param[buffers_n] Number of buffers
+     @param[cmask] Mask of character to search for (see linescan_create_mask)
+     @param[batch] Struct to which the results are written; room for ns[i] + 1
+     offsets is reserved while buffer i is searched.
+     @returns 0 on success; -1 indicates an error.
+  */
+  int linescan_find_batch(const char* const* bufs, const size_t* ns, size_t buffers_n, uint64_t cmask,
+			  linescan_batch* batch);
+
+  /* Position of the first set bit at or after pos.
+     @param[bits] Bitmap (e.g. linescan_bitmap.delims)
+     @param[size] Number of valid bits
+     @param[pos] Search start
+     @returns Position of the bit; size if there is none.
+  */
+  static inline size_t linescan_bitmap_next(const uint64_t* bits, size_t size, size_t pos){
+    if(pos >= size) return size;
+    size_t w = pos / 64;
+    uint64_t word = bits[w] & (~(uint64_t)0 << (pos % 64));
+    size_t words = (size + 63) / 64;
+    while(word == 0){
+      if(++w == words) return size;
+      word = bits[w];
+    }
+    size_t next = w * 64 + __builtin_ctzll(word);
+    return next < size ? next : size;
+  }
+  // @returns Position of the first newline at or after pos; bm->size if there is none.
+  static inline size_t linescan_bitmap_next_line(const linescan_bitmap* bm, size_t pos){
+    return linescan_bitmap_next(bm->newlines, bm->size, pos);
+  }
+  /* @returns Position of the first cmask match or newline at or after pos (i.e. the end of
+     the field containing pos); bm->size if there is none. */
+  static inline size_t linescan_bitmap_next_field(const linescan_bitmap* bm, size_t pos){
+    size_t d = linescan_bitmap_next(bm->delims, bm->size, pos);
+    return linescan_bitmap_next(bm->newlines, d, pos);
+  }
+
+  /* Count cmask matches in [from, to) using popcount.
+     @returns Number of set bits in bm->delims between from and to.
+  */
+  size_t linescan_bitmap_count(const linescan_bitmap* bm, size_t from, size_t to);
+  /* Select the k-th (starting at 0) cmask match at or after from.
+     @returns Position of the match; bm->size if there are less than k + 1 matches.
+  */
+  size_t linescan_bitmap_select(const linescan_bitmap* bm, size_t from, size_t k);
+  /* Locate field k (starting at 0) of the line starting at line_start, without visiting
+     the preceding fields one by one.
+     @param[start] Set to the position of the first character of the field.
+     @param[end] Set to the position of the terminating cmask match, newline or bm->size.
+     @returns 1 if the field exists; 0 if the line has less than k + 1 fields.
+  */
+  int linescan_bitmap_field(const linescan_bitmap* bm, size_t line_start, size_t k,
+			    size_t* start, size_t* end);
+
+  /* Kernels implementing the search functions above */
+  typedef enum linescan_kernel {
+    // Best kernel supported by the running CPU
+    LINESCAN_KERNEL_AUTO = 0,
+    // Portable 8-byte word kernel (see glibc memchr)
+    LINESCAN_KERNEL_SWAR,
+    // x86 vector kernels comparing 16/32/64 bytes at once
+    LINESCAN_KERNEL_SSE2,
+    LINESCAN_KERNEL_AVX2,
+    LINESCAN_KERNEL_AVX512BW,
+    LINESCAN_KERNEL_N
+  } linescan_kernel;
+
+  /* The best supported kernel is selected once at load time. Switching kernels
+     is not thread-safe and should happen before any search is started.
+     @param[kernel] Kernel to use for all subsequent searches.
+     @returns 0 on success; -1 if kernel is not supported by the running CPU.
+  */
+  int linescan_set_kernel(linescan_kernel kernel);
+  // @returns Kernel currently in use (never LINESCAN_KERNEL_AUTO).
+  linescan_kernel linescan_get_kernel(void);
+  // @returns 1 if kernel can run on this CPU, 0 otherwise.
+  int linescan_kernel_supported(linescan_kernel kernel);
+  // @returns Short name of kernel, NULL if kernel is invalid.
+  const char* linescan_kernel_name(linescan_kernel kernel);
+
+  /* State of an adaptive scanner. Unless a kernel was pinned with
+     linescan_set_kernel, the scanner times every supported kernel, the portable
+     word kernel included, on a trial window of calls and keeps the fastest per
+     character. Mean line length and delimiter density are sampled in every
+     window; once either differs by more than a factor of 2 from the trials, the
+     trials are repeated, and their winner only replaces the kernel in use if
+     it is more than 1/8 faster. */
+  typedef struct linescan_adaptive {
+    // Kernel in use
+    linescan_kernel kernel;
+    // Kernel on trial; LINESCAN_KERNEL_AUTO outside of trials
+    linescan_kernel trial;
+    // Nanoseconds per 1024 characters of every kernel in the last trials
+    uint64_t costs[LINESCAN_KERNEL_N];
+    // Calls, complete lines, characters and delimiters in the current window
+    size_t calls;
+    size_t lines;
+    size_t bytes;
+    size_t matches;
+    // Nanoseconds spent in the kernel on trial during the current window
+    uint64_t elapsed;
+    // Mean line length and delimiters per 1024 characters of the last trial window
+    size_t length;
+    size_t density;
+    // Number of windows outside of trials and number of completed trials
+    size_t windows;
+    size_t trials;
+  } linescan_adaptive;
+
+  void linescan_adaptive_init(linescan_adaptive* a);
+
+  /* Same as linescan_find, with the kernel chosen by an adaptive scanner (see
+     linescan_adaptive). Use one state per stream of lines; the chosen kernels
+     are counted in linescan_stats.adaptive_kernels.
+     @param[a] State of the adaptive scanner
+     @returns Same as linescan_find
+  */
+  int linescan_find_adaptive(const char* buf, uint64_t cmask, size_t n, linescan* result,
+			     linescan_adaptive* a);
+
 #ifdef __cplusplus
 }
 #endif
+
+#endif
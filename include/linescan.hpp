@@ -0,0 +1,171 @@
+#ifndef LINESCAN_HPP
+#define LINESCAN_HPP
+
+#if __cplusplus < 201703L
+#error "linescan.hpp requires C++17"
+#endif
+
+#include <linescan.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+/* Header-only C++ front end. Delimiter and terminator are template parameters,
+   so their masks are compile-time constants and every scanner<delim, term>
+   gets its own inlined kernel. The kernel is the portable word kernel of
+   linescan_find_bitmap (linescan.c), searching 64 characters per step.
+   The C functions of linescan.h remain available alongside; the namespace is
+   called linescanpp since linescan already names the C result type. */
+
+namespace linescanpp {
+
+  namespace detail {
+
+    constexpr uint64_t ONES = 0x0101010101010101ull;
+    constexpr uint64_t HIGHS = 0x8080808080808080ull;
+
+    constexpr uint64_t mask(char c){
+      return ONES * static_cast<unsigned char>(c);
+    }
+
+    // 0x80 in every byte of w that is zero, 0x00 in all other bytes
+    inline uint64_t zero_bytes(uint64_t w){
+      const uint64_t low_7 = ~HIGHS;
+      return ~(((w & low_7) + low_7) | w | low_7);
+    }
+
+    // High bits of all bytes in the low 8 bits (bit i = byte i)
+    inline uint64_t movemask(uint64_t w){
+      return ((w >> 7) * 0x0102040810204080ull) >> 56;
+    }
+
+    /* Bitmaps of delimiters and terminators in n <= 64 characters
+       (see linescan_block_swar). */
+    template<char Delim, char Term>
+    inline void block(const char* b, size_t n, uint64_t& m_d, uint64_t& m_t){
+      constexpr uint64_t delim_mask = mask(Delim);
+      constexpr uint64_t term_mask = mask(Term);
+      uint64_t d = 0;
+      uint64_t t = 0;
+      size_t j = 0;
+      for(; n - j >= 8; j += 8){
+	uint64_t x;
+	std::memcpy(&x, b + j, 8);
+	d |= movemask(zero_bytes(x ^ delim_mask)) << j;
+	t |= movemask(zero_bytes(x ^ term_mask)) << j;
+      }
+      for(; j < n; j++){
+	if(b[j] == Delim) d |= uint64_t(1) << j;
+	else if(b[j] == Term) t |= uint64_t(1) << j;
+      }
+      m_d = d;
+      m_t = t;
+    }
+
+  }
+
+  template<char Delim, char Term> class scanner;
+
+  /* Fields of one line, stored in place without heap allocation. Holds up to
+     N fields; further fields are counted but not stored. Views point into the
+     searched buffer. */
+  template<size_t N>
+  class line {
+  public:
+    using iterator = const std::string_view*;
+
+    // Stored fields
+    iterator begin() const { return fields_.data(); }
+    iterator end() const { return fields_.data() + stored(); }
+    const std::string_view& operator[](size_t i) const { return fields_[i]; }
+    size_t stored() const { return fields_n_ < N ? fields_n_ : N; }
+    // Number of fields in the line, including the ones not stored
+    size_t size() const { return fields_n_; }
+    // Line including the terminator
+    std::string_view text() const { return text_; }
+    // False if the search ended before a terminator was found
+    bool terminated() const { return terminated_; }
+
+  private:
+    template<char Delim, char Term> friend class scanner;
+
+    void push(const char* start, size_t len){
+      if(fields_n_ < N) fields_[fields_n_] = std::string_view(start, len);
+      fields_n_++;
+    }
+
+    std::array<std::string_view, N> fields_{};
+    size_t fields_n_ = 0;
+    std::string_view text_;
+    bool terminated_ = false;
+  };
+
+  /* Splits lines ending with Term into fields separated by Delim.
+     Example: linescanpp::scanner<',', '\n'>::find(buf, line) */
+  template<char Delim, char Term = '\n'>
+  class scanner {
+    static_assert(Delim != Term, "delimiter and terminator must differ");
+
+  public:
+    static constexpr uint64_t delim_mask = detail::mask(Delim);
+    static constexpr uint64_t term_mask = detail::mask(Term);
+
+    /* Find the fields of the first line of buf.
+       @param[buf] Characters to search
+       @param[out] Receives the fields; out.text() is the line including the
+       terminator, or all of buf if there is no terminator.
+       @returns true if a terminator was found. */
+    template<size_t N>
+    static bool find(std::string_view buf, line<N>& out) noexcept {
+      const char* b = buf.data();
+      size_t n = buf.size();
+      size_t start = 0;
+
+      out.fields_n_ = 0;
+      for(size_t i = 0; i < n; i += 64){
+	uint64_t m_d;
+	uint64_t m_t;
+	detail::block<Delim, Term>(b + i, n - i < 64 ? n - i : 64, m_d, m_t);
+	// Keep the delimiters in front of the first terminator only
+	if(m_t != 0) m_d &= (m_t & -m_t) - 1;
+	while(m_d != 0){
+	  size_t pos = i + __builtin_ctzll(m_d);
+	  out.push(b + start, pos - start);
+	  start = pos + 1;
+	  m_d &= m_d - 1;
+	}
+	if(m_t != 0){
+	  size_t pos = i + __builtin_ctzll(m_t);
+	  out.push(b + start, pos - start);
+	  out.text_ = std::string_view(b, pos + 1);
+	  out.terminated_ = true;
+	  return true;
+	}
+      }
+      out.push(b + start, n - start);
+      out.text_ = buf;
+      out.terminated_ = false;
+      return false;
+    }
+
+    /* Call f(const line<N>&) for every line of buf, including a last line
+       without terminator.
+       @returns Number of lines. */
+    template<size_t N, typename F>
+    static size_t for_each_line(std::string_view buf, F&& f){
+      line<N> l;
+      size_t lines = 0;
+      while(!buf.empty()){
+	find(buf, l);
+	f(static_cast<const line<N>&>(l));
+	buf.remove_prefix(l.text().size());
+	lines++;
+      }
+      return lines;
+    }
+  };
+
+}
+
+#endif
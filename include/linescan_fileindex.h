@@ -0,0 +1,67 @@
+#ifndef LINESCAN_FILEINDEX_H
+#define LINESCAN_FILEINDEX_H
+
+#include <linescan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  // Store the cmask matches of every line in addition to the line starts
+  #define LINESCAN_FILEINDEX_FIELDS 1
+
+  /* Sidecar index of the complete lines of a file, kept in a separate index file.
+     Lines are grouped into blocks of a fixed number of lines. Every block holds
+     the length of each line and, with LINESCAN_FILEINDEX_FIELDS, the distances
+     between its cmask matches as varints; a directory of block start offsets
+     follows the blocks. Looking up a line decodes at most one block. Integers
+     are stored in host byte order, so index files are not portable between
+     machines of different endianness. */
+  typedef struct linescan_fileindex linescan_fileindex;
+
+  /* Create or update the index of a file. If index_path holds an index of the
+     same file, cmask and flags, and the file only grew, only the characters
+     behind the last indexed line are searched and appended. Otherwise the index
+     is rebuilt. A file counts as grown if it is not shorter than the indexed
+     part and the last 4 KiB of the indexed part are unchanged. Characters
+     after the last newline are not indexed until their line is complete.
+     @param[path] File to index
+     @param[index_path] Index file to create or update
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[flags] Combination of LINESCAN_FILEINDEX_* flags
+     @returns 0 on success; -1 on error (see errno). The index file is not valid
+     after an error and will be rebuilt by the next update.
+  */
+  int linescan_fileindex_update(const char* path, const char* index_path, uint64_t cmask, int flags);
+
+  /* Map a file and its index.
+     @returns New index; NULL on error (see errno). Fails with ESTALE if the
+     indexed part of the file was changed.
+  */
+  linescan_fileindex* linescan_fileindex_open(const char* path, const char* index_path);
+  void linescan_fileindex_close(linescan_fileindex* fi);
+
+  // @returns Number of indexed lines.
+  size_t linescan_fileindex_lines(const linescan_fileindex* fi);
+
+  /* @returns File offset of line k (starting at 0); SIZE_MAX if k is out of range
+     or, with errno EINVAL, if the index is corrupt. */
+  size_t linescan_fileindex_offset(const linescan_fileindex* fi, size_t k);
+
+  /* Look up line k (starting at 0).
+     @param[fi] Index
+     @param[k] Line number
+     @param[line] Set to the search result of the line (see linescan_find); line->buf
+     points into the mapping of the file. Offsets are read from the index if it
+     holds fields, otherwise the line is searched. It stays valid until the next call.
+     @returns 1 if the line was returned; 0 if k is out of range. -1 indicates an
+     error; errno is EINVAL if the index is corrupt, e.g. an encoded line crosses
+     the end of its block.
+  */
+  int linescan_fileindex_line(linescan_fileindex* fi, size_t k, const linescan** line);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef LINESCAN_INGEST_H
+#define LINESCAN_INGEST_H
+
+#include <linescan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  // Open files with O_DIRECT where the file system supports it
+  #define LINESCAN_INGEST_DIRECT 1
+  // Do not use io_uring, always read with the pread thread pool
+  #define LINESCAN_INGEST_PREAD 2
+
+  /* Asynchronous reader of many files at once. A fixed pool of buffers is kept
+     in flight as io_uring reads (with registered buffers if the kernel allows)
+     and submitted with a single system call per wait for completions. Without
+     io_uring, reads are done with pread by a pool of threads. Every completed
+     buffer is searched with linescan_find_all and handed out in file order;
+     lines crossing buffers are assembled in a per-file carry buffer. */
+  typedef struct linescan_ingest linescan_ingest;
+
+  /* A buffer handed out by linescan_ingest_next */
+  typedef struct linescan_ingest_chunk {
+    // File number (see linescan_ingest_add)
+    size_t file;
+    // File offset of buf
+    size_t offset;
+    // Characters read
+    const char* buf;
+    size_t len;
+    /* Line which started in an earlier buffer and ends in this one, or the last
+       line of the file if it lacks a newline (then len is 0); NULL if there is none.
+       head->buf points into the carry buffer of the file. */
+    const linescan* head;
+    /* Complete lines starting in this buffer behind head (see linescan_find_all).
+       Characters behind the last newline are carried over to the next buffer. */
+    const linescan_index* index;
+  } linescan_ingest_chunk;
+
+  /* @param[buffers] Number of buffers (reads in flight); must be > 0
+     @param[buffer_size] Bytes per read; rounded up to a multiple of 4096 for O_DIRECT
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[flags] Combination of LINESCAN_INGEST_* flags
+     @returns New reader; NULL on error.
+  */
+  linescan_ingest* linescan_ingest_create(size_t buffers, size_t buffer_size, uint64_t cmask, int flags);
+  void linescan_ingest_free(linescan_ingest* in);
+
+  /* Add a file to read. Files are read up to the size they have when they are added.
+     @returns File number (starting at 0); -1 on error (see errno).
+  */
+  int linescan_ingest_add(linescan_ingest* in, const char* path);
+
+  /* Hand out the next buffer. Buffers of one file are handed out in file order;
+     buffers of different files are interleaved in order of completion. The
+     buffer handed out before is recycled.
+     @param[in] Reader
+     @param[chunk] Set to the buffer; valid until the next call.
+     @returns 1 if a buffer was returned; 0 if all files are read. -1 indicates a
+     read error (see errno; EIO if a file is shorter than when it was added). After
+     a read error, every further call returns -1 as well.
+  */
+  int linescan_ingest_next(linescan_ingest* in, const linescan_ingest_chunk** chunk);
+
+  // @returns 1 if reads are done with io_uring, 0 if they are done by the pread thread pool.
+  int linescan_ingest_uring(const linescan_ingest* in);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef LINESCAN_MMAP_H
+#define LINESCAN_MMAP_H
+
+#include <linescan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  // Fault in every window completely when it is mapped (MAP_POPULATE)
+  #define LINESCAN_MMAP_POPULATE 1
+  // Ask for transparent huge pages on every window (MADV_HUGEPAGE)
+  #define LINESCAN_MMAP_HUGEPAGES 2
+
+  /* Line reader over a memory-mapped file. The file is mapped in windows, which
+     are advised with MADV_SEQUENTIAL and MADV_WILLNEED; lines are searched in
+     place without copying. A line crossing the end of a window is searched
+     again in the next window, which starts at the page containing the line. */
+  typedef struct linescan_mmap linescan_mmap;
+
+  /* @param[path] File to map
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[window_size] Number of bytes to map at once; 0 maps the whole file.
+     Windows grow as needed to hold lines longer than window_size.
+     @param[flags] Combination of LINESCAN_MMAP_* flags
+     @returns New reader; NULL on error (see errno).
+  */
+  linescan_mmap* linescan_mmap_open(const char* path, uint64_t cmask, size_t window_size, int flags);
+  void linescan_mmap_close(linescan_mmap* m);
+
+  /* Hand out the next line.
+     @param[m] Reader
+     @param[line] Set to the search result of the line (see linescan_find); line->buf
+     points into the mapping. It stays valid until the next call. The last line of
+     the file may lack a newline.
+     @returns 1 if a line was returned; 0 at end of file. -1 indicates an error.
+  */
+  int linescan_mmap_next(linescan_mmap* m, const linescan** line);
+
+  // @returns File offset of the line returned next.
+  size_t linescan_mmap_tell(const linescan_mmap* m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef LINESCAN_PARALLEL_H
+#define LINESCAN_PARALLEL_H
+
+#include <linescan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /* Fixed set of worker threads. Work is split into chunks which are dealt out
+     to the workers in contiguous ranges; idle workers steal chunks from the end
+     of other workers' ranges. */
+  typedef struct linescan_pool linescan_pool;
+
+  /* @param[threads] Number of workers, including the thread calling into the pool; must be > 0
+     @returns New pool; NULL on error.
+  */
+  linescan_pool* linescan_pool_create(size_t threads);
+  void linescan_pool_free(linescan_pool* pool);
+  // @returns Number of workers, including the calling thread.
+  size_t linescan_pool_threads(const linescan_pool* pool);
+
+  /* Container for linescan_parallel_find_all results. The input is split into chunks
+     starting at line starts; chunk i covers the characters from starts[i] up to
+     starts[i+1] and is indexed by indexes[i], with offsets relative to
+     (buf + starts[i]). Chunks are in input order and may be empty. */
+  typedef struct linescan_parallel {
+    // Input search buffer
+    const char* buf;
+    // Number of characters between buf and the end of the last complete line
+    size_t size;
+    // Start of every chunk relative to buf
+    size_t* starts;
+    // Index of every chunk (see linescan_find_all)
+    linescan_index** indexes;
+    // Number of chunks
+    size_t chunks_n;
+    // Capacity of starts and indexes (grows on demand)
+    size_t chunks_size;
+  } linescan_parallel;
+
+  linescan_parallel* linescan_parallel_create(void);
+  void linescan_parallel_free(linescan_parallel* result);
+  // @returns Number of complete lines in all chunks.
+  size_t linescan_parallel_lines(const linescan_parallel* result);
+
+  /* Index all lines of a buffer on a thread pool (see linescan_find_all).
+     Chunk boundaries are moved forward to the next line start.
+     @param[pool] Workers to run on
+     @param[buf] Buffer to search
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[n] Number of characters to search; must be >= 0
+     @param[chunk_size] Nominal number of characters per chunk; 0 picks a size
+     from n and the number of workers.
+     @param[result] Struct to which results are written.
+     @returns 1 if buf ends with a newline (all n characters are indexed); 0 if
+     characters remain after the last newline. -1 indicates an error.
+  */
+  int linescan_parallel_find_all(linescan_pool* pool, const char* buf, uint64_t cmask, size_t n,
+				 size_t chunk_size, linescan_parallel* result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef LINESCAN_REVERSE_H
+#define LINESCAN_REVERSE_H
+
+#include <linescan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /* Line reader handing out the lines of a file or buffer newest-first, starting
+     at the end. Files are mapped in windows aligned to the window size, moving
+     towards the start of the file. Lines are searched with linescan_rfind from
+     their end to the preceding newline, so only the characters of lines handed
+     out are searched. A line crossing the start of a window is continued in the
+     preceding window without searching its characters again. */
+  typedef struct linescan_reverse linescan_reverse;
+
+  /* @param[path] File to read
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[window_size] Number of bytes to map at once; 0 maps the whole file.
+     Windows grow as needed to hold lines longer than window_size.
+     @returns New reader; NULL on error (see errno).
+  */
+  linescan_reverse* linescan_reverse_open(const char* path, uint64_t cmask, size_t window_size);
+  /* Reader over a buffer (e.g. a mapping owned by the caller), which must stay
+     valid until the reader is freed.
+     @returns New reader; NULL on error.
+  */
+  linescan_reverse* linescan_reverse_create(const char* buf, size_t n, uint64_t cmask);
+  void linescan_reverse_free(linescan_reverse* r);
+
+  /* Hand out the line in front of the last line handed out.
+     @param[r] Reader
+     @param[line] Set to the search result of the line in the format of linescan_find
+     (line start, cmask matches and newline in ascending order). line->buf points
+     into the mapping or buffer and stays valid until the next call. The first line
+     handed out may lack a newline; its offsets then end with the last cmask match,
+     as for linescan_find returning 0.
+     @returns 1 if a line was returned; 0 at the start of the input. -1 indicates an error.
+  */
+  int linescan_reverse_next(linescan_reverse* r, const linescan** line);
+
+  // @returns Offset of the first character of the last line handed out (the end of the next one).
+  size_t linescan_reverse_tell(const linescan_reverse* r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
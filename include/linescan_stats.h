@@ -0,0 +1,66 @@
+#ifndef LINESCAN_STATS_H
+#define LINESCAN_STATS_H
+
+#include <linescan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  // Number of line length histogram buckets
+  #define LINESCAN_STATS_BUCKETS 32
+
+  /* Counters of linescan_find, linescan_rfind and linescan_find_all calls.
+     Counters are only collected if the library is built with LINESCAN_STATS
+     (make stats); every thread counts into its own set, so collection does
+     not add contention to the search functions. All members are uint64_t. */
+  typedef struct linescan_stats {
+    // Number of calls
+    uint64_t calls;
+    // Time stamp counter cycles spent in calls (see linescan_stats_cycles)
+    uint64_t cycles;
+    // Characters compared one at a time until the first aligned word (Step 1)
+    uint64_t bytes_head;
+    // Characters compared a word or vector at a time (Step 2)
+    uint64_t bytes_body;
+    // Characters compared one at a time after the last word or vector (Step 3)
+    uint64_t bytes_tail;
+    // Words with matches which were searched again one character at a time
+    uint64_t slow_words;
+    // Number of complete lines found
+    uint64_t lines;
+    /* Line length histogram, including the newline. Bucket k > 0 counts lines of
+       2^(k-1) up to 2^k - 1 characters; the last bucket counts all longer lines. */
+    uint64_t line_lengths[LINESCAN_STATS_BUCKETS];
+    // linescan_find_adaptive calls per kernel chosen (index: linescan_kernel)
+    uint64_t adaptive_kernels[LINESCAN_KERNEL_N];
+    // Number of times an adaptive scanner switched to another kernel
+    uint64_t adaptive_switches;
+  } linescan_stats;
+
+  // @returns 1 if the library collects statistics, 0 otherwise (all counters stay 0).
+  int linescan_stats_enabled(void);
+
+  /* Enable or disable time stamp counter readings around every call (x86 only).
+     Disabled by default. */
+  void linescan_stats_cycles(int enable);
+
+  // Copy the counters of the calling thread to stats.
+  void linescan_stats_thread(linescan_stats* stats);
+
+  /* Copy the sum of the counters of all threads, including threads which have
+     exited, to stats. Counters of running threads are read without stopping them. */
+  void linescan_stats_total(linescan_stats* stats);
+
+  /* Set the counters of all threads to 0. Increments by threads searching at
+     the same time may survive the reset. */
+  void linescan_stats_reset(void);
+
+  // Add all counters of from to to.
+  void linescan_stats_add(linescan_stats* to, const linescan_stats* from);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
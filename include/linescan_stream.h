@@ -0,0 +1,38 @@
+#ifndef LINESCAN_STREAM_H
+#define LINESCAN_STREAM_H
+
+#include <linescan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /* Line reader over a file descriptor. A background thread reads the next chunk
+     while the current one is scanned (double buffering). Lines spanning chunk
+     boundaries are carried over without scanning their bytes twice. */
+  typedef struct linescan_stream linescan_stream;
+
+  /* @param[fd] File descriptor to read from. The stream does not close fd.
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[chunk_size] Number of characters per read(); must be > 0
+     @returns New stream; NULL on error.
+  */
+  linescan_stream* linescan_stream_create(int fd, uint64_t cmask, size_t chunk_size);
+  /* Stops the reader thread. If fd is a pipe or socket, this blocks until
+     the pending read() returns. */
+  void linescan_stream_free(linescan_stream* s);
+
+  /* Hand out the next line.
+     @param[s] Stream
+     @param[line] Set to the search result of the line (see linescan_find). It stays
+     valid until the next call. The last line of the input may lack a newline; its
+     offsets then end with the last cmask match, as for linescan_find returning 0.
+     @returns 1 if a line was returned; 0 at end of input. -1 indicates a read error.
+  */
+  int linescan_stream_next(linescan_stream* s, const linescan** line);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
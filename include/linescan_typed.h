@@ -0,0 +1,85 @@
+#ifndef LINESCAN_TYPED_H
+#define LINESCAN_TYPED_H
+
+#include <linescan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /* Column types of linescan_scan_typed */
+  typedef enum linescan_type {
+    // Field is not parsed
+    LINESCAN_SKIP,
+    // Decimal integer with optional sign
+    LINESCAN_INT64,
+    // Decimal floating point number with optional sign, fraction and exponent
+    LINESCAN_DOUBLE,
+    // Span of the field
+    LINESCAN_STRING
+  } linescan_type;
+
+  /* Values of one column. Only the array matching type is allocated. */
+  typedef struct linescan_column {
+    linescan_type type;
+    // LINESCAN_INT64 values
+    int64_t* ints;
+    // LINESCAN_DOUBLE values
+    double* doubles;
+    // LINESCAN_STRING start and end offset (relative to buf) of the field in every row
+    size_t* spans;
+    /* Bit (row % 64) of word (row / 64) is set if the field is missing, empty or
+       cannot be parsed completely; the value is 0 (an empty span for strings) then. */
+    uint64_t* nulls;
+  } linescan_column;
+
+  /* Container for linescan_scan_typed results in columnar layout. */
+  typedef struct linescan_table {
+    // Input search buffer
+    const char* buf;
+    // Number of characters between buf and the end of the last complete line
+    size_t size;
+    linescan_column* columns;
+    size_t columns_n;
+    // Number of rows (complete lines) parsed
+    size_t rows_n;
+    // Capacity of the column arrays in rows (grows on demand)
+    size_t rows_size;
+  } linescan_table;
+
+  /* @param[types] Type of every column; fields behind the last column are skipped
+     @param[columns_n] Number of columns
+     @param[rows_size] Initial capacity in rows
+     @returns New table; NULL on error.
+  */
+  linescan_table* linescan_table_create(const linescan_type* types, size_t columns_n, size_t rows_size);
+  void linescan_table_free(linescan_table* t);
+  void linescan_table_reset(linescan_table* t);
+
+  /* Split buffer into lines and fields like linescan_find_all and parse the
+     fields of every complete line into the columns of t. Every field is parsed
+     as soon as the kernel reports its end, while the block holding it is still
+     in cache; integers are parsed eight digits at a time. Doubles are exact:
+     numbers with at most 19 significant digits and a small decimal exponent
+     are computed directly, all others are passed to strtod. Special values
+     (inf, nan) and hexadecimal numbers are not accepted. Characters after
+     the last newline are not parsed.
+     @param[buf] Buffer to search
+     @param[cmask] Character mask to match (see linescan_create_mask).
+     @param[n] Number of characters to search; must be >= 0
+     @param[t] Table to which results are written; earlier rows are replaced.
+     @returns 1 if buf ends with a newline (all n characters are parsed); 0 if characters
+     remain after the last newline. -1 indicates an error.
+  */
+  int linescan_scan_typed(const char* buf, uint64_t cmask, size_t n, linescan_table* t);
+
+  /* @returns 1 if the field of column k in row is null (see linescan_column.nulls); 0 otherwise. */
+  static inline int linescan_table_null(const linescan_table* t, size_t k, size_t row){
+    return (t->columns[k].nulls[row / 64] >> (row % 64)) & 1;
+  }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
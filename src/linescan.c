@@ -70,14 +70,16 @@
    <https://www.gnu.org/licenses/>
 */
 
-#include <linescan.h>
+#define _POSIX_C_SOURCE 200809L
+
+#include "linescan_internal.h"
+#include <time.h>
 
 // Mask containing 00000001 in every byte
 static const uint64_t ONES_MASK = (uint64_t)0x01010101 | ((uint64_t)0x01010101) << 32;
 // Mask containing 10000000 in every byte
 static const uint64_t ONES_MASK_7 = ONES_MASK << 7;
 
-static const unsigned char NL = '\n';
 // Mask containing NL in every byte
 static const uint64_t NL_MASK = (uint64_t)NL
   | (((uint64_t)NL) << 8)
@@ -91,24 +93,15 @@ static const uint64_t NL_MASK = (uint64_t)NL
 // Magic mask used by rfind
 static const uint64_t RFIND_MAGIC_MASK = ((uint64_t)-1) / 0xff * 0xfe << 1 >> 1 | 1; 
 
-// private helper method for setting some values
-static inline void linescan_update(linescan* r,
-				   const char* buf,
-				   size_t size,
-				   size_t offsets_n){
-  r->buf = buf;
-  r->offsets_n = offsets_n;
-  r->size = size;
-}
-
 void linescan_reset(linescan* r){
   r->buf = NULL;
   r->size = 0;
   r->offsets_n = 0;
+  r->utf8_invalid = 0;
 }
 
 #ifdef LINESCAN_DEBUG
-void linescan_reset_debug(linescan* r){
+static void linescan_reset_debug(linescan* r){
   r->debug_steps_1 = 0;
   r->debug_steps_2 = 0;
   r->debug_steps_3 = 0;
@@ -120,6 +113,7 @@ linescan* linescan_create(size_t offsets_size){
   size_t* offsets = calloc(offsets_size, sizeof(size_t));
   r->offsets = offsets;
   r->offsets_size = offsets_size;
+  r->utf8 = 0;
   linescan_reset(r);
   return r;
 }
@@ -129,6 +123,875 @@ void linescan_free(linescan* r){
   free(r);
 }
 
+void linescan_index_reset(linescan_index* index){
+  index->buf = NULL;
+  index->size = 0;
+  index->offsets_n = 0;
+  index->lines_n = 0;
+}
+
+linescan_index* linescan_index_create(size_t offsets_size, size_t lines_size){
+  linescan_index* index = malloc(sizeof(linescan_index));
+  index->offsets = calloc(offsets_size, sizeof(size_t));
+  index->offsets_size = offsets_size;
+  index->lines = calloc(lines_size, sizeof(size_t));
+  index->lines_size = lines_size;
+  linescan_index_reset(index);
+  return index;
+}
+
+void linescan_index_free(linescan_index* index){
+  free(index->offsets);
+  free(index->lines);
+  free(index);
+}
+
+void linescan_bitmap_reset(linescan_bitmap* bm){
+  bm->buf = NULL;
+  bm->size = 0;
+}
+
+linescan_bitmap* linescan_bitmap_create(size_t size){
+  linescan_bitmap* bm = malloc(sizeof(linescan_bitmap));
+  size_t words_size = (size + 63) / 64;
+  bm->delims = calloc(words_size, sizeof(uint64_t));
+  bm->newlines = calloc(words_size, sizeof(uint64_t));
+  bm->words_size = words_size;
+  linescan_bitmap_reset(bm);
+  return bm;
+}
+
+void linescan_bitmap_free(linescan_bitmap* bm){
+  free(bm->delims);
+  free(bm->newlines);
+  free(bm);
+}
+
+int linescan_bitmap_grow(linescan_bitmap* bm, size_t size){
+  size_t words_size = (size + 63) / 64;
+  if(words_size < bm->words_size * 2) words_size = bm->words_size * 2;
+  uint64_t* delims = realloc(bm->delims, words_size * sizeof(uint64_t));
+  if(delims == NULL) return -1;
+  bm->delims = delims;
+  uint64_t* newlines = realloc(bm->newlines, words_size * sizeof(uint64_t));
+  if(newlines == NULL) return -1;
+  bm->newlines = newlines;
+  bm->words_size = words_size;
+  return 0;
+}
+
+size_t linescan_bitmap_count(const linescan_bitmap* bm, size_t from, size_t to){
+  if(to > bm->size) to = bm->size;
+  if(from >= to) return 0;
+  size_t w_from = from / 64;
+  size_t w_to = (to - 1) / 64;
+  uint64_t m_from = ~(uint64_t)0 << (from % 64);
+  uint64_t m_to = ~(uint64_t)0 >> (63 - (to - 1) % 64);
+
+  if(w_from == w_to) return __builtin_popcountll(bm->delims[w_from] & m_from & m_to);
+  size_t count = __builtin_popcountll(bm->delims[w_from] & m_from);
+  for(size_t w = w_from + 1; w < w_to; w++){
+    count += __builtin_popcountll(bm->delims[w]);
+  }
+  return count + __builtin_popcountll(bm->delims[w_to] & m_to);
+}
+
+size_t linescan_bitmap_select(const linescan_bitmap* bm, size_t from, size_t k){
+  if(from >= bm->size) return bm->size;
+  size_t words = (bm->size + 63) / 64;
+  size_t w = from / 64;
+  uint64_t word = bm->delims[w] & (~(uint64_t)0 << (from % 64));
+
+  // Skip whole words by popcount, then clear the lower matches of the final word
+  for(size_t count = __builtin_popcountll(word); k >= count; count = __builtin_popcountll(word)){
+    k -= count;
+    if(++w == words) return bm->size;
+    word = bm->delims[w];
+  }
+  for(; k > 0; k--) word &= word - 1;
+  return w * 64 + __builtin_ctzll(word);
+}
+
+int linescan_bitmap_field(const linescan_bitmap* bm, size_t line_start, size_t k,
+			  size_t* start, size_t* end){
+  if(line_start >= bm->size) return 0;
+  size_t line_end = linescan_bitmap_next_line(bm, line_start);
+  size_t s = line_start;
+  if(k > 0){
+    s = linescan_bitmap_select(bm, line_start, k - 1);
+    if(s >= line_end) return 0;
+    s++;
+  }
+  *start = s;
+  *end = linescan_bitmap_next_field(bm, s);
+  return 1;
+}
+
+void linescan_arena_init(linescan_arena* arena, void* base, size_t size){
+  arena->base = base;
+  arena->size = size;
+  arena->used = 0;
+}
+
+void linescan_arena_reset(linescan_arena* arena){
+  arena->used = 0;
+}
+
+void* linescan_arena_alloc(linescan_arena* arena, size_t size, size_t align){
+  size_t start = ((size_t)arena->base + arena->used + align - 1) & ~(align - 1);
+  start -= (size_t)arena->base;
+  if(start > arena->size || arena->size - start < size) return NULL;
+  arena->used = start + size;
+  return arena->base + start;
+}
+
+void linescan_bounded_reset(linescan_bounded* r){
+  r->buf = NULL;
+  r->size = 0;
+  r->offsets_n = 0;
+}
+
+linescan_bounded* linescan_bounded_create(size_t offsets_size, linescan_width width,
+					  linescan_arena* arena){
+  linescan_bounded* r = malloc(sizeof(linescan_bounded));
+  if(r == NULL) return NULL;
+  if(arena != NULL){
+    r->offsets = linescan_arena_alloc(arena, offsets_size * width, width);
+  } else {
+    r->offsets = calloc(offsets_size, width);
+  }
+  if(r->offsets == NULL){
+    free(r);
+    return NULL;
+  }
+  r->offsets_size = offsets_size;
+  r->width = width;
+  r->arena = arena;
+  linescan_bounded_reset(r);
+  return r;
+}
+
+void linescan_bounded_free(linescan_bounded* r){
+  if(r->arena == NULL) free(r->offsets);
+  free(r);
+}
+
+/* Moves offsets to a larger array from the arena.
+   @returns 0 on success, -1 if there is no arena or it is exhausted. */
+static int linescan_bounded_grow(linescan_bounded* r, size_t offsets_min){
+  if(r->arena == NULL) return -1;
+  size_t size = r->offsets_size * 2 > offsets_min ? r->offsets_size * 2 : offsets_min;
+  void* offsets = linescan_arena_alloc(r->arena, size * r->width, r->width);
+  if(offsets == NULL) return -1;
+  memcpy(offsets, r->offsets, r->offsets_size * r->width);
+  r->offsets = offsets;
+  r->offsets_size = size;
+  return 0;
+}
+
+/* Stores base + (position of every bit in m) behind offsets_n.
+   @returns New number of offsets. */
+static inline size_t linescan_bounded_store(linescan_bounded* r, size_t offsets_n,
+					    size_t base, uint64_t m){
+  switch(r->width){
+  case LINESCAN_WIDTH_16:
+    for(uint16_t* o = r->offsets; m != 0; m &= m - 1) o[offsets_n++] = base + __builtin_ctzll(m);
+    break;
+  case LINESCAN_WIDTH_32:
+    for(uint32_t* o = r->offsets; m != 0; m &= m - 1) o[offsets_n++] = base + __builtin_ctzll(m);
+    break;
+  default:
+    for(uint64_t* o = r->offsets; m != 0; m &= m - 1) o[offsets_n++] = base + __builtin_ctzll(m);
+    break;
+  }
+  return offsets_n;
+}
+
+static inline void linescan_bounded_update(linescan_bounded* r,
+					   const char* buf,
+					   size_t size,
+					   size_t offsets_n){
+  r->buf = buf;
+  r->offsets_n = offsets_n;
+  r->size = size;
+}
+
+int linescan_find_bounded(const char* buf, uint64_t cmask, size_t n, linescan_bounded* result){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(result != NULL, -1)
+  LINESCAN_CHECK(result->offsets_size >= 2, -1)
+  LINESCAN_CHECK(result->offsets != NULL, -1)
+
+  // Offsets must fit into width bytes
+  size_t limit = n;
+  if(result->width == LINESCAN_WIDTH_16 && limit > (size_t)UINT16_MAX + 1){
+    limit = (size_t)UINT16_MAX + 1;
+  } else if(result->width == LINESCAN_WIDTH_32 && limit > (size_t)UINT32_MAX + 1){
+    limit = (size_t)UINT32_MAX + 1;
+  }
+
+  // offsets[0] = 0
+  size_t offsets_n = linescan_bounded_store(result, 0, 0, 1);
+  for(size_t i = 0; i < limit; i += 64){
+    size_t k = limit - i < 64 ? limit - i : 64;
+    uint64_t m_c;
+    uint64_t m_nl;
+    linescan_block_impl(buf + i, cmask, k, &m_c, &m_nl);
+    // Keep the first newline and the matches in front of it only
+    m_nl &= -m_nl;
+    if(m_nl != 0) m_c &= m_nl - 1;
+
+    size_t hits = __builtin_popcountll(m_c | m_nl);
+    if(offsets_n + hits > result->offsets_size
+       && linescan_bounded_grow(result, offsets_n + hits) != 0){
+      // Store what fits; the newline never fits since it comes last
+      while(offsets_n < result->offsets_size){
+	offsets_n = linescan_bounded_store(result, offsets_n, i, m_c & -m_c);
+	m_c &= m_c - 1;
+      }
+      size_t last = linescan_bounded_offset(result, offsets_n - 1);
+      linescan_bounded_update(result, buf, last + 1, offsets_n);
+      return LINESCAN_FULL;
+    }
+
+    offsets_n = linescan_bounded_store(result, offsets_n, i, m_c | m_nl);
+    if(m_nl != 0){
+      linescan_bounded_update(result, buf, i + __builtin_ctzll(m_nl) + 1, offsets_n);
+      return 1;
+    }
+  }
+
+  if(limit < n){
+    // Continue behind the last match, or in the middle of an overlong field
+    size_t next = offsets_n > 1 ? linescan_bounded_offset(result, offsets_n - 1) + 1 : limit;
+    linescan_bounded_update(result, buf, next, offsets_n);
+    return LINESCAN_FULL;
+  }
+  linescan_bounded_update(result, buf, n, offsets_n);
+  return 0;
+}
+
+static int linescan_compare_size(const void* a, const void* b){
+  size_t x = *(const size_t*)a;
+  size_t y = *(const size_t*)b;
+  return (x > y) - (x < y);
+}
+
+void linescan_projection_reset(linescan_projection* p){
+  p->buf = NULL;
+  p->size = 0;
+  p->spans_n = 0;
+}
+
+linescan_projection* linescan_projection_create(const size_t* columns, size_t columns_n){
+  LINESCAN_CHECK(columns != NULL || columns_n == 0, NULL)
+  linescan_projection* p = malloc(sizeof(linescan_projection));
+  if(p == NULL) return NULL;
+  p->columns = malloc((columns_n + 1) * sizeof(size_t));
+  p->spans = malloc((2 * columns_n + 1) * sizeof(size_t));
+  if(p->columns == NULL || p->spans == NULL){
+    linescan_projection_free(p);
+    return NULL;
+  }
+  if(columns_n > 0) memcpy(p->columns, columns, columns_n * sizeof(size_t));
+  qsort(p->columns, columns_n, sizeof(size_t), linescan_compare_size);
+  p->columns_n = 0;
+  for(size_t i = 0; i < columns_n; i++){
+    if(p->columns_n == 0 || p->columns[i] != p->columns[p->columns_n - 1]){
+      p->columns[p->columns_n++] = p->columns[i];
+    }
+  }
+  linescan_projection_reset(p);
+  return p;
+}
+
+void linescan_projection_free(linescan_projection* p){
+  free(p->columns);
+  free(p->spans);
+  free(p);
+}
+
+int linescan_find_projection(const char* buf, uint64_t cmask, size_t n, linescan_projection* p){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(p != NULL, -1)
+  const size_t* columns = p->columns;
+  size_t* spans = p->spans;
+  size_t k = 0;
+  size_t field = 0;
+  size_t start = 0;
+  size_t i = 0;
+  const char* nl = NULL;
+
+  p->buf = buf;
+  while(k < p->columns_n && i < n){
+    size_t len = n - i < 64 ? n - i : 64;
+    uint64_t m_c;
+    uint64_t m_nl;
+    linescan_block_impl(buf + i, cmask, len, &m_c, &m_nl);
+    m_nl &= -m_nl;
+    if(m_nl != 0) m_c &= m_nl - 1;
+
+    // Skip blocks which do not reach the next wanted field
+    size_t hits = __builtin_popcountll(m_c);
+    if(field + hits < columns[k]){
+      field += hits;
+    } else {
+      for(; m_c != 0 && k < p->columns_n; m_c &= m_c - 1){
+	size_t pos = i + __builtin_ctzll(m_c);
+	if(field == columns[k]){
+	  spans[2 * k] = start;
+	  spans[2 * k + 1] = pos;
+	  k++;
+	}
+	field++;
+	start = pos + 1;
+      }
+    }
+
+    if(m_nl != 0){
+      size_t pos = i + __builtin_ctzll(m_nl);
+      if(k < p->columns_n && field == columns[k]){
+	spans[2 * k] = start;
+	spans[2 * k + 1] = pos;
+	k++;
+      }
+      p->spans_n = k;
+      p->size = pos + 1;
+      return 1;
+    }
+    i += len;
+    if(k == p->columns_n){
+      nl = memchr(buf + i, NL, n - i);
+      goto done;
+    }
+  }
+
+  if(k < p->columns_n){
+    // No newline; the last field ends at n
+    if(field == columns[k]){
+      spans[2 * k] = start;
+      spans[2 * k + 1] = n;
+      k++;
+    }
+    p->spans_n = k;
+    p->size = n;
+    return 0;
+  }
+  // All wanted fields found, or none wanted
+  nl = memchr(buf + i, NL, n - i);
+
+ done:
+  p->spans_n = k;
+  p->size = nl == NULL ? n : (size_t)(nl - buf) + 1;
+  return nl != NULL;
+}
+
+void linescan_quote_init(linescan_quote* q, char quote){
+  q->qmask = linescan_create_mask(quote);
+  q->inside = 0;
+}
+
+/* Clears cmask matches and newlines inside quotes from the bitmaps of one
+   block and advances the quote state to the end of the block. Bits of a
+   short block above n are 0 in m_q, so the state of its last character
+   is carried. */
+static inline void linescan_quote_block(uint64_t* m_c, uint64_t* m_nl, uint64_t m_q,
+					uint64_t* inside){
+  uint64_t in = linescan_prefix_xor(m_q) ^ *inside;
+  *m_c &= ~in;
+  *m_nl &= ~in;
+  *inside = (uint64_t)((int64_t)in >> 63);
+}
+
+int linescan_find_quoted(const char* buf, uint64_t cmask, size_t n, linescan* result,
+			 linescan_quote* q){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(result != NULL, -1)
+  LINESCAN_CHECK(q != NULL, -1)
+  LINESCAN_CHECK(cmask != q->qmask, -1)
+  size_t* offsets = result->offsets;
+  uint64_t inside = q->inside;
+
+  offsets[0] = 0;
+  size_t offsets_n = 1;
+  for(size_t i = 0; i < n; i += 64){
+    size_t k = n - i < 64 ? n - i : 64;
+    uint64_t m_c;
+    uint64_t m_nl;
+    uint64_t m_q;
+    linescan_block_quoted_impl(buf + i, cmask, q->qmask, k, &m_c, &m_nl, &m_q);
+    linescan_quote_block(&m_c, &m_nl, m_q, &inside);
+    // Keep the first newline and the matches in front of it only
+    m_nl &= -m_nl;
+    if(m_nl != 0) m_c &= m_nl - 1;
+    for(uint64_t m = m_c | m_nl; m != 0; m &= m - 1){
+      offsets[offsets_n] = i + __builtin_ctzll(m);
+      offsets_n++;
+    }
+    if(m_nl != 0){
+      // Newlines are never quoted
+      q->inside = 0;
+      linescan_update(result, buf, i + __builtin_ctzll(m_nl) + 1, offsets_n);
+      return 1;
+    }
+  }
+  q->inside = inside;
+  linescan_update(result, buf, n, offsets_n);
+  return 0;
+}
+
+int linescan_find_all_quoted(const char* buf, uint64_t cmask, size_t n, linescan_index* index,
+			     linescan_quote* q){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(index != NULL, -1)
+  LINESCAN_CHECK(q != NULL, -1)
+  LINESCAN_CHECK(cmask != q->qmask, -1)
+  uint64_t inside = q->inside;
+  size_t offsets_n = 1;
+  size_t lines_n = 0;
+
+  if(linescan_index_reserve(index, 0, 0, 1) != 0) return -1;
+  index->offsets[0] = 0;
+  index->lines[0] = 0;
+
+  for(size_t i = 0; i < n; i += 64){
+    // Every character adds at most two offsets (newline and start of next line)
+    if(linescan_index_reserve(index, offsets_n, lines_n, 128) != 0) return -1;
+    size_t* offsets = index->offsets;
+    size_t* lines = index->lines;
+    size_t k = n - i < 64 ? n - i : 64;
+    uint64_t m_c;
+    uint64_t m_nl;
+    uint64_t m_q;
+    linescan_block_quoted_impl(buf + i, cmask, q->qmask, k, &m_c, &m_nl, &m_q);
+    linescan_quote_block(&m_c, &m_nl, m_q, &inside);
+
+    for(uint64_t m = m_c | m_nl; m != 0; m &= m - 1){
+      uint64_t bit = m & -m;
+      size_t offset = i + __builtin_ctzll(m);
+      offsets[offsets_n] = offset;
+      offsets_n++;
+      if(m_nl & bit){
+	lines_n++;
+	lines[lines_n] = offsets_n;
+	offsets[offsets_n] = offset + 1;
+	offsets_n++;
+      }
+    }
+  }
+
+  // The last complete line ends outside of quotes
+  if(lines_n > 0) q->inside = 0;
+  return linescan_index_update(index, buf, n, lines_n);
+}
+
+int linescan_find_bitmap_quoted(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm,
+				linescan_quote* q){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(bm != NULL, -1)
+  LINESCAN_CHECK(q != NULL, -1)
+  LINESCAN_CHECK(cmask != q->qmask, -1)
+  uint64_t inside = q->inside;
+
+  if(linescan_bitmap_reserve(bm, n) != 0) return -1;
+  for(size_t i = 0, w = 0; i < n; i += 64, w++){
+    size_t k = n - i < 64 ? n - i : 64;
+    uint64_t m_c;
+    uint64_t m_nl;
+    uint64_t m_q;
+    linescan_block_quoted_impl(buf + i, cmask, q->qmask, k, &m_c, &m_nl, &m_q);
+    linescan_quote_block(&m_c, &m_nl, m_q, &inside);
+    bm->delims[w] = m_c;
+    bm->newlines[w] = m_nl;
+  }
+  q->inside = inside;
+  return linescan_bitmap_update(bm, buf, n);
+}
+
+int linescan_delim_init(linescan_delim* d, const char* chars, size_t n){
+  LINESCAN_CHECK(d != NULL, -1)
+  LINESCAN_CHECK(chars != NULL, -1)
+  if(n == 0 || n > sizeof(d->chars) || memchr(chars, NL, n) != NULL) return -1;
+  memset(d->chars, 0, sizeof(d->chars));
+  memcpy(d->chars, chars, n);
+  d->n = n;
+  d->first = linescan_create_mask(chars[0]);
+  d->last = linescan_create_mask(chars[n - 1]);
+  return 0;
+}
+
+/* Computes the delimiter starts (m_d) and newlines (m_nl) of the block at
+   (buf + i). A delimiter start is reported only if the whole delimiter fits
+   into [buf, buf + n); overlapping matches are not removed. */
+static inline void linescan_delim_block(const char* buf, const linescan_delim* d, size_t i, size_t n,
+					uint64_t* m_d, uint64_t* m_nl){
+  size_t k = n - i < 64 ? n - i : 64;
+  size_t shift = d->n - 1;
+  uint64_t m_first;
+  uint64_t m_last = 0;
+  uint64_t m_unused;
+  linescan_block_impl(buf + i, d->first, k, &m_first, m_nl);
+  if(shift == 0){
+    *m_d = m_first;
+    return;
+  }
+  // Last characters, shifted so that bit j stands for a delimiter starting at (i + j)
+  if(i + shift < n){
+    size_t k_last = n - i - shift < 64 ? n - i - shift : 64;
+    linescan_block_impl(buf + i + shift, d->last, k_last, &m_last, &m_unused);
+  }
+  uint64_t m = m_first & m_last;
+  if(d->n > 2){
+    for(uint64_t c = m; c != 0; c &= c - 1){
+      int j = __builtin_ctzll(c);
+      if(memcmp(buf + i + j + 1, d->chars + 1, d->n - 2) != 0) m &= ~(((uint64_t)1) << j);
+    }
+  }
+  *m_d = m;
+}
+
+int linescan_find_delim(const char* buf, const linescan_delim* d, size_t n, linescan* result){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(d != NULL, -1)
+  LINESCAN_CHECK(result != NULL, -1)
+  size_t* offsets = result->offsets;
+  // Matches starting in front of next overlap the previous match
+  size_t next = 0;
+
+  offsets[0] = 0;
+  size_t offsets_n = 1;
+  for(size_t i = 0; i < n; i += 64){
+    uint64_t m_d;
+    uint64_t m_nl;
+    linescan_delim_block(buf, d, i, n, &m_d, &m_nl);
+    // Keep the first newline and the matches in front of it only
+    m_nl &= -m_nl;
+    if(m_nl != 0) m_d &= m_nl - 1;
+    for(; m_d != 0; m_d &= m_d - 1){
+      size_t offset = i + __builtin_ctzll(m_d);
+      if(offset < next) continue;
+      offsets[offsets_n] = offset + d->n - 1;
+      offsets_n++;
+      next = offset + d->n;
+    }
+    if(m_nl != 0){
+      size_t offset = i + __builtin_ctzll(m_nl);
+      offsets[offsets_n] = offset;
+      offsets_n++;
+      linescan_update(result, buf, offset + 1, offsets_n);
+      return 1;
+    }
+  }
+  linescan_update(result, buf, n, offsets_n);
+  return 0;
+}
+
+int linescan_find_all_delim(const char* buf, const linescan_delim* d, size_t n, linescan_index* index){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(d != NULL, -1)
+  LINESCAN_CHECK(index != NULL, -1)
+  size_t next = 0;
+  size_t offsets_n = 1;
+  size_t lines_n = 0;
+
+  if(linescan_index_reserve(index, 0, 0, 1) != 0) return -1;
+  index->offsets[0] = 0;
+  index->lines[0] = 0;
+
+  for(size_t i = 0; i < n; i += 64){
+    // Every character adds at most two offsets (newline and start of next line)
+    if(linescan_index_reserve(index, offsets_n, lines_n, 128) != 0) return -1;
+    size_t* offsets = index->offsets;
+    size_t* lines = index->lines;
+    uint64_t m_d;
+    uint64_t m_nl;
+    linescan_delim_block(buf, d, i, n, &m_d, &m_nl);
+
+    for(uint64_t m = m_d | m_nl; m != 0; m &= m - 1){
+      uint64_t bit = m & -m;
+      size_t offset = i + __builtin_ctzll(m);
+      if(m_nl & bit){
+	offsets[offsets_n] = offset;
+	offsets_n++;
+	lines_n++;
+	lines[lines_n] = offsets_n;
+	offsets[offsets_n] = offset + 1;
+	offsets_n++;
+	next = offset + 1;
+      } else if(offset >= next){
+	offsets[offsets_n] = offset + d->n - 1;
+	offsets_n++;
+	next = offset + d->n;
+      }
+    }
+  }
+  return linescan_index_update(index, buf, n, lines_n);
+}
+
+void linescan_predicate_init(linescan_predicate* p, size_t field, linescan_predicate_op op,
+			     const char* value, size_t value_n){
+  p->field = field;
+  p->op = op;
+  p->value = value;
+  p->value_n = value_n;
+  memset(p->bytes, 0, sizeof(p->bytes));
+  for(size_t i = 0; i < value_n; i++){
+    unsigned char c = (unsigned char)value[i];
+    p->bytes[c / 64] |= ((uint64_t)1) << (c % 64);
+  }
+}
+
+// @returns 1 if the field [f, f + len) passes p, 0 otherwise.
+static inline int linescan_predicate_test(const linescan_predicate* p, const char* f, size_t len){
+  switch(p->op){
+  case LINESCAN_PREDICATE_EQUAL:
+    return len == p->value_n && memcmp(f, p->value, len) == 0;
+  case LINESCAN_PREDICATE_PREFIX:
+    return len >= p->value_n && memcmp(f, p->value, p->value_n) == 0;
+  case LINESCAN_PREDICATE_BYTES:
+    for(size_t i = 0; i < len; i++){
+      unsigned char c = (unsigned char)f[i];
+      if((p->bytes[c / 64] >> (c % 64)) & 1) return 1;
+    }
+    return 0;
+  }
+  return 0;
+}
+
+/* Stores the offsets of the line starting at (buf + start) in index and sets
+   end behind its newline. @returns 1 if the line is complete; 0 if it has no
+   newline (its offsets are dropped then). -1 indicates an error. */
+static int linescan_filter_emit(const char* buf, uint64_t cmask, size_t n, size_t start,
+				linescan_index* index, size_t* lines_n, size_t* end){
+  size_t offsets_n = index->lines[*lines_n];
+  for(size_t i = start; i < n; i += 64){
+    // Line start, matches and newline
+    if(linescan_index_reserve(index, offsets_n, *lines_n, 66) != 0) return -1;
+    size_t* offsets = index->offsets;
+    if(i == start){
+      offsets[offsets_n] = start;
+      offsets_n++;
+    }
+    size_t k = n - i < 64 ? n - i : 64;
+    uint64_t m_c;
+    uint64_t m_nl;
+    linescan_block_impl(buf + i, cmask, k, &m_c, &m_nl);
+    m_nl &= -m_nl;
+    if(m_nl != 0) m_c &= m_nl - 1;
+    for(uint64_t m = m_c | m_nl; m != 0; m &= m - 1){
+      offsets[offsets_n] = i + __builtin_ctzll(m);
+      offsets_n++;
+    }
+    if(m_nl != 0){
+      (*lines_n)++;
+      index->lines[*lines_n] = offsets_n;
+      *end = i + __builtin_ctzll(m_nl) + 1;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int linescan_find_all_filter(const char* buf, uint64_t cmask, size_t n, const linescan_predicate* p,
+			     linescan_index* index){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(p != NULL, -1)
+  LINESCAN_CHECK(index != NULL, -1)
+  size_t lines_n = 0;
+  // Start of the current line
+  size_t line = 0;
+
+  if(linescan_index_reserve(index, 0, 0, 1) != 0) return -1;
+  index->lines[0] = 0;
+
+  while(line < n){
+    size_t field = 0;
+    size_t start = line;
+    // Span of the tested field; SIZE_MAX if not found yet
+    size_t f_start = SIZE_MAX;
+    size_t f_end = 0;
+    // Newline of the line; SIZE_MAX if not reached
+    size_t nl = SIZE_MAX;
+
+    for(size_t i = line; i < n && f_start == SIZE_MAX && nl == SIZE_MAX; i += 64){
+      size_t k = n - i < 64 ? n - i : 64;
+      uint64_t m_c;
+      uint64_t m_nl;
+      linescan_block_impl(buf + i, cmask, k, &m_c, &m_nl);
+      m_nl &= -m_nl;
+      if(m_nl != 0) m_c &= m_nl - 1;
+
+      // Skip blocks which do not reach the end of the tested field
+      size_t hits = __builtin_popcountll(m_c);
+      if(field + hits < p->field){
+	field += hits;
+      } else {
+	for(; m_c != 0; m_c &= m_c - 1){
+	  size_t pos = i + __builtin_ctzll(m_c);
+	  if(field == p->field){
+	    f_start = start;
+	    f_end = pos;
+	    break;
+	  }
+	  field++;
+	  start = pos + 1;
+	}
+      }
+      if(f_start == SIZE_MAX && m_nl != 0){
+	nl = i + __builtin_ctzll(m_nl);
+	if(field == p->field){
+	  f_start = start;
+	  f_end = nl;
+	}
+      }
+    }
+    // Line is incomplete; the field may go on in the next buffer
+    if(f_start == SIZE_MAX && nl == SIZE_MAX) break;
+
+    if(f_start != SIZE_MAX && linescan_predicate_test(p, buf + f_start, f_end - f_start)){
+      int rc = linescan_filter_emit(buf, cmask, n, line, index, &lines_n, &line);
+      if(rc < 0) return -1;
+      if(rc == 0) break;
+    } else if(nl != SIZE_MAX){
+      line = nl + 1;
+    } else {
+      const char* next = memchr(buf + f_end, NL, n - f_end);
+      if(next == NULL) break;
+      line = (size_t)(next - buf) + 1;
+    }
+  }
+
+  linescan_index_update(index, buf, n, lines_n);
+  // Lines which did not pass are searched as well
+  index->size = line;
+  return line == n;
+}
+
+void linescan_class_init(linescan_class* cl){
+  memset(cl, 0, sizeof(*cl));
+  cl->tables = 1;
+  // Bit h % 8 of table h / 8 stands for high nibble h
+  for(int h = 0; h < 16; h++) cl->hi[h / 8][h] = (uint8_t)(1 << (h % 8));
+}
+
+int linescan_class_add(linescan_class* cl, const char* chars, size_t n){
+  LINESCAN_CHECK(cl != NULL, -1)
+  LINESCAN_CHECK(chars != NULL || n == 0, -1)
+  if(cl->classes_n == 255) return -1;
+  for(size_t i = 0; i < n; i++){
+    unsigned char c = (unsigned char)chars[i];
+    if(cl->classes[c] != 0 && cl->classes[c] != cl->classes_n + 1) return -1;
+  }
+  for(size_t i = 0; i < n; i++){
+    unsigned char c = (unsigned char)chars[i];
+    cl->classes[c] = (uint8_t)(cl->classes_n + 1);
+    cl->lo[c >> 7][c & 15] |= (uint8_t)(1 << ((c >> 4) % 8));
+    if(c >= 0x80) cl->tables = 2;
+  }
+  return (int)cl->classes_n++;
+}
+
+void linescan_hits_reset(linescan_hits* hits){
+  hits->buf = NULL;
+  hits->size = 0;
+  hits->hits_n = 0;
+}
+
+linescan_hits* linescan_hits_create(size_t hits_size){
+  linescan_hits* hits = malloc(sizeof(linescan_hits));
+  hits->offsets = calloc(hits_size, sizeof(size_t));
+  hits->classes = calloc(hits_size, sizeof(uint8_t));
+  hits->hits_size = hits_size;
+  linescan_hits_reset(hits);
+  return hits;
+}
+
+void linescan_hits_free(linescan_hits* hits){
+  free(hits->offsets);
+  free(hits->classes);
+  free(hits);
+}
+
+void linescan_batch_reset(linescan_batch* batch){
+  batch->offsets_n = 0;
+  batch->buffers_n = 0;
+  batch->starts[0] = 0;
+}
+
+linescan_batch* linescan_batch_create(size_t buffers_size, size_t offsets_size){
+  linescan_batch* batch = malloc(sizeof(linescan_batch));
+  batch->offsets = calloc(offsets_size, sizeof(size_t));
+  batch->offsets_size = offsets_size;
+  batch->starts = calloc(buffers_size + 1, sizeof(size_t));
+  batch->sizes = calloc(buffers_size, sizeof(size_t));
+  batch->status = calloc(buffers_size, sizeof(int8_t));
+  batch->buffers_size = buffers_size;
+  linescan_batch_reset(batch);
+  return batch;
+}
+
+void linescan_batch_free(linescan_batch* batch){
+  free(batch->offsets);
+  free(batch->starts);
+  free(batch->sizes);
+  free(batch->status);
+  free(batch);
+}
+
+int linescan_batch_grow(linescan_batch* batch, size_t offsets_min, size_t buffers_min){
+  if(offsets_min > batch->offsets_size){
+    size_t size = batch->offsets_size * 2 > offsets_min ? batch->offsets_size * 2 : offsets_min;
+    size_t* offsets = realloc(batch->offsets, size * sizeof(size_t));
+    if(offsets == NULL) return -1;
+    batch->offsets = offsets;
+    batch->offsets_size = size;
+  }
+  if(buffers_min > batch->buffers_size){
+    size_t size = batch->buffers_size * 2 > buffers_min ? batch->buffers_size * 2 : buffers_min;
+    size_t* starts = realloc(batch->starts, (size + 1) * sizeof(size_t));
+    if(starts == NULL) return -1;
+    batch->starts = starts;
+    size_t* sizes = realloc(batch->sizes, size * sizeof(size_t));
+    if(sizes == NULL) return -1;
+    batch->sizes = sizes;
+    int8_t* status = realloc(batch->status, size * sizeof(int8_t));
+    if(status == NULL) return -1;
+    batch->status = status;
+    batch->buffers_size = size;
+  }
+  return 0;
+}
+
+int linescan_hits_grow(linescan_hits* hits, size_t hits_min){
+  size_t size = hits->hits_size * 2 > hits_min ? hits->hits_size * 2 : hits_min;
+  size_t* offsets = realloc(hits->offsets, size * sizeof(size_t));
+  if(offsets == NULL) return -1;
+  hits->offsets = offsets;
+  uint8_t* classes = realloc(hits->classes, size * sizeof(uint8_t));
+  if(classes == NULL) return -1;
+  hits->classes = classes;
+  hits->hits_size = size;
+  return 0;
+}
+
+int linescan_index_grow(linescan_index* index, size_t offsets_min, size_t lines_min){
+  if(offsets_min > index->offsets_size){
+    size_t size = index->offsets_size * 2 > offsets_min ? index->offsets_size * 2 : offsets_min;
+    size_t* offsets = realloc(index->offsets, size * sizeof(size_t));
+    if(offsets == NULL) return -1;
+    index->offsets = offsets;
+    index->offsets_size = size;
+  }
+  if(lines_min > index->lines_size){
+    size_t size = index->lines_size * 2 > lines_min ? index->lines_size * 2 : lines_min;
+    size_t* lines = realloc(index->lines, size * sizeof(size_t));
+    if(lines == NULL) return -1;
+    index->lines = lines;
+    index->lines_size = size;
+  }
+  return 0;
+}
+
 __attribute__ ((pure)) uint64_t linescan_create_mask(char c) {
     uint64_t result = c;
     result |= result << 8;
@@ -145,13 +1008,11 @@ __attribute__ ((pure)) uint64_t linescan_create_mask(char c) {
    (b) separate compilation prevents the compiler from problematic optimizations due
    to the type of buf.
  */
-int linescan_find(const char* buf, uint64_t cmask, size_t n, linescan* result){
-  LINESCAN_CHECK(buf != NULL, -1)
-  LINESCAN_CHECK(result != NULL, -1)
-  LINESCAN_DBG(linescan_reset_debug(result);)
-  
+static inline __attribute__((always_inline))
+int linescan_find_word(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result){
   const unsigned char* b;
   unsigned char c_ref = (unsigned char)cmask;
+  unsigned char t_ref = (unsigned char)tmask;
   size_t* offsets = result->offsets;
   size_t n0 = n;
 
@@ -164,10 +1025,11 @@ int linescan_find(const char* buf, uint64_t cmask, size_t n, linescan* result){
       n--, b++){
     unsigned char c = *b;
     LINESCAN_DBG(result->debug_steps_1++;)
+    LINESCAN_COUNT(bytes_head, 1)
     if(c == c_ref){
       offsets[offsets_n] = n0 - n;
       offsets_n++;
-    } else if(c == NL){
+    } else if(c == t_ref){
       size_t offset = n0 - n;
       offsets[offsets_n] = offset;
       offsets_n++;
@@ -181,14 +1043,16 @@ int linescan_find(const char* buf, uint64_t cmask, size_t n, linescan* result){
   /* Step 2: Search multiple bytes using uint64_t masks (see memchr for details) */
   while(n >= 8){
     LINESCAN_DBG(result->debug_steps_2++;)
-    uint64_t w_nl = *lb ^ NL_MASK;
+    uint64_t w_nl = *lb ^ tmask;
     
     if ((((w_nl - ONES_MASK) & ~w_nl) & ONES_MASK_7) != 0){
       break;
     }
+    LINESCAN_COUNT(bytes_body, 8)
 
     uint64_t w_t = *lb ^ cmask;
     if ((((w_t - ONES_MASK) & ~w_t) & ONES_MASK_7) != 0){
+      LINESCAN_COUNT(slow_words, 1)
       for(size_t i=0;i<8;i++){
 	unsigned char c = ((const unsigned char*)lb)[i];
 	size_t offset_base = n0 - n;
@@ -208,11 +1072,12 @@ int linescan_find(const char* buf, uint64_t cmask, size_t n, linescan* result){
      or a detected newline in the last step. */
   for(; n > 0; n--, b++){
     LINESCAN_DBG(result->debug_steps_3++;)
+    LINESCAN_COUNT(bytes_tail, 1)
     unsigned char c = *b;
     if(c == c_ref){
       offsets[offsets_n] = n0 - n;
       offsets_n++;
-    } else if(c == NL){
+    } else if(c == t_ref){
       size_t offset = n0 - n;
       offsets[offsets_n] = offset;
       offsets_n++;
@@ -225,16 +1090,29 @@ int linescan_find(const char* buf, uint64_t cmask, size_t n, linescan* result){
   return 0;
 }
 
+/* The portable kernel validates UTF-8 of the line found in a second pass; it
+   is still in L1 cache. */
+int linescan_find_swar(const char* buf, uint64_t cmask, size_t n, linescan* result){
+  int rc = linescan_find_word(buf, cmask, NL_MASK, n, result);
+  if(result->utf8) result->utf8_invalid = linescan_utf8_check((const unsigned char*)buf, 0, result->size);
+  return rc;
+}
+
+int linescan_find_term_swar(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result){
+  int rc = linescan_find_word(buf, cmask, tmask, n, result);
+  if(result->utf8) result->utf8_invalid = linescan_utf8_check((const unsigned char*)buf, 0, result->size);
+  return rc;
+}
+
 /* Adapted from glibc string/memrchr.c
    HERE BE DRAGONS.
-   See linescan_find for details about undefined behavior.
+   See linescan_find_word for details about undefined behavior.
  */
-int linescan_rfind(const char* buf, uint64_t cmask, size_t n, linescan* result){
-  LINESCAN_CHECK(buf != NULL, -1)
-  LINESCAN_CHECK(result != NULL, -1)
-  LINESCAN_DBG(linescan_reset_debug(result);)
+static inline __attribute__((always_inline))
+int linescan_rfind_word(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result){
   const unsigned char* b;
   unsigned char c_ref = (unsigned char)cmask;
+  unsigned char t_ref = (unsigned char)tmask;
   size_t* offsets = result->offsets;
   size_t n0 = n;
 
@@ -246,11 +1124,12 @@ int linescan_rfind(const char* buf, uint64_t cmask, size_t n, linescan* result){
       n > 0 && ((uint64_t)b & (uint64_t)7) !=0;
       n--){
     LINESCAN_DBG(result->debug_steps_1++;)
+    LINESCAN_COUNT(bytes_head, 1)
     unsigned char c = *--b;
     if(c == c_ref){
       offsets[offsets_n] = n - 1;
       offsets_n++;
-    } else if(c == NL){
+    } else if(c == t_ref){
       offsets[offsets_n] = n - 1;
       offsets_n++;
       linescan_update(result, buf, n0 - n + 1, offsets_n);
@@ -263,21 +1142,23 @@ int linescan_rfind(const char* buf, uint64_t cmask, size_t n, linescan* result){
   /* Step 2: Search multiple bytes using uint64_t masks (see memrchr for details) */
   while(n >= 8){
     LINESCAN_DBG(result->debug_steps_2++;)
+    LINESCAN_COUNT(bytes_body, 8)
     n -= 8;
     uint64_t w_t = *--lb ^ cmask;
-    uint64_t w_nl = *lb ^ NL_MASK;
+    uint64_t w_nl = *lb ^ tmask;
 
     if ((((w_t + RFIND_MAGIC_MASK) ^ ~w_t) & ~RFIND_MAGIC_MASK) != 0
 	||
 	(((w_nl + RFIND_MAGIC_MASK) ^ ~w_nl) & ~RFIND_MAGIC_MASK) != 0
 	){
+      LINESCAN_COUNT(slow_words, 1)
       for(int i=7;i>=0;i--){
 	unsigned char c = ((const unsigned char*)lb)[i];
 	size_t offset_base = n;
 	if(c == c_ref) {
 	  offsets[offsets_n] = offset_base + i;
 	  offsets_n++;
-	} else if(c == NL) {
+	} else if(c == t_ref) {
 	  size_t offset = offset_base + i;
 	  offsets[offsets_n] = offset;
 	  offsets_n++;
@@ -294,11 +1175,12 @@ int linescan_rfind(const char* buf, uint64_t cmask, size_t n, linescan* result){
   /* Step 3: There is less than 8 bytes left to search */
   while(n-- > 0){
     LINESCAN_DBG(result->debug_steps_3++;)
+    LINESCAN_COUNT(bytes_tail, 1)
     unsigned char c = *--b;
     if(c == c_ref){
       offsets[offsets_n] = n;
       offsets_n++;
-    } else if(c == NL){
+    } else if(c == t_ref){
       offsets[offsets_n] = n;
       offsets_n++;
       linescan_update(result, buf, n0 - n, offsets_n);
@@ -310,9 +1192,674 @@ int linescan_rfind(const char* buf, uint64_t cmask, size_t n, linescan* result){
   return 0;
 }
 
+int linescan_rfind_swar(const char* buf, uint64_t cmask, size_t n, linescan* result){
+  return linescan_rfind_word(buf, cmask, NL_MASK, n, result);
+}
 
-  
+int linescan_rfind_term_swar(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result){
+  return linescan_rfind_word(buf, cmask, tmask, n, result);
+}
 
-  
+/* Exact per-byte variant of the memchr bit trick: returns 0x80 in every byte of w
+   that is zero and 0x00 in all other bytes. */
+static inline uint64_t linescan_zero_bytes(uint64_t w){
+  const uint64_t low_7 = ~ONES_MASK_7;
+  return ~(((w & low_7) + low_7) | w | low_7);
+}
 
-      
+/* Compresses the high bits of all bytes into the low 8 bits (bit i = byte i) */
+static inline uint64_t linescan_movemask(uint64_t w){
+  return ((w >> 7) * 0x0102040810204080) >> 56;
+}
+
+/* Portable find_bitmap kernel, 8 bytes per step. */
+int linescan_find_bitmap_swar(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm){
+  const unsigned char* b = (const unsigned char*)buf;
+  size_t i = 0;
+  size_t w = 0;
+
+  if(linescan_bitmap_reserve(bm, n) != 0) return -1;
+  uint64_t* delims = bm->delims;
+  uint64_t* newlines = bm->newlines;
+
+  while(i < n){
+    uint64_t m_c = 0;
+    uint64_t m_nl = 0;
+    size_t j = 0;
+    for(; j < 64 && n - i >= 8; j += 8, i += 8){
+      uint64_t x;
+      memcpy(&x, b + i, 8);
+      m_c |= linescan_movemask(linescan_zero_bytes(x ^ cmask)) << j;
+      m_nl |= linescan_movemask(linescan_zero_bytes(x ^ NL_MASK)) << j;
+    }
+    for(; j < 64 && i < n; j++, i++){
+      unsigned char c = b[i];
+      if(c == (unsigned char)cmask) m_c |= ((uint64_t)1) << j;
+      else if(c == NL) m_nl |= ((uint64_t)1) << j;
+    }
+    delims[w] = m_c;
+    newlines[w] = m_nl & ~m_c;
+    w++;
+  }
+
+  return linescan_bitmap_update(bm, buf, n);
+}
+
+void linescan_block_swar(const char* buf, uint64_t cmask, size_t n,
+			 uint64_t* m_c, uint64_t* m_nl){
+  const unsigned char* b = (const unsigned char*)buf;
+  uint64_t c = 0;
+  uint64_t nl = 0;
+  size_t j = 0;
+
+  for(; n - j >= 8; j += 8){
+    uint64_t x;
+    memcpy(&x, b + j, 8);
+    c |= linescan_movemask(linescan_zero_bytes(x ^ cmask)) << j;
+    nl |= linescan_movemask(linescan_zero_bytes(x ^ NL_MASK)) << j;
+  }
+  for(; j < n; j++){
+    if(b[j] == (unsigned char)cmask) c |= ((uint64_t)1) << j;
+    else if(b[j] == NL) nl |= ((uint64_t)1) << j;
+  }
+  *m_c = c;
+  *m_nl = nl & ~c;
+}
+
+/* Portable count_all kernel, 64 characters per block like the vector kernels. */
+int linescan_count_all_swar(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts){
+  size_t lines_n = 0;
+  size_t delims_n = 0;
+  size_t fields = 0;
+  size_t fields_max = 0;
+
+  for(size_t i = 0; i < n; i += 64){
+    size_t k = n - i < 64 ? n - i : 64;
+    LINESCAN_COUNT(bytes_body, k == 64 ? k : 0)
+    LINESCAN_COUNT(bytes_tail, k == 64 ? 0 : k)
+    uint64_t m_c;
+    uint64_t m_nl;
+    linescan_block_swar(buf + i, cmask, k, &m_c, &m_nl);
+    linescan_counts_block(m_c, m_nl, &lines_n, &delims_n, &fields, &fields_max);
+  }
+
+  int ends_nl = n > 0 && buf[n - 1] == NL && (unsigned char)cmask != NL;
+  return linescan_counts_update(counts, buf, n, lines_n, delims_n, fields, fields_max, ends_nl);
+}
+
+void linescan_block_quoted_swar(const char* buf, uint64_t cmask, uint64_t qmask, size_t n,
+				uint64_t* m_c, uint64_t* m_nl, uint64_t* m_q){
+  const unsigned char* b = (const unsigned char*)buf;
+  uint64_t c = 0;
+  uint64_t nl = 0;
+  uint64_t q = 0;
+  size_t j = 0;
+
+  for(; n - j >= 8; j += 8){
+    uint64_t x;
+    memcpy(&x, b + j, 8);
+    c |= linescan_movemask(linescan_zero_bytes(x ^ cmask)) << j;
+    nl |= linescan_movemask(linescan_zero_bytes(x ^ NL_MASK)) << j;
+    q |= linescan_movemask(linescan_zero_bytes(x ^ qmask)) << j;
+  }
+  for(; j < n; j++){
+    if(b[j] == (unsigned char)cmask) c |= ((uint64_t)1) << j;
+    else if(b[j] == NL) nl |= ((uint64_t)1) << j;
+    else if(b[j] == (unsigned char)qmask) q |= ((uint64_t)1) << j;
+  }
+  *m_c = c;
+  *m_nl = nl & ~c;
+  *m_q = q & ~(c | nl);
+}
+
+/* Portable find_all kernel. Words are loaded with memcpy, so no alignment
+   step is needed. Words without a match are skipped, every other word is
+   searched byte by byte. */
+int linescan_find_all_swar(const char* buf, uint64_t cmask, size_t n, linescan_index* index){
+  const unsigned char* b = (const unsigned char*)buf;
+  unsigned char c_ref = (unsigned char)cmask;
+  size_t offsets_n = 1;
+  size_t lines_n = 0;
+  size_t i = 0;
+
+  if(linescan_index_reserve(index, 0, 0, 1) != 0) return -1;
+  index->offsets[0] = 0;
+  index->lines[0] = 0;
+
+  while(i < n){
+    // Every byte adds at most two offsets (newline and start of next line)
+    if(linescan_index_reserve(index, offsets_n, lines_n, 16) != 0) return -1;
+    size_t* offsets = index->offsets;
+    size_t* lines = index->lines;
+    size_t end = n - i >= 8 ? i + 8 : n;
+
+    if(end - i == 8){
+      LINESCAN_COUNT(bytes_body, 8)
+      uint64_t w;
+      memcpy(&w, b + i, 8);
+      uint64_t w_t = w ^ cmask;
+      uint64_t w_nl = w ^ NL_MASK;
+      if (((((w_t - ONES_MASK) & ~w_t) | ((w_nl - ONES_MASK) & ~w_nl)) & ONES_MASK_7) == 0){
+	i = end;
+	continue;
+      }
+      LINESCAN_COUNT(slow_words, 1)
+    } else {
+      LINESCAN_COUNT(bytes_tail, end - i)
+    }
+
+    for(; i < end; i++){
+      unsigned char c = b[i];
+      if(c == c_ref){
+	offsets[offsets_n] = i;
+	offsets_n++;
+      } else if(c == NL){
+	offsets[offsets_n] = i;
+	offsets_n++;
+	lines_n++;
+	lines[lines_n] = offsets_n;
+	offsets[offsets_n] = i + 1;
+	offsets_n++;
+      }
+    }
+  }
+
+  return linescan_index_update(index, buf, n, lines_n);
+}
+
+/* Portable find_class kernel. Words without any character of the set are
+   skipped by the lookup table alone, there is no word-at-a-time shortcut for
+   arbitrary sets. */
+int linescan_find_class_swar(const char* buf, const linescan_class* cl, size_t n, linescan_hits* hits){
+  const unsigned char* b = (const unsigned char*)buf;
+  const uint8_t* classes = cl->classes;
+  size_t hits_n = 0;
+
+  for(size_t i = 0; i < n; i += 64){
+    if(linescan_hits_reserve(hits, hits_n, 64) != 0) return -1;
+    size_t end = n - i < 64 ? n : i + 64;
+    for(size_t k = i; k < end; k++){
+      uint8_t c = classes[b[k]];
+      if(c != 0){
+	hits->offsets[hits_n] = k;
+	hits->classes[hits_n] = c - 1;
+	hits_n++;
+      }
+    }
+  }
+  return linescan_hits_update(hits, buf, n, hits_n);
+}
+
+/* Kernel selection.
+   The public search functions call through these pointers. They start out
+   at the portable kernels and are switched to the best vector kernel supported
+   by the CPU once at load time.
+ */
+
+typedef struct linescan_kernel_impl {
+  const char* name;
+  linescan_find_fn find;
+  linescan_find_fn rfind;
+  linescan_find_term_fn find_term;
+  linescan_find_term_fn rfind_term;
+  linescan_find_all_fn find_all;
+  linescan_find_bitmap_fn find_bitmap;
+  linescan_count_all_fn count_all;
+  linescan_block_fn block;
+  linescan_block_quoted_fn block_quoted;
+  linescan_find_class_fn find_class;
+} linescan_kernel_impl;
+
+static const linescan_kernel_impl linescan_kernels[] = {
+  [LINESCAN_KERNEL_AUTO] = { .name = "auto" },
+  [LINESCAN_KERNEL_SWAR] = {
+    .name = "swar",
+    .find = linescan_find_swar,
+    .rfind = linescan_rfind_swar,
+    .find_term = linescan_find_term_swar,
+    .rfind_term = linescan_rfind_term_swar,
+    .find_all = linescan_find_all_swar,
+    .find_bitmap = linescan_find_bitmap_swar,
+    .count_all = linescan_count_all_swar,
+    .block = linescan_block_swar,
+    .block_quoted = linescan_block_quoted_swar,
+    .find_class = linescan_find_class_swar,
+  },
+#if LINESCAN_HAVE_X86
+  [LINESCAN_KERNEL_SSE2] = {
+    .name = "sse2",
+    .find = linescan_find_sse2,
+    .rfind = linescan_rfind_sse2,
+    .find_term = linescan_find_term_sse2,
+    .rfind_term = linescan_rfind_term_sse2,
+    .find_all = linescan_find_all_sse2,
+    .find_bitmap = linescan_find_bitmap_sse2,
+    .count_all = linescan_count_all_sse2,
+    .block = linescan_block_sse2,
+    .block_quoted = linescan_block_quoted_sse2,
+    // SSE2 has no byte shuffle (pshufb is SSSE3)
+    .find_class = linescan_find_class_swar,
+  },
+  [LINESCAN_KERNEL_AVX2] = {
+    .name = "avx2",
+    .find = linescan_find_avx2,
+    .rfind = linescan_rfind_avx2,
+    .find_term = linescan_find_term_avx2,
+    .rfind_term = linescan_rfind_term_avx2,
+    .find_all = linescan_find_all_avx2,
+    .find_bitmap = linescan_find_bitmap_avx2,
+    .count_all = linescan_count_all_avx2,
+    .block = linescan_block_avx2,
+    .block_quoted = linescan_block_quoted_avx2,
+    .find_class = linescan_find_class_avx2,
+  },
+  [LINESCAN_KERNEL_AVX512BW] = {
+    .name = "avx512bw",
+    .find = linescan_find_avx512bw,
+    .rfind = linescan_rfind_avx512bw,
+    .find_term = linescan_find_term_avx512bw,
+    .rfind_term = linescan_rfind_term_avx512bw,
+    .find_all = linescan_find_all_avx512bw,
+    .find_bitmap = linescan_find_bitmap_avx512bw,
+    .count_all = linescan_count_all_avx512bw,
+    .block = linescan_block_avx512bw,
+    .block_quoted = linescan_block_quoted_avx512bw,
+    .find_class = linescan_find_class_avx512bw,
+  },
+#else
+  [LINESCAN_KERNEL_SSE2] = { .name = "sse2" },
+  [LINESCAN_KERNEL_AVX2] = { .name = "avx2" },
+  [LINESCAN_KERNEL_AVX512BW] = { .name = "avx512bw" },
+#endif
+};
+
+static linescan_kernel linescan_active_kernel = LINESCAN_KERNEL_SWAR;
+// Set if the kernel was chosen with linescan_set_kernel instead of LINESCAN_KERNEL_AUTO
+static int linescan_kernel_pinned = 0;
+static linescan_find_fn linescan_find_impl = linescan_find_swar;
+static linescan_find_fn linescan_rfind_impl = linescan_rfind_swar;
+static linescan_find_term_fn linescan_find_term_impl = linescan_find_term_swar;
+static linescan_find_term_fn linescan_rfind_term_impl = linescan_rfind_term_swar;
+static linescan_find_all_fn linescan_find_all_impl = linescan_find_all_swar;
+static linescan_find_bitmap_fn linescan_find_bitmap_impl = linescan_find_bitmap_swar;
+static linescan_count_all_fn linescan_count_all_impl = linescan_count_all_swar;
+linescan_block_fn linescan_block_impl = linescan_block_swar;
+linescan_block_quoted_fn linescan_block_quoted_impl = linescan_block_quoted_swar;
+static linescan_find_class_fn linescan_find_class_impl = linescan_find_class_swar;
+
+int linescan_kernel_supported(linescan_kernel kernel){
+  switch(kernel){
+  case LINESCAN_KERNEL_AUTO:
+  case LINESCAN_KERNEL_SWAR:
+    return 1;
+#if LINESCAN_HAVE_X86
+  case LINESCAN_KERNEL_SSE2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2") != 0;
+  case LINESCAN_KERNEL_AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi")
+      && __builtin_cpu_supports("bmi2");
+  case LINESCAN_KERNEL_AVX512BW:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+      && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2");
+#endif
+  default:
+    return 0;
+  }
+}
+
+int linescan_set_kernel(linescan_kernel kernel){
+  int pinned = kernel != LINESCAN_KERNEL_AUTO;
+  if(kernel == LINESCAN_KERNEL_AUTO){
+    kernel = LINESCAN_KERNEL_SWAR;
+    for(int k = LINESCAN_KERNEL_SWAR + 1; k < LINESCAN_KERNEL_N; k++){
+      if(linescan_kernel_supported((linescan_kernel)k)) kernel = (linescan_kernel)k;
+    }
+  }
+  if(!linescan_kernel_supported(kernel)) return -1;
+  linescan_active_kernel = kernel;
+  linescan_kernel_pinned = pinned;
+  linescan_find_impl = linescan_kernels[kernel].find;
+  linescan_rfind_impl = linescan_kernels[kernel].rfind;
+  linescan_find_term_impl = linescan_kernels[kernel].find_term;
+  linescan_rfind_term_impl = linescan_kernels[kernel].rfind_term;
+  linescan_find_all_impl = linescan_kernels[kernel].find_all;
+  linescan_find_bitmap_impl = linescan_kernels[kernel].find_bitmap;
+  linescan_count_all_impl = linescan_kernels[kernel].count_all;
+  linescan_block_impl = linescan_kernels[kernel].block;
+  linescan_block_quoted_impl = linescan_kernels[kernel].block_quoted;
+  linescan_find_class_impl = linescan_kernels[kernel].find_class;
+  return 0;
+}
+
+linescan_kernel linescan_get_kernel(void){
+  return linescan_active_kernel;
+}
+
+// Calls per sample window of an adaptive scanner, and per kernel on trial
+#define LINESCAN_ADAPTIVE_WINDOW 256
+#define LINESCAN_ADAPTIVE_TRIAL 64
+
+static uint64_t linescan_adaptive_clock(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void linescan_adaptive_init(linescan_adaptive* a){
+  memset(a, 0, sizeof(*a));
+  a->kernel = linescan_active_kernel;
+  a->trial = linescan_kernel_pinned ? LINESCAN_KERNEL_AUTO : LINESCAN_KERNEL_SWAR;
+}
+
+static void linescan_adaptive_next_window(linescan_adaptive* a){
+  a->calls = 0;
+  a->lines = 0;
+  a->bytes = 0;
+  a->matches = 0;
+  a->elapsed = 0;
+}
+
+static size_t linescan_adaptive_length(const linescan_adaptive* a){
+  return a->bytes / (a->lines > 0 ? a->lines : 1);
+}
+
+static size_t linescan_adaptive_density(const linescan_adaptive* a){
+  return a->matches * 1024 / (a->bytes > 0 ? a->bytes : 1);
+}
+
+// @returns 1 if x and ref differ by more than a factor of 2 (small values are treated alike)
+static int linescan_adaptive_changed(size_t x, size_t ref){
+  x += 8;
+  ref += 8;
+  return x > ref * 2 || ref > x * 2;
+}
+
+// Ends the trial window of a->trial and moves on to the next kernel or picks the fastest.
+static void linescan_adaptive_trial(linescan_adaptive* a){
+  a->costs[a->trial] = a->elapsed * 1024 / (a->bytes > 0 ? a->bytes : 1);
+  int k = a->trial + 1;
+  while(k < LINESCAN_KERNEL_N && !linescan_kernel_supported((linescan_kernel)k)) k++;
+  if(k < LINESCAN_KERNEL_N){
+    a->trial = (linescan_kernel)k;
+    linescan_adaptive_next_window(a);
+    return;
+  }
+
+  linescan_kernel best = a->kernel;
+  for(k = LINESCAN_KERNEL_SWAR; k < LINESCAN_KERNEL_N; k++){
+    if(linescan_kernel_supported((linescan_kernel)k) && a->costs[k] < a->costs[best]) best = (linescan_kernel)k;
+  }
+  // The first trials decide at once, later ones need a clear gain
+  uint64_t cost = a->costs[a->kernel];
+  if(best != a->kernel && (a->trials == 0 || a->costs[best] < cost - cost / 8)){
+    a->kernel = best;
+    LINESCAN_COUNT(adaptive_switches, 1)
+  }
+  a->trial = LINESCAN_KERNEL_AUTO;
+  a->trials++;
+  a->length = linescan_adaptive_length(a);
+  a->density = linescan_adaptive_density(a);
+  linescan_adaptive_next_window(a);
+}
+
+// Ends a window outside of trials; repeats the trials if the data changed.
+static void linescan_adaptive_window(linescan_adaptive* a){
+  if(linescan_adaptive_changed(linescan_adaptive_length(a), a->length) ||
+     linescan_adaptive_changed(linescan_adaptive_density(a), a->density)){
+    a->trial = LINESCAN_KERNEL_SWAR;
+  }
+  a->windows++;
+  linescan_adaptive_next_window(a);
+}
+
+const char* linescan_kernel_name(linescan_kernel kernel){
+  if((int)kernel < 0 || kernel >= LINESCAN_KERNEL_N) return NULL;
+  return linescan_kernels[kernel].name;
+}
+
+__attribute__ ((constructor)) static void linescan_init_kernel(void){
+  linescan_set_kernel(LINESCAN_KERNEL_AUTO);
+}
+
+int linescan_find(const char* buf, uint64_t cmask, size_t n, linescan* result){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(result != NULL, -1)
+  LINESCAN_DBG(linescan_reset_debug(result);)
+  LINESCAN_STAT(uint64_t start = linescan_stats_begin();)
+  int rc = linescan_find_impl(buf, cmask, n, result);
+  LINESCAN_STAT(linescan_stats_end(start); if(rc == 1) linescan_stats_line(result->size);)
+  return rc;
+}
+
+int linescan_rfind(const char* buf, uint64_t cmask, size_t n, linescan* result){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(result != NULL, -1)
+  LINESCAN_DBG(linescan_reset_debug(result);)
+  LINESCAN_STAT(uint64_t start = linescan_stats_begin();)
+  int rc = linescan_rfind_impl(buf, cmask, n, result);
+  LINESCAN_STAT(linescan_stats_end(start); if(rc == 1) linescan_stats_line(result->size);)
+  return rc;
+}
+
+int linescan_find_adaptive(const char* buf, uint64_t cmask, size_t n, linescan* result,
+			   linescan_adaptive* a){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(result != NULL, -1)
+  LINESCAN_CHECK(a != NULL, -1)
+  LINESCAN_DBG(linescan_reset_debug(result);)
+  if(linescan_kernel_pinned){
+    // Kernel chosen by the caller
+    a->kernel = linescan_active_kernel;
+    a->trial = LINESCAN_KERNEL_AUTO;
+  }
+  linescan_kernel kernel = a->trial != LINESCAN_KERNEL_AUTO ? a->trial : a->kernel;
+  LINESCAN_STAT(uint64_t start = linescan_stats_begin();)
+  int rc;
+  if(a->trial != LINESCAN_KERNEL_AUTO){
+    // Only the kernel is timed, not the work of the caller between calls
+    uint64_t t = linescan_adaptive_clock();
+    rc = linescan_kernels[kernel].find(buf, cmask, n, result);
+    a->elapsed += linescan_adaptive_clock() - t;
+  } else {
+    rc = linescan_kernels[kernel].find(buf, cmask, n, result);
+  }
+  LINESCAN_STAT(linescan_stats_end(start); if(rc == 1) linescan_stats_line(result->size);)
+  LINESCAN_COUNT(adaptive_kernels[kernel], 1)
+  if(linescan_kernel_pinned) return rc;
+
+  // Offsets hold the start, the delimiters and, if found, the newline
+  a->calls++;
+  a->lines += rc;
+  a->bytes += result->size;
+  a->matches += result->offsets_n - 1 - rc;
+  if(a->trial != LINESCAN_KERNEL_AUTO){
+    if(a->calls == LINESCAN_ADAPTIVE_TRIAL) linescan_adaptive_trial(a);
+  } else if(a->calls == LINESCAN_ADAPTIVE_WINDOW){
+    linescan_adaptive_window(a);
+  }
+  return rc;
+}
+
+int linescan_find_term(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(result != NULL, -1)
+  LINESCAN_CHECK(cmask != tmask, -1)
+  LINESCAN_DBG(linescan_reset_debug(result);)
+  LINESCAN_STAT(uint64_t start = linescan_stats_begin();)
+  int rc = linescan_find_term_impl(buf, cmask, tmask, n, result);
+  LINESCAN_STAT(linescan_stats_end(start); if(rc == 1) linescan_stats_line(result->size);)
+  return rc;
+}
+
+int linescan_rfind_term(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(result != NULL, -1)
+  LINESCAN_CHECK(cmask != tmask, -1)
+  LINESCAN_DBG(linescan_reset_debug(result);)
+  LINESCAN_STAT(uint64_t start = linescan_stats_begin();)
+  int rc = linescan_rfind_term_impl(buf, cmask, tmask, n, result);
+  LINESCAN_STAT(linescan_stats_end(start); if(rc == 1) linescan_stats_line(result->size);)
+  return rc;
+}
+
+int linescan_find_crlf(const char* buf, uint64_t cmask, size_t n, linescan* result){
+  LINESCAN_CHECK((unsigned char)cmask != '\r', -1)
+  int rc = linescan_find(buf, cmask, n, result);
+  if(rc == 1){
+    // The newline was found in this pass, so the character in front of it is at hand
+    size_t* last = &result->offsets[result->offsets_n - 1];
+    if(*last > 0 && buf[*last - 1] == '\r') (*last)--;
+  }
+  return rc;
+}
+
+int linescan_find_all(const char* buf, uint64_t cmask, size_t n, linescan_index* index){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(index != NULL, -1)
+  LINESCAN_STAT(uint64_t start = linescan_stats_begin();)
+  int rc = linescan_find_all_impl(buf, cmask, n, index);
+  LINESCAN_STAT(
+    linescan_stats_end(start);
+    if(rc >= 0){
+      for(size_t i = 0; i < index->lines_n; i++){
+	size_t first = index->lines[i];
+	size_t last = index->lines[i + 1] - 1;
+	linescan_stats_line(index->offsets[last] + 1 - index->offsets[first]);
+      }
+    })
+  return rc;
+}
+
+// Buffers whose first blocks linescan_find_batch searches together
+#define LINESCAN_BATCH_GROUP 4
+
+int linescan_find_batch(const char* const* bufs, const size_t* ns, size_t buffers_n, uint64_t cmask,
+			linescan_batch* batch){
+  LINESCAN_CHECK(bufs != NULL || buffers_n == 0, -1)
+  LINESCAN_CHECK(ns != NULL || buffers_n == 0, -1)
+  LINESCAN_CHECK(batch != NULL, -1)
+  if(linescan_batch_grow(batch, 0, buffers_n) != 0) return -1;
+  LINESCAN_STAT(uint64_t start = linescan_stats_begin();)
+  linescan_find_fn find = linescan_find_impl;
+  linescan_block_fn block = linescan_block_impl;
+
+  // Searches lines continuing behind the first block, writing straight into the arena
+  linescan view;
+  view.utf8 = 0;
+  LINESCAN_DBG(linescan_reset_debug(&view);)
+  size_t offsets_n = 0;
+  batch->starts[0] = 0;
+
+  for(size_t i = 0; i < buffers_n && i < LINESCAN_BATCH_GROUP; i++) __builtin_prefetch(bufs[i]);
+  for(size_t g = 0; g < buffers_n; g += LINESCAN_BATCH_GROUP){
+    size_t group_n = buffers_n - g < LINESCAN_BATCH_GROUP ? buffers_n - g : LINESCAN_BATCH_GROUP;
+    uint64_t m_c[LINESCAN_BATCH_GROUP];
+    uint64_t m_nl[LINESCAN_BATCH_GROUP];
+
+    /* Bitmaps of the first 64 characters of every buffer in the group. The
+       loads do not depend on each other, so their latencies overlap. */
+    for(size_t j = 0; j < group_n; j++){
+      size_t n = ns[g + j] < 64 ? ns[g + j] : 64;
+      m_c[j] = 0;
+      m_nl[j] = 0;
+      if(n > 0) block(bufs[g + j], cmask, n, &m_c[j], &m_nl[j]);
+    }
+    for(size_t i = g + LINESCAN_BATCH_GROUP; i < buffers_n && i < g + 2 * LINESCAN_BATCH_GROUP; i++){
+      __builtin_prefetch(bufs[i]);
+    }
+
+    for(size_t j = 0; j < group_n; j++){
+      size_t i = g + j;
+      size_t n = ns[i];
+      if(offsets_n + n + 1 > batch->offsets_size && linescan_batch_grow(batch, offsets_n + n + 1, 0) != 0){
+	LINESCAN_STAT(linescan_stats_end(start);)
+	return -1;
+      }
+      size_t* o = batch->offsets + offsets_n;
+      uint64_t c = m_c[j];
+      uint64_t nl = m_nl[j];
+      int rc;
+      size_t size;
+      size_t k = 0;
+      if(nl != 0 || n <= 64){
+	// Keep delimiters in front of the first newline only
+	if(nl != 0) c &= (nl & -nl) - 1;
+	o[k++] = 0;
+	for(; c != 0; c &= c - 1) o[k++] = __builtin_ctzll(c);
+	rc = nl != 0;
+	size = nl != 0 ? (size_t)__builtin_ctzll(nl) + 1 : n;
+	if(nl != 0) o[k++] = size - 1;
+      } else {
+	// The line continues behind the first block: search the buffer as a whole
+	view.offsets = o;
+	rc = find(bufs[i], cmask, n, &view);
+	k = view.offsets_n;
+	size = view.size;
+      }
+      LINESCAN_STAT(if(rc == 1) linescan_stats_line(size);)
+      batch->sizes[i] = size;
+      batch->status[i] = (int8_t)rc;
+      offsets_n += k;
+      batch->starts[i + 1] = offsets_n;
+    }
+  }
+  batch->offsets_n = offsets_n;
+  batch->buffers_n = buffers_n;
+  LINESCAN_STAT(linescan_stats_end(start);)
+  return 0;
+}
+
+int linescan_find_class(const char* buf, const linescan_class* cl, size_t n, linescan_hits* hits){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(cl != NULL, -1)
+  LINESCAN_CHECK(hits != NULL, -1)
+  return linescan_find_class_impl(buf, cl, n, hits);
+}
+
+int linescan_find_bitmap(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(bm != NULL, -1)
+  return linescan_find_bitmap_impl(buf, cmask, n, bm);
+}
+
+int linescan_count(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(counts != NULL, -1)
+  size_t delims_n = 0;
+
+  counts->buf = buf;
+  counts->lines_n = 0;
+  for(size_t i = 0; i < n; i += 64){
+    size_t k = n - i < 64 ? n - i : 64;
+    uint64_t m_c;
+    uint64_t m_nl;
+    linescan_block_impl(buf + i, cmask, k, &m_c, &m_nl);
+    if(m_nl != 0){
+      // Count the matches in front of the first newline only
+      m_nl &= -m_nl;
+      delims_n += __builtin_popcountll(m_c & (m_nl - 1));
+      counts->size = i + __builtin_ctzll(m_nl) + 1;
+      counts->lines_n = 1;
+      counts->delims_n = delims_n;
+      counts->fields_max = delims_n + 1;
+      return 1;
+    }
+    delims_n += __builtin_popcountll(m_c);
+  }
+  counts->size = n;
+  counts->delims_n = delims_n;
+  counts->fields_max = n > 0 ? delims_n + 1 : 0;
+  return 0;
+}
+
+int linescan_count_all(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(counts != NULL, -1)
+  LINESCAN_STAT(uint64_t start = linescan_stats_begin();)
+  int rc = linescan_count_all_impl(buf, cmask, n, counts);
+  LINESCAN_STAT(linescan_stats_end(start);)
+  return rc;
+}
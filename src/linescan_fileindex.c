@@ -0,0 +1,510 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define _GNU_SOURCE
+
+#include <linescan_fileindex.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char LINESCAN_FILEINDEX_MAGIC[8] = { 'L', 'S', 'C', 'A', 'N', 'I', 'D', 'X' };
+static const uint64_t LINESCAN_FILEINDEX_VERSION = 1;
+// Lines per block
+static const uint64_t LINESCAN_FILEINDEX_BLOCK = 128;
+// Number of characters searched per linescan_find_all call
+static const size_t LINESCAN_FILEINDEX_STEP = 1 << 24;
+// Number of characters in front of the end of the indexed part covered by the check sum
+#define LINESCAN_FILEINDEX_CHECK 4096
+// Encoded lines are written to the index file in pieces of this size
+static const size_t LINESCAN_FILEINDEX_FLUSH = 1 << 20;
+
+/* Layout of an index file:
+   header | blocks (data_end) | padding | directory (dir_offset)
+   The directory holds two entries per block: the file offset of the first line
+   of the block and the index file offset of its data. Every line is stored as
+   varint(length including the newline), followed with LINESCAN_FILEINDEX_FIELDS
+   by varint(number of cmask matches) and varint(distance of every match to the
+   previous match or the line start). */
+typedef struct linescan_fileindex_header {
+  char magic[8];
+  uint64_t version;
+  uint64_t flags;
+  uint64_t cmask;
+  uint64_t block_lines;
+  uint64_t lines_n;
+  // Number of indexed characters (end of the last indexed line)
+  uint64_t size;
+  // FNV-1a hash of the characters in front of size
+  uint64_t check;
+  uint64_t data_end;
+  uint64_t dir_offset;
+} linescan_fileindex_header;
+
+struct linescan_fileindex {
+  linescan_fileindex_header header;
+  // Mapped index file
+  char* index_map;
+  size_t index_len;
+  const uint64_t* dir;
+  // Mapped file
+  char* map;
+  size_t map_len;
+  // Result of the last lookup
+  linescan* line;
+};
+
+// Index file under construction
+typedef struct linescan_fileindex_writer {
+  int fd;
+  // Encoded lines not yet written
+  unsigned char* buf;
+  size_t buf_n;
+  size_t buf_size;
+  // Index file offset of buf[0]
+  uint64_t pos;
+  // Directory, two entries per block
+  uint64_t* dir;
+  size_t dir_n;
+  size_t dir_size;
+} linescan_fileindex_writer;
+
+static inline size_t linescan_varint_put(unsigned char* p, uint64_t v){
+  size_t k = 0;
+  while(v >= 0x80){
+    p[k++] = (unsigned char)v | 0x80;
+    v >>= 7;
+  }
+  p[k++] = (unsigned char)v;
+  return k;
+}
+
+/* Decodes a varint in front of end.
+   @returns 0 on success; -1 if the varint crosses end or is longer than 64 bits. */
+static inline int linescan_varint_get(const unsigned char** p, const unsigned char* end, uint64_t* v){
+  uint64_t x = 0;
+  for(int shift = 0; shift < 64 && *p < end; shift += 7){
+    unsigned char c = *(*p)++;
+    x |= (uint64_t)(c & 0x7f) << shift;
+    if(!(c & 0x80)){
+      *v = x;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int linescan_write_all(int fd, const void* buf, size_t len, uint64_t offset){
+  const char* p = buf;
+  while(len > 0){
+    ssize_t k = pwrite(fd, p, len, (off_t)offset);
+    if(k < 0) return -1;
+    p += k;
+    len -= (size_t)k;
+    offset += (uint64_t)k;
+  }
+  return 0;
+}
+
+static int linescan_read_all(int fd, void* buf, size_t len, uint64_t offset){
+  char* p = buf;
+  while(len > 0){
+    ssize_t k = pread(fd, p, len, (off_t)offset);
+    if(k <= 0) return -1;
+    p += k;
+    len -= (size_t)k;
+    offset += (uint64_t)k;
+  }
+  return 0;
+}
+
+/* Hashes the characters in front of size, so that a rewritten file is not
+   mistaken for a grown one. */
+static int linescan_fileindex_check(int fd, uint64_t size, uint64_t* check){
+  unsigned char buf[LINESCAN_FILEINDEX_CHECK];
+  size_t len = size < LINESCAN_FILEINDEX_CHECK ? size : LINESCAN_FILEINDEX_CHECK;
+  if(linescan_read_all(fd, buf, len, size - len) != 0) return -1;
+  uint64_t h = 14695981039346656037ULL;
+  for(size_t i = 0; i < len; i++){
+    h ^= buf[i];
+    h *= 1099511628211ULL;
+  }
+  *check = h;
+  return 0;
+}
+
+static int linescan_fileindex_valid(const linescan_fileindex_header* h){
+  return memcmp(h->magic, LINESCAN_FILEINDEX_MAGIC, 8) == 0
+    && h->version == LINESCAN_FILEINDEX_VERSION
+    && h->block_lines == LINESCAN_FILEINDEX_BLOCK
+    && h->data_end >= sizeof(linescan_fileindex_header)
+    && h->dir_offset >= h->data_end;
+}
+
+static size_t linescan_fileindex_blocks(const linescan_fileindex_header* h){
+  return (h->lines_n + h->block_lines - 1) / h->block_lines;
+}
+
+/* Reads header and directory of an existing index of the same file, cmask and flags.
+   @returns 0 if the index can be appended to, -1 otherwise. */
+static int linescan_fileindex_resume(int fd, size_t file_size, uint64_t cmask, int flags,
+				     linescan_fileindex_header* h, linescan_fileindex_writer* w){
+  uint64_t check;
+  if(linescan_read_all(w->fd, h, sizeof(*h), 0) != 0) return -1;
+  if(!linescan_fileindex_valid(h) || h->cmask != cmask || h->flags != (uint64_t)flags) return -1;
+  if(h->size > file_size) return -1;
+  if(linescan_fileindex_check(fd, h->size, &check) != 0 || check != h->check) return -1;
+
+  size_t dir_n = 2 * linescan_fileindex_blocks(h);
+  uint64_t* dir = malloc((dir_n + 2) * sizeof(uint64_t));
+  if(dir == NULL) return -1;
+  if(linescan_read_all(w->fd, dir, dir_n * sizeof(uint64_t), h->dir_offset) != 0){
+    free(dir);
+    return -1;
+  }
+  w->dir = dir;
+  w->dir_n = dir_n;
+  w->dir_size = dir_n + 2;
+  return 0;
+}
+
+static int linescan_fileindex_flush(linescan_fileindex_writer* w){
+  if(linescan_write_all(w->fd, w->buf, w->buf_n, w->pos) != 0) return -1;
+  w->pos += w->buf_n;
+  w->buf_n = 0;
+  return 0;
+}
+
+// Makes room for k more encoded bytes. @returns 0 on success, -1 on error.
+static int linescan_fileindex_reserve(linescan_fileindex_writer* w, size_t k){
+  if(w->buf_n + k <= w->buf_size) return 0;
+  if(w->buf_n >= LINESCAN_FILEINDEX_FLUSH && linescan_fileindex_flush(w) != 0) return -1;
+  if(w->buf_n + k <= w->buf_size) return 0;
+  size_t size = w->buf_size * 2 > w->buf_n + k ? w->buf_size * 2 : w->buf_n + k;
+  unsigned char* buf = realloc(w->buf, size);
+  if(buf == NULL) return -1;
+  w->buf = buf;
+  w->buf_size = size;
+  return 0;
+}
+
+static int linescan_fileindex_block(linescan_fileindex_writer* w, uint64_t offset){
+  if(w->dir_n + 2 > w->dir_size){
+    size_t size = w->dir_size * 2 + 2;
+    uint64_t* dir = realloc(w->dir, size * sizeof(uint64_t));
+    if(dir == NULL) return -1;
+    w->dir = dir;
+    w->dir_size = size;
+  }
+  w->dir[w->dir_n++] = offset;
+  w->dir[w->dir_n++] = w->pos + w->buf_n;
+  return 0;
+}
+
+/* Encodes all lines of index, which was searched at file offset base.
+   @returns 0 on success, -1 on error. */
+static int linescan_fileindex_encode(linescan_fileindex_writer* w, linescan_fileindex_header* h,
+				     const linescan_index* index, uint64_t base){
+  for(size_t i = 0; i < index->lines_n; i++){
+    const size_t* offsets = index->offsets + index->lines[i];
+    size_t matches = index->lines[i + 1] - index->lines[i] - 2;
+    size_t start = offsets[0];
+    if(h->lines_n % h->block_lines == 0 && linescan_fileindex_block(w, base + start) != 0) return -1;
+    if(linescan_fileindex_reserve(w, 20 + 10 * matches) != 0) return -1;
+
+    w->buf_n += linescan_varint_put(w->buf + w->buf_n, offsets[matches + 1] + 1 - start);
+    if(h->flags & LINESCAN_FILEINDEX_FIELDS){
+      w->buf_n += linescan_varint_put(w->buf + w->buf_n, matches);
+      size_t prev = start;
+      for(size_t j = 1; j <= matches; j++){
+	w->buf_n += linescan_varint_put(w->buf + w->buf_n, offsets[j] - prev);
+	prev = offsets[j];
+      }
+    }
+    h->lines_n++;
+  }
+  return 0;
+}
+
+/* Searches the file from h->size to file_size and encodes all complete lines.
+   @returns 0 on success, -1 on error. */
+static int linescan_fileindex_scan(int fd, size_t file_size, linescan_fileindex_header* h,
+				   linescan_fileindex_writer* w){
+  if(file_size <= h->size) return 0;
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t map_base = h->size / page_size * page_size;
+  size_t map_len = file_size - map_base;
+  char* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, (off_t)map_base);
+  if(map == MAP_FAILED) return -1;
+  madvise(map, map_len, MADV_SEQUENTIAL);
+
+  const char* buf = map + (h->size - map_base);
+  size_t avail = file_size - h->size;
+  linescan_index* index = linescan_index_create(1024, 64);
+  size_t done = 0;
+  size_t step = LINESCAN_FILEINDEX_STEP;
+  int rc = 0;
+
+  while(done < avail){
+    size_t n = avail - done < step ? avail - done : step;
+    if(linescan_find_all(buf + done, h->cmask, n, index) < 0){
+      rc = -1;
+      break;
+    }
+    if(index->lines_n == 0){
+      // No complete line in this step; search a longer step unless the file ends
+      if(done + n == avail) break;
+      step *= 2;
+      continue;
+    }
+    if(linescan_fileindex_encode(w, h, index, h->size + done) != 0){
+      rc = -1;
+      break;
+    }
+    done += index->size;
+    step = LINESCAN_FILEINDEX_STEP;
+  }
+  h->size += done;
+
+  linescan_index_free(index);
+  munmap(map, map_len);
+  return rc;
+}
+
+int linescan_fileindex_update(const char* path, const char* index_path, uint64_t cmask, int flags){
+  LINESCAN_CHECK(path != NULL, -1)
+  LINESCAN_CHECK(index_path != NULL, -1)
+  linescan_fileindex_header h;
+  linescan_fileindex_writer w = { .fd = -1 };
+  struct stat st;
+  int rc = -1;
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return -1;
+  if(fstat(fd, &st) != 0) goto done;
+  size_t file_size = (size_t)st.st_size;
+  w.fd = open(index_path, O_RDWR | O_CREAT, 0644);
+  if(w.fd < 0) goto done;
+
+  if(linescan_fileindex_resume(fd, file_size, cmask, flags, &h, &w) != 0){
+    // Start over
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LINESCAN_FILEINDEX_MAGIC, 8);
+    h.version = LINESCAN_FILEINDEX_VERSION;
+    h.flags = (uint64_t)flags;
+    h.cmask = cmask;
+    h.block_lines = LINESCAN_FILEINDEX_BLOCK;
+    h.data_end = sizeof(h);
+    w.dir_n = 0;
+  }
+
+  // Invalidate the index until the new header is written
+  linescan_fileindex_header invalid;
+  memset(&invalid, 0, sizeof(invalid));
+  if(linescan_write_all(w.fd, &invalid, sizeof(invalid), 0) != 0) goto done;
+
+  // New lines are appended to the last block, overwriting the directory
+  w.pos = h.data_end;
+  w.buf_size = 2 * LINESCAN_FILEINDEX_FLUSH;
+  w.buf = malloc(w.buf_size);
+  if(w.buf == NULL) goto done;
+  if(linescan_fileindex_scan(fd, file_size, &h, &w) != 0) goto done;
+  if(linescan_fileindex_flush(&w) != 0) goto done;
+
+  h.data_end = w.pos;
+  h.dir_offset = (h.data_end + 7) & ~(uint64_t)7;
+  size_t dir_len = w.dir_n * sizeof(uint64_t);
+  if(linescan_write_all(w.fd, w.dir, dir_len, h.dir_offset) != 0) goto done;
+  if(ftruncate(w.fd, (off_t)(h.dir_offset + dir_len)) != 0) goto done;
+  if(linescan_fileindex_check(fd, h.size, &h.check) != 0) goto done;
+  if(linescan_write_all(w.fd, &h, sizeof(h), 0) != 0) goto done;
+  rc = 0;
+
+ done:
+  free(w.buf);
+  free(w.dir);
+  if(w.fd >= 0) close(w.fd);
+  close(fd);
+  return rc;
+}
+
+linescan_fileindex* linescan_fileindex_open(const char* path, const char* index_path){
+  LINESCAN_CHECK(path != NULL, NULL)
+  LINESCAN_CHECK(index_path != NULL, NULL)
+  struct stat st;
+  uint64_t check;
+
+  linescan_fileindex* fi = calloc(1, sizeof(linescan_fileindex));
+  if(fi == NULL) return NULL;
+  int ifd = open(index_path, O_RDONLY);
+  int fd = open(path, O_RDONLY);
+  if(ifd < 0 || fd < 0 || fstat(ifd, &st) != 0) goto error;
+  fi->index_len = (size_t)st.st_size;
+  if(fi->index_len < sizeof(linescan_fileindex_header)) goto invalid;
+  fi->index_map = mmap(NULL, fi->index_len, PROT_READ, MAP_PRIVATE, ifd, 0);
+  if(fi->index_map == MAP_FAILED){
+    fi->index_map = NULL;
+    goto error;
+  }
+  memcpy(&fi->header, fi->index_map, sizeof(linescan_fileindex_header));
+  linescan_fileindex_header* h = &fi->header;
+  if(!linescan_fileindex_valid(h)) goto invalid;
+  if(h->dir_offset > fi->index_len
+     || linescan_fileindex_blocks(h) > (fi->index_len - h->dir_offset) / (2 * sizeof(uint64_t))) goto invalid;
+  fi->dir = (const uint64_t*)(fi->index_map + h->dir_offset);
+
+  if(fstat(fd, &st) != 0) goto error;
+  if((size_t)st.st_size < h->size
+     || linescan_fileindex_check(fd, h->size, &check) != 0 || check != h->check){
+    errno = ESTALE;
+    goto error;
+  }
+  fi->map_len = (size_t)st.st_size;
+  if(fi->map_len > 0){
+    fi->map = mmap(NULL, fi->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(fi->map == MAP_FAILED){
+      fi->map = NULL;
+      goto error;
+    }
+    // Lines are looked up at random
+    madvise(fi->map, fi->map_len, MADV_RANDOM);
+  }
+  fi->line = linescan_create(64);
+  close(ifd);
+  close(fd);
+  return fi;
+
+ invalid:
+  errno = EINVAL;
+ error:
+  if(ifd >= 0) close(ifd);
+  if(fd >= 0) close(fd);
+  linescan_fileindex_close(fi);
+  return NULL;
+}
+
+void linescan_fileindex_close(linescan_fileindex* fi){
+  if(fi->index_map != NULL) munmap(fi->index_map, fi->index_len);
+  if(fi->map != NULL) munmap(fi->map, fi->map_len);
+  if(fi->line != NULL) linescan_free(fi->line);
+  free(fi);
+}
+
+size_t linescan_fileindex_lines(const linescan_fileindex* fi){
+  return fi->header.lines_n;
+}
+
+/* Decodes the block of line k up to line k.
+   @param[end] Set to the end of the data of the block
+   @returns Position of the encoded line k in the index; offset is set to its file
+   offset. NULL with errno EINVAL if the block crosses the end of its data or the
+   lines cross the end of the indexed part of the file. */
+static const unsigned char* linescan_fileindex_seek(const linescan_fileindex* fi, size_t k,
+						    size_t* offset, const unsigned char** end){
+  const linescan_fileindex_header* h = &fi->header;
+  size_t block = k / h->block_lines;
+  uint64_t start = fi->dir[2 * block + 1];
+  uint64_t stop = block + 1 < linescan_fileindex_blocks(h) ? fi->dir[2 * block + 3] : h->data_end;
+  uint64_t pos = fi->dir[2 * block];
+  if(start > stop || stop > h->data_end || pos > h->size) goto invalid;
+  const unsigned char* p = (const unsigned char*)fi->index_map + start;
+  *end = (const unsigned char*)fi->index_map + stop;
+  for(size_t i = block * h->block_lines; i < k; i++){
+    uint64_t len;
+    if(linescan_varint_get(&p, *end, &len) != 0 || len > h->size - pos) goto invalid;
+    pos += len;
+    if(h->flags & LINESCAN_FILEINDEX_FIELDS){
+      uint64_t matches;
+      uint64_t distance;
+      if(linescan_varint_get(&p, *end, &matches) != 0) goto invalid;
+      // Every match takes at least one byte, so corrupt counts end at the block end
+      for(; matches > 0; matches--){
+	if(linescan_varint_get(&p, *end, &distance) != 0) goto invalid;
+      }
+    }
+  }
+  *offset = pos;
+  return p;
+
+ invalid:
+  errno = EINVAL;
+  return NULL;
+}
+
+size_t linescan_fileindex_offset(const linescan_fileindex* fi, size_t k){
+  LINESCAN_CHECK(fi != NULL, SIZE_MAX)
+  size_t offset;
+  const unsigned char* end;
+  if(k >= fi->header.lines_n) return SIZE_MAX;
+  if(linescan_fileindex_seek(fi, k, &offset, &end) == NULL) return SIZE_MAX;
+  return offset;
+}
+
+// Grows line->offsets to hold at least size offsets. @returns 0 on success, -1 on error.
+static int linescan_fileindex_offsets(linescan* line, size_t size){
+  if(size <= line->offsets_size) return 0;
+  size_t* offsets = realloc(line->offsets, size * sizeof(size_t));
+  if(offsets == NULL) return -1;
+  line->offsets = offsets;
+  line->offsets_size = size;
+  return 0;
+}
+
+int linescan_fileindex_line(linescan_fileindex* fi, size_t k, const linescan** line){
+  LINESCAN_CHECK(fi != NULL, -1)
+  LINESCAN_CHECK(line != NULL, -1)
+  size_t offset;
+  const unsigned char* end;
+  uint64_t len;
+  if(k >= fi->header.lines_n) return 0;
+  const unsigned char* p = linescan_fileindex_seek(fi, k, &offset, &end);
+  if(p == NULL) return -1;
+  if(linescan_varint_get(&p, end, &len) != 0 || len == 0 || len > fi->header.size - offset) goto invalid;
+  const char* buf = fi->map + offset;
+  linescan* r = fi->line;
+
+  if(fi->header.flags & LINESCAN_FILEINDEX_FIELDS){
+    uint64_t matches;
+    // Matches are distinct characters in front of the newline
+    if(linescan_varint_get(&p, end, &matches) != 0 || matches >= len) goto invalid;
+    if(linescan_fileindex_offsets(r, matches + 2) != 0) return -1;
+    size_t pos = 0;
+    r->offsets[0] = 0;
+    for(size_t i = 1; i <= matches; i++){
+      uint64_t distance;
+      if(linescan_varint_get(&p, end, &distance) != 0 || distance > len - 1 - pos) goto invalid;
+      pos += distance;
+      r->offsets[i] = pos;
+    }
+    r->offsets[matches + 1] = len - 1;
+    r->buf = buf;
+    r->size = len;
+    r->offsets_n = matches + 2;
+  } else {
+    // Every character can be a match
+    if(linescan_fileindex_offsets(r, len + 1) != 0) return -1;
+    if(linescan_find(buf, fi->header.cmask, len, r) != 1) return -1;
+  }
+  *line = r;
+  return 1;
+
+ invalid:
+  errno = EINVAL;
+  return -1;
+}
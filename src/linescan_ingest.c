@@ -0,0 +1,609 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define _GNU_SOURCE
+
+#include <linescan_ingest.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* io_uring is used through its system calls directly, so liburing is not needed */
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define LINESCAN_HAVE_URING 1
+#endif
+#endif
+#ifndef LINESCAN_HAVE_URING
+#define LINESCAN_HAVE_URING 0
+#endif
+
+// Alignment of buffers and read sizes required by O_DIRECT
+static const size_t LINESCAN_INGEST_ALIGN = 4096;
+// Maximum number of threads of the pread pool
+static const size_t LINESCAN_INGEST_THREADS = 8;
+
+enum linescan_buffer_state {
+  LINESCAN_BUFFER_FREE,
+  // Read submitted
+  LINESCAN_BUFFER_READING,
+  // Read completed, waiting to be handed out in file order
+  LINESCAN_BUFFER_DONE
+};
+
+typedef struct linescan_ingest_buffer {
+  char* buf;
+  enum linescan_buffer_state state;
+  size_t file;
+  size_t offset;
+  // Number of characters expected
+  size_t len;
+  // Number of characters read (so far, while reading); -errno on error
+  ssize_t res;
+} linescan_ingest_buffer;
+
+typedef struct linescan_ingest_file {
+  int fd;
+  size_t size;
+  // File offset of the next read to submit
+  size_t submitted;
+  // File offset of the next buffer to hand out
+  size_t delivered;
+  // Characters behind the last newline handed out so far
+  char* carry;
+  size_t carry_n;
+  size_t carry_size;
+} linescan_ingest_file;
+
+#if LINESCAN_HAVE_URING
+typedef struct linescan_uring {
+  int fd;
+  void* sq_ring;
+  size_t sq_ring_len;
+  void* cq_ring;
+  size_t cq_ring_len;
+  struct io_uring_sqe* sqes;
+  size_t sqes_len;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+  // Entries added since the last io_uring_enter
+  unsigned pending;
+  // Buffers are registered with the ring (IORING_OP_READ_FIXED)
+  int fixed;
+} linescan_uring;
+#endif
+
+struct linescan_ingest {
+  uint64_t cmask;
+  int flags;
+  size_t buffer_size;
+
+  linescan_ingest_buffer* buffers;
+  size_t buffers_n;
+  // Number of reads submitted and not collected yet
+  size_t in_flight;
+  // Buffer handed out last; buffers_n if there is none
+  size_t current;
+  // errno of a failed read; once set, every call of linescan_ingest_next fails
+  int error;
+
+  linescan_ingest_file* files;
+  size_t files_n;
+  size_t files_size;
+  // File to submit the next read for (round robin)
+  size_t next_file;
+  // File number + 1 of a last line without newline to hand out next; 0 if there is none
+  size_t tail_file;
+
+  // Chunk handed out last and its search results
+  linescan_ingest_chunk chunk;
+  linescan_index* index;
+  linescan* head;
+  // Holds the line described by head
+  char* head_buf;
+  size_t head_size;
+
+  int uring;
+#if LINESCAN_HAVE_URING
+  linescan_uring ring;
+#endif
+
+  // pread pool
+  pthread_t* threads;
+  size_t threads_n;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  // Buffers to read, ring of buffers_n entries
+  size_t* queue;
+  size_t queue_head;
+  size_t queue_n;
+  // Buffers read
+  size_t* completed;
+  size_t completed_n;
+  int stop;
+};
+
+#if LINESCAN_HAVE_URING
+
+static void linescan_uring_exit(linescan_uring* ring){
+  if(ring->sqes != NULL) munmap(ring->sqes, ring->sqes_len);
+  if(ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_len);
+  if(ring->sq_ring != NULL) munmap(ring->sq_ring, ring->sq_ring_len);
+  close(ring->fd);
+}
+
+/* Sets up a ring with room for all buffers and registers them.
+   @returns 0 on success, -1 if io_uring is not available. */
+static int linescan_uring_init(linescan_ingest* in){
+  linescan_uring* ring = &in->ring;
+  struct io_uring_params p;
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+
+  ring->fd = (int)syscall(__NR_io_uring_setup, (unsigned)in->buffers_n, &p);
+  if(ring->fd < 0) return -1;
+  ring->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if(p.features & IORING_FEAT_SINGLE_MMAP){
+    if(ring->cq_ring_len > ring->sq_ring_len) ring->sq_ring_len = ring->cq_ring_len;
+    ring->cq_ring_len = ring->sq_ring_len;
+  }
+  void* sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       ring->fd, IORING_OFF_SQ_RING);
+  if(sq_ring == MAP_FAILED) goto error;
+  ring->sq_ring = sq_ring;
+  if(p.features & IORING_FEAT_SINGLE_MMAP){
+    ring->cq_ring = sq_ring;
+  } else {
+    void* cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 ring->fd, IORING_OFF_CQ_RING);
+    if(cq_ring == MAP_FAILED) goto error;
+    ring->cq_ring = cq_ring;
+  }
+  ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ring->fd, IORING_OFF_SQES);
+  if(sqes == MAP_FAILED) goto error;
+  ring->sqes = sqes;
+
+  char* sq = ring->sq_ring;
+  char* cq = ring->cq_ring;
+  ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+  ring->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+  ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+  ring->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+  // Registered buffers save mapping them on every read; not fatal if over RLIMIT_MEMLOCK
+  struct iovec* iov = malloc(in->buffers_n * sizeof(struct iovec));
+  if(iov != NULL){
+    for(size_t i = 0; i < in->buffers_n; i++){
+      iov[i].iov_base = in->buffers[i].buf;
+      iov[i].iov_len = in->buffer_size;
+    }
+    ring->fixed = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+			  iov, (unsigned)in->buffers_n) == 0;
+    free(iov);
+  }
+  return 0;
+
+ error:
+  linescan_uring_exit(ring);
+  return -1;
+}
+
+// Queues a read; it is submitted with the next io_uring_enter.
+static void linescan_uring_submit(linescan_ingest* in, size_t i){
+  linescan_uring* ring = &in->ring;
+  linescan_ingest_buffer* b = &in->buffers[i];
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[index];
+
+  // Characters read before a short read
+  size_t done = (size_t)b->res;
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = in->files[b->file].fd;
+  sqe->off = b->offset + done;
+  sqe->addr = (uint64_t)(uintptr_t)(b->buf + done);
+  sqe->len = (uint32_t)(in->buffer_size - done);
+  sqe->user_data = i;
+  if(ring->fixed) sqe->buf_index = (uint16_t)i;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->pending++;
+}
+
+/* Submits queued reads and waits for at least one completion.
+   @returns 0 on success, -1 on error. */
+static int linescan_uring_wait(linescan_ingest* in){
+  linescan_uring* ring = &in->ring;
+  unsigned head = *ring->cq_head;
+  int empty = head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  if(ring->pending > 0 || empty){
+    long rc = syscall(__NR_io_uring_enter, ring->fd, ring->pending, empty ? 1 : 0,
+		      IORING_ENTER_GETEVENTS, NULL, 0);
+    if(rc < 0 && errno != EINTR) return -1;
+    if(rc > 0) ring->pending -= (unsigned)rc;
+  }
+
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  for(; head != tail; head++){
+    struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+    linescan_ingest_buffer* b = &in->buffers[cqe->user_data];
+    if(cqe->res > 0 && (size_t)(b->res + cqe->res) < b->len){
+      // Short read: read the rest, like the pread workers
+      b->res += cqe->res;
+      linescan_uring_submit(in, (size_t)cqe->user_data);
+      continue;
+    }
+    b->res = cqe->res < 0 ? cqe->res : b->res + cqe->res;
+    b->state = LINESCAN_BUFFER_DONE;
+    in->in_flight--;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return 0;
+}
+
+#endif
+
+static void* linescan_ingest_worker(void* arg){
+  linescan_ingest* in = arg;
+
+  pthread_mutex_lock(&in->lock);
+  while(!in->stop){
+    if(in->queue_n == 0){
+      pthread_cond_wait(&in->work, &in->lock);
+      continue;
+    }
+    size_t i = in->queue[in->queue_head];
+    in->queue_head = (in->queue_head + 1) % in->buffers_n;
+    in->queue_n--;
+    linescan_ingest_buffer* b = &in->buffers[i];
+    int fd = in->files[b->file].fd;
+    pthread_mutex_unlock(&in->lock);
+
+    size_t total = 0;
+    ssize_t r = 0;
+    while(total < b->len){
+      r = pread(fd, b->buf + total, in->buffer_size - total, (off_t)(b->offset + total));
+      if(r < 0 && errno == EINTR) continue;
+      if(r <= 0) break;
+      total += (size_t)r;
+    }
+
+    pthread_mutex_lock(&in->lock);
+    b->res = r < 0 ? -errno : (ssize_t)total;
+    in->completed[in->completed_n++] = i;
+    pthread_cond_signal(&in->done);
+  }
+  pthread_mutex_unlock(&in->lock);
+  return NULL;
+}
+
+static void linescan_pread_submit(linescan_ingest* in, size_t i){
+  pthread_mutex_lock(&in->lock);
+  in->queue[(in->queue_head + in->queue_n) % in->buffers_n] = i;
+  in->queue_n++;
+  pthread_cond_signal(&in->work);
+  pthread_mutex_unlock(&in->lock);
+}
+
+static void linescan_pread_wait(linescan_ingest* in){
+  pthread_mutex_lock(&in->lock);
+  while(in->completed_n == 0) pthread_cond_wait(&in->done, &in->lock);
+  for(size_t k = 0; k < in->completed_n; k++){
+    in->buffers[in->completed[k]].state = LINESCAN_BUFFER_DONE;
+    in->in_flight--;
+  }
+  in->completed_n = 0;
+  pthread_mutex_unlock(&in->lock);
+}
+
+static int linescan_pread_init(linescan_ingest* in){
+  in->queue = malloc(in->buffers_n * sizeof(size_t));
+  in->completed = malloc(in->buffers_n * sizeof(size_t));
+  size_t threads_n = in->buffers_n < LINESCAN_INGEST_THREADS ? in->buffers_n : LINESCAN_INGEST_THREADS;
+  in->threads = malloc(threads_n * sizeof(pthread_t));
+  if(in->queue == NULL || in->completed == NULL || in->threads == NULL) return -1;
+  for(; in->threads_n < threads_n; in->threads_n++){
+    if(pthread_create(&in->threads[in->threads_n], NULL, linescan_ingest_worker, in) != 0) return -1;
+  }
+  return 0;
+}
+
+linescan_ingest* linescan_ingest_create(size_t buffers, size_t buffer_size, uint64_t cmask, int flags){
+  LINESCAN_CHECK(buffers > 0, NULL)
+  linescan_ingest* in = calloc(1, sizeof(linescan_ingest));
+  if(in == NULL) return NULL;
+  in->cmask = cmask;
+  in->flags = flags;
+  in->buffer_size = (buffer_size + LINESCAN_INGEST_ALIGN - 1) / LINESCAN_INGEST_ALIGN * LINESCAN_INGEST_ALIGN;
+  if(in->buffer_size == 0) in->buffer_size = LINESCAN_INGEST_ALIGN;
+  in->buffers_n = buffers;
+  in->current = buffers;
+  pthread_mutex_init(&in->lock, NULL);
+  pthread_cond_init(&in->work, NULL);
+  pthread_cond_init(&in->done, NULL);
+
+  in->buffers = calloc(buffers, sizeof(linescan_ingest_buffer));
+  in->index = linescan_index_create(1024, 64);
+  in->head = linescan_create(64);
+  if(in->buffers == NULL) goto error;
+  for(size_t i = 0; i < buffers; i++){
+    void* buf;
+    if(posix_memalign(&buf, LINESCAN_INGEST_ALIGN, in->buffer_size) != 0) goto error;
+    in->buffers[i].buf = buf;
+    in->buffers[i].state = LINESCAN_BUFFER_FREE;
+  }
+
+#if LINESCAN_HAVE_URING
+  if(!(flags & LINESCAN_INGEST_PREAD)) in->uring = linescan_uring_init(in) == 0;
+#endif
+  if(!in->uring && linescan_pread_init(in) != 0) goto error;
+  return in;
+
+ error:
+  linescan_ingest_free(in);
+  return NULL;
+}
+
+void linescan_ingest_free(linescan_ingest* in){
+  if(in->threads_n > 0){
+    pthread_mutex_lock(&in->lock);
+    in->stop = 1;
+    pthread_cond_broadcast(&in->work);
+    pthread_mutex_unlock(&in->lock);
+    for(size_t t = 0; t < in->threads_n; t++) pthread_join(in->threads[t], NULL);
+  }
+#if LINESCAN_HAVE_URING
+  /* Closing the ring does not wait for reads in flight, which would write
+     into the buffers freed below */
+  if(in->uring){
+    while(in->in_flight > 0 && linescan_uring_wait(in) == 0);
+    linescan_uring_exit(&in->ring);
+  }
+#endif
+  pthread_mutex_destroy(&in->lock);
+  pthread_cond_destroy(&in->work);
+  pthread_cond_destroy(&in->done);
+  free(in->threads);
+  free(in->queue);
+  free(in->completed);
+
+  for(size_t i = 0; in->buffers != NULL && i < in->buffers_n; i++) free(in->buffers[i].buf);
+  free(in->buffers);
+  for(size_t f = 0; f < in->files_n; f++){
+    close(in->files[f].fd);
+    free(in->files[f].carry);
+  }
+  free(in->files);
+  linescan_index_free(in->index);
+  linescan_free(in->head);
+  free(in->head_buf);
+  free(in);
+}
+
+int linescan_ingest_uring(const linescan_ingest* in){
+  return in->uring;
+}
+
+int linescan_ingest_add(linescan_ingest* in, const char* path){
+  LINESCAN_CHECK(in != NULL, -1)
+  LINESCAN_CHECK(path != NULL, -1)
+  int fd = -1;
+  if(in->flags & LINESCAN_INGEST_DIRECT){
+    fd = open(path, O_RDONLY | O_DIRECT);
+    // File systems without O_DIRECT support (e.g. tmpfs) reject it with EINVAL
+    if(fd < 0 && errno != EINVAL) return -1;
+  }
+  if(fd < 0) fd = open(path, O_RDONLY);
+  if(fd < 0) return -1;
+  struct stat st;
+  if(fstat(fd, &st) != 0){
+    close(fd);
+    return -1;
+  }
+
+  if(in->files_n == in->files_size){
+    size_t size = in->files_size * 2 + 4;
+    linescan_ingest_file* files = realloc(in->files, size * sizeof(linescan_ingest_file));
+    if(files == NULL){
+      close(fd);
+      return -1;
+    }
+    in->files = files;
+    in->files_size = size;
+  }
+  linescan_ingest_file* f = &in->files[in->files_n];
+  memset(f, 0, sizeof(*f));
+  f->fd = fd;
+  f->size = (size_t)st.st_size;
+  return (int)in->files_n++;
+}
+
+// Starts reads into all free buffers, going round robin over files with characters left.
+static void linescan_ingest_submit(linescan_ingest* in){
+  for(size_t i = 0; i < in->buffers_n; i++){
+    linescan_ingest_buffer* b = &in->buffers[i];
+    if(b->state != LINESCAN_BUFFER_FREE || i == in->current) continue;
+    size_t k = 0;
+    for(; k < in->files_n; k++){
+      linescan_ingest_file* f = &in->files[(in->next_file + k) % in->files_n];
+      if(f->submitted < f->size) break;
+    }
+    if(k == in->files_n) return;
+    b->file = (in->next_file + k) % in->files_n;
+    in->next_file = b->file + 1;
+    linescan_ingest_file* f = &in->files[b->file];
+    b->offset = f->submitted;
+    b->len = f->size - f->submitted < in->buffer_size ? f->size - f->submitted : in->buffer_size;
+    f->submitted += b->len;
+    b->state = LINESCAN_BUFFER_READING;
+    b->res = 0;
+    in->in_flight++;
+#if LINESCAN_HAVE_URING
+    if(in->uring){
+      linescan_uring_submit(in, i);
+      continue;
+    }
+#endif
+    linescan_pread_submit(in, i);
+  }
+}
+
+// Appends len characters to the carry buffer of f. @returns 0 on success, -1 on error.
+static int linescan_ingest_carry(linescan_ingest_file* f, const char* buf, size_t len){
+  if(f->carry_n + len > f->carry_size){
+    size_t size = f->carry_size * 2 > f->carry_n + len ? f->carry_size * 2 : f->carry_n + len;
+    char* carry = realloc(f->carry, size);
+    if(carry == NULL) return -1;
+    f->carry = carry;
+    f->carry_size = size;
+  }
+  memcpy(f->carry + f->carry_n, buf, len);
+  f->carry_n += len;
+  return 0;
+}
+
+/* Moves the carried characters of f to head_buf and searches them.
+   @returns 0 on success, -1 on error. */
+static int linescan_ingest_head(linescan_ingest* in, linescan_ingest_file* f){
+  char* buf = in->head_buf;
+  size_t size = in->head_size;
+  in->head_buf = f->carry;
+  in->head_size = f->carry_size;
+  f->carry = buf;
+  f->carry_size = size;
+  size_t n = f->carry_n;
+  f->carry_n = 0;
+
+  linescan* head = in->head;
+  if(n + 1 > head->offsets_size){
+    size_t* offsets = realloc(head->offsets, (n + 1) * sizeof(size_t));
+    if(offsets == NULL) return -1;
+    head->offsets = offsets;
+    head->offsets_size = n + 1;
+  }
+  linescan_find(in->head_buf, in->cmask, n, head);
+  in->chunk.head = head;
+  return 0;
+}
+
+/* Searches a completed buffer: the end of a carried line, complete lines and
+   the characters behind the last newline. @returns 0 on success, -1 on error. */
+static int linescan_ingest_scan(linescan_ingest* in, linescan_ingest_buffer* b){
+  linescan_ingest_file* f = &in->files[b->file];
+  const char* buf = b->buf;
+  size_t len = b->len;
+  size_t start = 0;
+
+  in->chunk.file = b->file;
+  in->chunk.offset = b->offset;
+  in->chunk.buf = buf;
+  in->chunk.len = len;
+  in->chunk.head = NULL;
+  in->chunk.index = in->index;
+
+  if(f->carry_n > 0){
+    const char* nl = memchr(buf, '\n', len);
+    start = nl != NULL ? (size_t)(nl - buf) + 1 : len;
+    if(linescan_ingest_carry(f, buf, start) != 0) return -1;
+    if(nl != NULL && linescan_ingest_head(in, f) != 0) return -1;
+  }
+  if(linescan_find_all(buf + start, in->cmask, len - start, in->index) < 0) return -1;
+  size_t rest = start + in->index->size;
+  if(linescan_ingest_carry(f, buf + rest, len - rest) != 0) return -1;
+
+  f->delivered += len;
+  if(f->delivered == f->size && f->carry_n > 0) in->tail_file = b->file + 1;
+  return 0;
+}
+
+int linescan_ingest_next(linescan_ingest* in, const linescan_ingest_chunk** chunk){
+  LINESCAN_CHECK(in != NULL, -1)
+  LINESCAN_CHECK(chunk != NULL, -1)
+
+  // Later buffers of a file with a failed read can never be handed out
+  if(in->error != 0){
+    errno = in->error;
+    return -1;
+  }
+
+  // Recycle the buffer handed out before
+  if(in->current < in->buffers_n){
+    in->buffers[in->current].state = LINESCAN_BUFFER_FREE;
+    in->current = in->buffers_n;
+  }
+
+  if(in->tail_file > 0){
+    // Last line of a file without newline
+    linescan_ingest_file* f = &in->files[in->tail_file - 1];
+    in->chunk.file = in->tail_file - 1;
+    in->chunk.offset = f->size;
+    in->chunk.buf = f->carry;
+    in->chunk.len = 0;
+    in->tail_file = 0;
+    linescan_index_reset(in->index);
+    if(linescan_ingest_head(in, f) != 0) return -1;
+    *chunk = &in->chunk;
+    return 1;
+  }
+
+  for(;;){
+    linescan_ingest_submit(in);
+    for(size_t i = 0; i < in->buffers_n; i++){
+      linescan_ingest_buffer* b = &in->buffers[i];
+      if(b->state != LINESCAN_BUFFER_DONE || b->offset != in->files[b->file].delivered) continue;
+      if(b->res != (ssize_t)b->len){
+	in->error = b->res < 0 ? (int)-b->res : EIO;
+	b->state = LINESCAN_BUFFER_FREE;
+	errno = in->error;
+	return -1;
+      }
+      if(linescan_ingest_scan(in, b) != 0) return -1;
+      in->current = i;
+      *chunk = &in->chunk;
+      return 1;
+    }
+    if(in->in_flight == 0) return 0;
+#if LINESCAN_HAVE_URING
+    if(in->uring){
+      if(linescan_uring_wait(in) != 0) return -1;
+      continue;
+    }
+#endif
+    linescan_pread_wait(in);
+  }
+}
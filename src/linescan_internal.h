@@ -0,0 +1,348 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Declarations shared between the translation units of the library.
+   Not part of the public interface. */
+
+#ifndef LINESCAN_INTERNAL_H
+#define LINESCAN_INTERNAL_H
+
+#include <string.h>
+#include <linescan.h>
+#include <linescan_stats.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define LINESCAN_HAVE_X86 1
+#else
+#define LINESCAN_HAVE_X86 0
+#endif
+
+static const unsigned char NL = '\n';
+
+/* Smallest page size of the supported platforms. Vector kernels may load
+   characters behind the end of a buffer as long as the load does not cross
+   a boundary of this size, so it cannot fault. */
+#define LINESCAN_PAGE_SIZE 4096
+
+/* Statistics (linescan_stats.c). LINESCAN_STAT(expression) is only compiled in
+   with LINESCAN_STATS; LINESCAN_COUNT(field, value) adds to a counter of the
+   calling thread. */
+#ifdef LINESCAN_STATS
+typedef struct linescan_stats_counters {
+  linescan_stats stats;
+  int registered;
+  struct linescan_stats_counters* next;
+} linescan_stats_counters;
+
+extern _Thread_local linescan_stats_counters linescan_stats_tls;
+void linescan_stats_register(void);
+// @returns Time stamp counter if cycle counting is enabled, 0 otherwise.
+uint64_t linescan_stats_clock(void);
+
+/* Only the owning thread writes its counters; relaxed accesses let other
+   threads read them while they are updated, at the cost of a plain add. */
+static inline void linescan_stats_inc(uint64_t* counter, uint64_t value){
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+// Called before every counted search; @returns start time for linescan_stats_end.
+static inline uint64_t linescan_stats_begin(void){
+  if(!linescan_stats_tls.registered) linescan_stats_register();
+  linescan_stats_inc(&linescan_stats_tls.stats.calls, 1);
+  return linescan_stats_clock();
+}
+
+static inline void linescan_stats_end(uint64_t start){
+  if(start != 0) linescan_stats_inc(&linescan_stats_tls.stats.cycles, linescan_stats_clock() - start);
+}
+
+static inline void linescan_stats_line(size_t length){
+  size_t k = length == 0 ? 0 : 64 - __builtin_clzll(length);
+  if(k >= LINESCAN_STATS_BUCKETS) k = LINESCAN_STATS_BUCKETS - 1;
+  linescan_stats_inc(&linescan_stats_tls.stats.lines, 1);
+  linescan_stats_inc(&linescan_stats_tls.stats.line_lengths[k], 1);
+}
+
+#define LINESCAN_STAT(expression) expression
+#define LINESCAN_COUNT(field, value) linescan_stats_inc(&linescan_stats_tls.stats.field, (value));
+#else
+#define LINESCAN_STAT(expression)
+#define LINESCAN_COUNT(field, value)
+#endif
+
+// private helper method for setting some values
+static inline void linescan_update(linescan* r,
+				   const char* buf,
+				   size_t size,
+				   size_t offsets_n){
+  r->buf = buf;
+  r->offsets_n = offsets_n;
+  r->size = size;
+}
+
+/* Validates UTF-8 (RFC 3629: no overlong forms, surrogates or code points
+   above U+10FFFF) in b[i, end), eight ASCII characters at a time.
+   @returns Offset of the first character of the first invalid or truncated
+   sequence; end if all sequences are valid. */
+static inline size_t linescan_utf8_check(const unsigned char* b, size_t i, size_t end){
+  while(i < end){
+    if(end - i >= 8){
+      uint64_t w;
+      memcpy(&w, b + i, 8);
+      if((w & 0x8080808080808080ull) == 0){
+	i += 8;
+	continue;
+      }
+    }
+    unsigned char c = b[i];
+    if(c < 0x80){
+      i++;
+      continue;
+    }
+    size_t len;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xbf;
+    if(c >= 0xc2 && c <= 0xdf){
+      len = 2;
+    } else if(c >= 0xe0 && c <= 0xef){
+      len = 3;
+      if(c == 0xe0) lo = 0xa0;
+      else if(c == 0xed) hi = 0x9f;
+    } else if(c >= 0xf0 && c <= 0xf4){
+      len = 4;
+      if(c == 0xf0) lo = 0x90;
+      else if(c == 0xf4) hi = 0x8f;
+    } else {
+      return i;
+    }
+    if(end - i < len || b[i + 1] < lo || b[i + 1] > hi) return i;
+    for(size_t j = 2; j < len; j++)
+      if((b[i + j] & 0xc0) != 0x80) return i;
+    i += len;
+  }
+  return end;
+}
+
+/* First invalid UTF-8 offset of the line b[0, end), given that a vector
+   validator has checked all sequences ending in b[0, checked) and flagged
+   errors (possibly behind end) if err != 0. The validator reports a sequence
+   cut at the end of a vector only with the next vector, so the last sequence
+   in front of min(checked, end) is checked again, together with the rest of
+   the line. */
+static inline size_t linescan_utf8_finish(const unsigned char* b, size_t end, size_t checked, int err){
+  if(err) return linescan_utf8_check(b, 0, end);
+  size_t stop = checked < end ? checked : end;
+  // Restart at the first character of a sequence which may be cut at stop
+  size_t i = stop;
+  for(size_t j = 1; j <= 3 && j <= stop; j++){
+    unsigned char c = b[stop - j];
+    if(c < 0x80) break;
+    if(c >= 0xc0){
+      i = stop - j;
+      break;
+    }
+  }
+  return linescan_utf8_check(b, i, end);
+}
+
+typedef int (*linescan_find_fn)(const char* buf, uint64_t cmask, size_t n, linescan* result);
+typedef int (*linescan_find_term_fn)(const char* buf, uint64_t cmask, uint64_t tmask, size_t n,
+				     linescan* result);
+typedef int (*linescan_find_all_fn)(const char* buf, uint64_t cmask, size_t n, linescan_index* index);
+typedef int (*linescan_find_bitmap_fn)(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm);
+typedef int (*linescan_count_all_fn)(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts);
+typedef int (*linescan_find_class_fn)(const char* buf, const linescan_class* cl, size_t n, linescan_hits* hits);
+/* Computes bitmaps of cmask matches and newlines (excluding cmask matches) for
+   n <= 64 characters. Building block for search modes without their own kernels. */
+typedef void (*linescan_block_fn)(const char* buf, uint64_t cmask, size_t n,
+				  uint64_t* m_c, uint64_t* m_nl);
+
+/* Like linescan_block_fn, additionally computing the bitmap of quote
+   characters (described by qmask) in m_q. */
+typedef void (*linescan_block_quoted_fn)(const char* buf, uint64_t cmask, uint64_t qmask, size_t n,
+					 uint64_t* m_c, uint64_t* m_nl, uint64_t* m_q);
+
+/* Bit i of the result is the XOR of bits 0..i of x, i.e. set for every
+   character between an odd and the following even quote (including the
+   opening quote). Equivalent to a carry-less multiplication of x by ~0. */
+static inline uint64_t linescan_prefix_xor(uint64_t x){
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/* Grows index arrays to hold at least offsets_min offsets and lines_min lines.
+   @returns 0 on success, -1 if memory could not be allocated. */
+int linescan_index_grow(linescan_index* index, size_t offsets_min, size_t lines_min);
+
+/* Makes room for another k offsets and k lines behind offsets_n and lines_n.
+   Pointers in index may change. */
+static inline int linescan_index_reserve(linescan_index* index,
+					 size_t offsets_n,
+					 size_t lines_n,
+					 size_t k){
+  if(offsets_n + k <= index->offsets_size && lines_n + k + 1 <= index->lines_size) return 0;
+  return linescan_index_grow(index, offsets_n + k, lines_n + k + 1);
+}
+
+/* Stores the results of a find_all kernel. Kernels keep the position of the
+   first offset of the current line in lines[lines_n]; offsets of the
+   unterminated last line are dropped. */
+static inline int linescan_index_update(linescan_index* index,
+					const char* buf,
+					size_t n,
+					size_t lines_n){
+  size_t offsets_n = index->lines[lines_n];
+  index->buf = buf;
+  index->offsets_n = offsets_n;
+  index->lines_n = lines_n;
+  index->size = offsets_n > 0 ? index->offsets[offsets_n - 1] + 1 : 0;
+  return index->size == n;
+}
+
+/* Grows bitmaps to hold at least size characters.
+   @returns 0 on success, -1 if memory could not be allocated. */
+int linescan_bitmap_grow(linescan_bitmap* bm, size_t size);
+
+static inline int linescan_bitmap_reserve(linescan_bitmap* bm, size_t size){
+  if((size + 63) / 64 <= bm->words_size) return 0;
+  return linescan_bitmap_grow(bm, size);
+}
+
+/* Grows hit arrays to hold at least hits_min hits.
+   @returns 0 on success, -1 if memory could not be allocated. */
+int linescan_hits_grow(linescan_hits* hits, size_t hits_min);
+
+// Makes room for another k hits behind hits_n. Pointers in hits may change.
+static inline int linescan_hits_reserve(linescan_hits* hits, size_t hits_n, size_t k){
+  if(hits_n + k <= hits->hits_size) return 0;
+  return linescan_hits_grow(hits, hits_n + k);
+}
+
+/* Grows batch arrays to hold at least offsets_min offsets and buffers_min buffers.
+   @returns 0 on success, -1 if memory could not be allocated. */
+int linescan_batch_grow(linescan_batch* batch, size_t offsets_min, size_t buffers_min);
+
+// Stores the results of a find_class kernel
+static inline int linescan_hits_update(linescan_hits* hits, const char* buf, size_t n, size_t hits_n){
+  hits->buf = buf;
+  hits->size = n;
+  hits->hits_n = hits_n;
+  return 0;
+}
+
+// Stores the results of a find_bitmap kernel
+static inline int linescan_bitmap_update(linescan_bitmap* bm, const char* buf, size_t n){
+  bm->buf = buf;
+  bm->size = n;
+  if(n == 0) return 0;
+  return (int)((bm->newlines[(n - 1) / 64] >> ((n - 1) % 64)) & 1);
+}
+
+/* Adds the cmask matches (m_c) and newlines (m_nl) of one block to the running
+   counts of a count_all kernel. fields holds the matches of the current line. */
+static inline __attribute__((always_inline))
+void linescan_counts_block(uint64_t m_c, uint64_t m_nl, size_t* lines_n, size_t* delims_n,
+			   size_t* fields, size_t* fields_max){
+  *delims_n += __builtin_popcountll(m_c);
+  for(; m_nl != 0; m_nl &= m_nl - 1){
+    uint64_t below = (m_nl & -m_nl) - 1;
+    size_t f = *fields + __builtin_popcountll(m_c & below);
+    if(f > *fields_max) *fields_max = f;
+    m_c &= ~below;
+    *fields = 0;
+    (*lines_n)++;
+  }
+  *fields += __builtin_popcountll(m_c);
+}
+
+/* Stores the results of a count_all kernel. */
+static inline int linescan_counts_update(linescan_counts* counts, const char* buf, size_t n,
+					 size_t lines_n, size_t delims_n, size_t fields,
+					 size_t fields_max, int ends_nl){
+  // Characters after the last newline form another line
+  if(fields > fields_max) fields_max = fields;
+  counts->buf = buf;
+  counts->size = n;
+  counts->lines_n = lines_n;
+  counts->delims_n = delims_n;
+  counts->fields_max = n > 0 ? fields_max + 1 : 0;
+  return ends_nl;
+}
+
+/* Runs job(arg, worker) once on every worker of pool, including the calling
+   thread as worker 0, and waits for all of them to return (linescan_parallel.c). */
+typedef struct linescan_pool linescan_pool;
+typedef void (*linescan_job_fn)(void* arg, size_t worker);
+void linescan_pool_run(linescan_pool* pool, linescan_job_fn job, void* arg);
+
+/* Selected kernels (linescan.c) */
+extern linescan_block_fn linescan_block_impl;
+extern linescan_block_quoted_fn linescan_block_quoted_impl;
+
+/* Portable kernels (linescan.c) */
+int linescan_find_swar(const char* buf, uint64_t cmask, size_t n, linescan* result);
+int linescan_rfind_swar(const char* buf, uint64_t cmask, size_t n, linescan* result);
+int linescan_find_term_swar(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+int linescan_rfind_term_swar(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+int linescan_find_all_swar(const char* buf, uint64_t cmask, size_t n, linescan_index* index);
+int linescan_find_bitmap_swar(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm);
+int linescan_count_all_swar(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts);
+void linescan_block_swar(const char* buf, uint64_t cmask, size_t n, uint64_t* m_c, uint64_t* m_nl);
+void linescan_block_quoted_swar(const char* buf, uint64_t cmask, uint64_t qmask, size_t n, uint64_t* m_c, uint64_t* m_nl, uint64_t* m_q);
+int linescan_find_class_swar(const char* buf, const linescan_class* cl, size_t n, linescan_hits* hits);
+
+#if LINESCAN_HAVE_X86
+/* Vector kernels (linescan_simd.c). Callers must make sure the running CPU
+   supports the corresponding instruction set. */
+int linescan_find_sse2(const char* buf, uint64_t cmask, size_t n, linescan* result);
+int linescan_rfind_sse2(const char* buf, uint64_t cmask, size_t n, linescan* result);
+int linescan_find_term_sse2(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+int linescan_rfind_term_sse2(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+int linescan_find_all_sse2(const char* buf, uint64_t cmask, size_t n, linescan_index* index);
+int linescan_find_bitmap_sse2(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm);
+int linescan_count_all_sse2(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts);
+void linescan_block_sse2(const char* buf, uint64_t cmask, size_t n, uint64_t* m_c, uint64_t* m_nl);
+void linescan_block_quoted_sse2(const char* buf, uint64_t cmask, uint64_t qmask, size_t n, uint64_t* m_c, uint64_t* m_nl, uint64_t* m_q);
+int linescan_find_avx2(const char* buf, uint64_t cmask, size_t n, linescan* result);
+int linescan_rfind_avx2(const char* buf, uint64_t cmask, size_t n, linescan* result);
+int linescan_find_term_avx2(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+int linescan_rfind_term_avx2(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+int linescan_find_all_avx2(const char* buf, uint64_t cmask, size_t n, linescan_index* index);
+int linescan_find_bitmap_avx2(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm);
+int linescan_count_all_avx2(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts);
+void linescan_block_avx2(const char* buf, uint64_t cmask, size_t n, uint64_t* m_c, uint64_t* m_nl);
+void linescan_block_quoted_avx2(const char* buf, uint64_t cmask, uint64_t qmask, size_t n, uint64_t* m_c, uint64_t* m_nl, uint64_t* m_q);
+int linescan_find_class_avx2(const char* buf, const linescan_class* cl, size_t n, linescan_hits* hits);
+int linescan_find_avx512bw(const char* buf, uint64_t cmask, size_t n, linescan* result);
+int linescan_rfind_avx512bw(const char* buf, uint64_t cmask, size_t n, linescan* result);
+int linescan_find_term_avx512bw(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+int linescan_rfind_term_avx512bw(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result);
+int linescan_find_all_avx512bw(const char* buf, uint64_t cmask, size_t n, linescan_index* index);
+int linescan_find_bitmap_avx512bw(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm);
+int linescan_count_all_avx512bw(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts);
+void linescan_block_avx512bw(const char* buf, uint64_t cmask, size_t n, uint64_t* m_c, uint64_t* m_nl);
+void linescan_block_quoted_avx512bw(const char* buf, uint64_t cmask, uint64_t qmask, size_t n, uint64_t* m_c, uint64_t* m_nl, uint64_t* m_q);
+int linescan_find_class_avx512bw(const char* buf, const linescan_class* cl, size_t n, linescan_hits* hits);
+#endif
+
+#endif
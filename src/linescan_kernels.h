@@ -0,0 +1,594 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Vector kernel template. Included once per instruction set by linescan_simd.c,
+   which defines the following before every inclusion:
+
+   LINESCAN_ISA  Suffix for the generated function names (e.g. avx2)
+   LS_WIDTH      Number of bytes compared per vector (16, 32 or 64)
+   LS_VEC        Vector type
+   LS_SET1(c)    Vector containing byte c in every lane
+   LS_LOAD(p)    Unaligned load of LS_WIDTH bytes from p
+   LS_EQ(x,v)    Bitmap (bit i = lane i) of bytes in x equal to v, as uint64_t
+
+   Instruction sets with a byte shuffle additionally define the following for
+   linescan_find_class
+
+   LS_SHUFFLE(t,x)  Byte i of t's 16-byte lane, i = low nibble of byte x
+   LS_AND(x,y)      Bitwise and
+   LS_OR(x,y)       Bitwise or
+   LS_SRL4(x)       x shifted right by 4 bits (per 16-bit lane)
+   LS_TABLE(p)      16 bytes at p, repeated in every 16-byte lane
+
+   and for the UTF-8 validation of linescan_find:
+
+   LS_PREV(x,p,k)   x shifted up by k bytes, shifting in the last k bytes of p
+   LS_SUBS(x,y)     Unsigned saturating subtraction
+   LS_XOR(x,y)      Bitwise xor
+
+   Full vectors are loaded from within [buf, buf + n). The last partial vector
+   (or block) is loaded so that it ends at buf + n, overlapping characters
+   searched before, or, if the buffer is too short, starting at its first
+   character and reading past buf + n within the same page (see
+   linescan_partial). Only if both are impossible it is searched byte by byte.
+ */
+
+#define LS_CAT_(a,b) a##_##b
+#define LS_CAT(a,b) LS_CAT_(a,b)
+#define LS_FN(name) LS_CAT(name,LINESCAN_ISA)
+// Bits set by LS_EQ for a vector of equal bytes
+#define LS_LANES (LS_WIDTH == 64 ? ~(uint64_t)0 : (((uint64_t)1) << (LS_WIDTH % 64)) - 1)
+
+/* Bitmaps of the k characters at (b + i), with i + k <= n and k < width, where
+   width is LS_WIDTH or 64: the vector of width characters is loaded from
+   (b + i) if it lies within [b, b + n), otherwise the one ending at (b + i + k)
+   if it does, otherwise from (b + i) if it does not cross a page boundary.
+   Bits of other characters are cleared.
+   @returns 1 if the bitmaps were computed; 0 if the characters must be searched
+   byte by byte. */
+static inline __attribute__((always_inline))
+int LS_FN(linescan_partial)(const unsigned char* b, size_t i, size_t k, size_t n, size_t width,
+			    LS_VEC v_c, LS_VEC v_nl, uint64_t* m_c, uint64_t* m_nl){
+  const unsigned char* p = b + i;
+  size_t shift = 0;
+  if(i + width > n){
+    if(i + k >= width){
+      p = b + i + k - width;
+      shift = width - k;
+    } else if(((uintptr_t)p & (LINESCAN_PAGE_SIZE - 1)) > LINESCAN_PAGE_SIZE - width){
+      return 0;
+    }
+  }
+  uint64_t c = 0;
+  uint64_t nl = 0;
+  for(size_t j = 0; j < width; j += LS_WIDTH){
+    LS_VEC x = LS_LOAD(p + j);
+    c |= LS_EQ(x, v_c) << j;
+    nl |= LS_EQ(x, v_nl) << j;
+  }
+  uint64_t keep = (((uint64_t)1) << k) - 1;
+  *m_c = (c >> shift) & keep;
+  *m_nl = (nl >> shift) & keep;
+  return 1;
+}
+
+#ifdef LS_SHUFFLE
+
+/* UTF-8 validation by table lookups (after Keiser and Lemire, "Validating
+   UTF-8 In Less Than One Instruction Per Byte"): every byte is classified by
+   the high and low nibble of the byte before it and its own high nibble, and
+   the three lookups share a bit for every invalid pair of bytes. Lead bytes of
+   three and four byte sequences are checked two and three bytes ahead with
+   saturating subtractions. Uses linescan_utf8_tables and LS_PREV, LS_SUBS and
+   LS_XOR from linescan_simd.c.
+   @returns Vector with non-zero bytes where a sequence ending in x is invalid;
+   a sequence cut at the end of x is reported with the next vector. */
+static inline __attribute__((always_inline))
+LS_VEC LS_FN(linescan_utf8_vec)(LS_VEC x, LS_VEC prev){
+  const LS_VEC v_0f = LS_SET1(0x0f);
+  LS_VEC prev1 = LS_PREV(x, prev, 1);
+  LS_VEC byte_1_high = LS_SHUFFLE(LS_TABLE(linescan_utf8_tables[0]), LS_AND(LS_SRL4(prev1), v_0f));
+  LS_VEC byte_1_low = LS_SHUFFLE(LS_TABLE(linescan_utf8_tables[1]), LS_AND(prev1, v_0f));
+  LS_VEC byte_2_high = LS_SHUFFLE(LS_TABLE(linescan_utf8_tables[2]), LS_AND(LS_SRL4(x), v_0f));
+  LS_VEC special = LS_AND(LS_AND(byte_1_high, byte_1_low), byte_2_high);
+  // Only 111xxxxx two and 1111xxxx three bytes back stay >= 0x80
+  LS_VEC third = LS_SUBS(LS_PREV(x, prev, 2), LS_SET1(0xe0 - 0x80));
+  LS_VEC fourth = LS_SUBS(LS_PREV(x, prev, 3), LS_SET1(0xf0 - 0x80));
+  LS_VEC must_continue = LS_AND(LS_OR(third, fourth), LS_SET1(0x80));
+  return LS_XOR(must_continue, special);
+}
+
+#endif
+
+/* find and rfind are instantiated twice: with the terminator fixed to NL for
+   linescan_find/rfind, and with a terminator argument for the _term variants.
+   find is instantiated once more with UTF-8 validation (see linescan.utf8). */
+static inline __attribute__((always_inline))
+int LS_FN(linescan_find_t)(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result,
+			   int utf8){
+  const unsigned char* b = (const unsigned char*)buf;
+  unsigned char c_ref = (unsigned char)cmask;
+  unsigned char t_ref = (unsigned char)tmask;
+  size_t* offsets = result->offsets;
+  const LS_VEC v_c = LS_SET1(c_ref);
+  const LS_VEC v_nl = LS_SET1(t_ref);
+  size_t i = 0;
+  // Characters validated in full vectors, and whether any errors were flagged
+  size_t checked = 0;
+  int err_any = 0;
+#ifdef LS_SHUFFLE
+  const LS_VEC v_zero = LS_SET1(0);
+  LS_VEC prev = v_zero;
+  LS_VEC err = v_zero;
+#endif
+
+  offsets[0] = 0;
+  size_t offsets_n = 1;
+
+  /* Step 1 is not needed, vectors are loaded unaligned */
+
+  /* Step 2: Compare LS_WIDTH bytes at once and extract offsets from the match bitmaps.
+     Less than LS_WIDTH bytes left are compared at once as well (see linescan_partial).
+     Only full vectors are validated, the rest of the line is left to
+     linescan_utf8_finish. */
+  for(; i < n; i += LS_WIDTH){
+    uint64_t m_c;
+    uint64_t m_nl;
+    if(n - i >= LS_WIDTH){
+      LINESCAN_DBG(result->debug_steps_2++;)
+      LINESCAN_COUNT(bytes_body, LS_WIDTH)
+      LS_VEC x = LS_LOAD(b + i);
+      m_c = LS_EQ(x, v_c);
+      m_nl = LS_EQ(x, v_nl);
+#ifdef LS_SHUFFLE
+      if(utf8){
+	err = LS_OR(err, LS_FN(linescan_utf8_vec)(x, prev));
+	prev = x;
+	checked = i + LS_WIDTH;
+      }
+#endif
+    } else if(LS_FN(linescan_partial)(b, i, n - i, n, LS_WIDTH, v_c, v_nl, &m_c, &m_nl)){
+      LINESCAN_DBG(result->debug_steps_3++;)
+      LINESCAN_COUNT(bytes_tail, n - i)
+    } else {
+      break;
+    }
+    // A delimiter equal to the terminator is reported as delimiter, like in the portable kernel
+    m_nl &= ~m_c;
+
+    if(m_nl != 0){
+      // Keep delimiters in front of the first newline only
+      m_c &= (m_nl & -m_nl) - 1;
+    }
+    while(m_c != 0){
+      offsets[offsets_n] = i + __builtin_ctzll(m_c);
+      offsets_n++;
+      m_c &= m_c - 1;
+    }
+    if(m_nl != 0){
+      size_t offset = i + __builtin_ctzll(m_nl);
+      offsets[offsets_n] = offset;
+      offsets_n++;
+      linescan_update(result, buf, offset + 1, offsets_n);
+#ifdef LS_SHUFFLE
+      if(utf8) err_any = LS_EQ(err, v_zero) != LS_LANES;
+#endif
+      if(utf8) result->utf8_invalid = linescan_utf8_finish(b, offset + 1, checked, err_any);
+      return 1;
+    }
+  }
+
+  /* Step 3: Less than LS_WIDTH bytes left, close to the end of a page */
+  for(; i < n; i++){
+    LINESCAN_DBG(result->debug_steps_3++;)
+    LINESCAN_COUNT(bytes_tail, 1)
+    unsigned char c = b[i];
+    if(c == c_ref){
+      offsets[offsets_n] = i;
+      offsets_n++;
+    } else if(c == t_ref){
+      offsets[offsets_n] = i;
+      offsets_n++;
+      break;
+    }
+  }
+
+  int found = i < n;
+  size_t size = found ? i + 1 : n;
+  linescan_update(result, buf, size, offsets_n);
+#ifdef LS_SHUFFLE
+  if(utf8) err_any = LS_EQ(err, v_zero) != LS_LANES;
+#endif
+  if(utf8) result->utf8_invalid = linescan_utf8_finish(b, size, checked, err_any);
+  return found;
+}
+
+int LS_FN(linescan_find)(const char* buf, uint64_t cmask, size_t n, linescan* result){
+  if(result->utf8) return LS_FN(linescan_find_t)(buf, cmask, NL, n, result, 1);
+  return LS_FN(linescan_find_t)(buf, cmask, NL, n, result, 0);
+}
+
+int LS_FN(linescan_find_term)(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result){
+  if(result->utf8) return LS_FN(linescan_find_t)(buf, cmask, tmask, n, result, 1);
+  return LS_FN(linescan_find_t)(buf, cmask, tmask, n, result, 0);
+}
+
+static inline __attribute__((always_inline))
+int LS_FN(linescan_rfind_t)(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result){
+  const unsigned char* b = (const unsigned char*)buf;
+  unsigned char c_ref = (unsigned char)cmask;
+  unsigned char t_ref = (unsigned char)tmask;
+  size_t* offsets = result->offsets;
+  const LS_VEC v_c = LS_SET1(c_ref);
+  const LS_VEC v_nl = LS_SET1(t_ref);
+  size_t end = n;
+
+  offsets[0] = n-1;
+  size_t offsets_n = 1;
+
+  /* Step 2: Compare LS_WIDTH bytes at once, walking towards buf. Less than
+     LS_WIDTH bytes left are compared at once as well (see linescan_partial). */
+  while(end > 0){
+    size_t base = 0;
+    uint64_t m_c;
+    uint64_t m_nl;
+    if(end >= LS_WIDTH){
+      LINESCAN_DBG(result->debug_steps_2++;)
+      LINESCAN_COUNT(bytes_body, LS_WIDTH)
+      base = end - LS_WIDTH;
+      LS_VEC x = LS_LOAD(b + base);
+      m_c = LS_EQ(x, v_c);
+      m_nl = LS_EQ(x, v_nl);
+    } else if(LS_FN(linescan_partial)(b, 0, end, n, LS_WIDTH, v_c, v_nl, &m_c, &m_nl)){
+      LINESCAN_DBG(result->debug_steps_3++;)
+      LINESCAN_COUNT(bytes_tail, end)
+    } else {
+      break;
+    }
+    m_nl &= ~m_c;
+    int last_nl = 0;
+
+    if(m_nl != 0){
+      last_nl = 63 - __builtin_clzll(m_nl);
+      // Keep delimiters behind the last newline only
+      m_c &= ~((((uint64_t)2) << last_nl) - 1);
+    }
+    while(m_c != 0){
+      int k = 63 - __builtin_clzll(m_c);
+      offsets[offsets_n] = base + k;
+      offsets_n++;
+      m_c ^= ((uint64_t)1) << k;
+    }
+    if(m_nl != 0){
+      size_t offset = base + last_nl;
+      offsets[offsets_n] = offset;
+      offsets_n++;
+      linescan_update(result, buf, n - offset, offsets_n);
+      return 1;
+    }
+    end = base;
+  }
+
+  /* Step 3: Less than LS_WIDTH bytes left, close to the end of a page */
+  while(end-- > 0){
+    LINESCAN_DBG(result->debug_steps_3++;)
+    LINESCAN_COUNT(bytes_tail, 1)
+    unsigned char c = b[end];
+    if(c == c_ref){
+      offsets[offsets_n] = end;
+      offsets_n++;
+    } else if(c == t_ref){
+      offsets[offsets_n] = end;
+      offsets_n++;
+      linescan_update(result, buf, n - end, offsets_n);
+      return 1;
+    }
+  }
+
+  linescan_update(result, buf, n, offsets_n);
+  return 0;
+}
+
+int LS_FN(linescan_rfind)(const char* buf, uint64_t cmask, size_t n, linescan* result){
+  return LS_FN(linescan_rfind_t)(buf, cmask, NL, n, result);
+}
+
+int LS_FN(linescan_rfind_term)(const char* buf, uint64_t cmask, uint64_t tmask, size_t n, linescan* result){
+  return LS_FN(linescan_rfind_t)(buf, cmask, tmask, n, result);
+}
+
+int LS_FN(linescan_find_all)(const char* buf, uint64_t cmask, size_t n, linescan_index* index){
+  const unsigned char* b = (const unsigned char*)buf;
+  unsigned char c_ref = (unsigned char)cmask;
+  const LS_VEC v_c = LS_SET1(c_ref);
+  const LS_VEC v_nl = LS_SET1(NL);
+  size_t offsets_n = 1;
+  size_t lines_n = 0;
+  size_t i = 0;
+
+  if(linescan_index_reserve(index, 0, 0, 1) != 0) return -1;
+  index->offsets[0] = 0;
+  index->lines[0] = 0;
+
+  while(i < n){
+    // Every byte adds at most two offsets (newline and start of next line)
+    if(linescan_index_reserve(index, offsets_n, lines_n, 2 * LS_WIDTH) != 0) return -1;
+    size_t* offsets = index->offsets;
+    size_t* lines = index->lines;
+    uint64_t m_c;
+    uint64_t m_nl;
+
+    if(n - i >= LS_WIDTH){
+      LINESCAN_COUNT(bytes_body, LS_WIDTH)
+      LS_VEC x = LS_LOAD(b + i);
+      m_c = LS_EQ(x, v_c);
+      m_nl = LS_EQ(x, v_nl) & ~m_c;
+    } else {
+      LINESCAN_COUNT(bytes_tail, n - i)
+      if(LS_FN(linescan_partial)(b, i, n - i, n, LS_WIDTH, v_c, v_nl, &m_c, &m_nl)){
+	m_nl &= ~m_c;
+      } else {
+	// Less than LS_WIDTH bytes left close to the end of a page, build the bitmaps byte by byte
+	m_c = 0;
+	m_nl = 0;
+	for(size_t k = 0; k < n - i; k++){
+	  unsigned char c = b[i + k];
+	  if(c == c_ref) m_c |= ((uint64_t)1) << k;
+	  else if(c == NL) m_nl |= ((uint64_t)1) << k;
+	}
+      }
+    }
+
+    if(m_nl == 0){
+      while(m_c != 0){
+	offsets[offsets_n] = i + __builtin_ctzll(m_c);
+	offsets_n++;
+	m_c &= m_c - 1;
+      }
+    } else {
+      uint64_t m = m_c | m_nl;
+      while(m != 0){
+	uint64_t bit = m & -m;
+	size_t offset = i + __builtin_ctzll(m);
+	offsets[offsets_n] = offset;
+	offsets_n++;
+	if(m_nl & bit){
+	  lines_n++;
+	  lines[lines_n] = offsets_n;
+	  offsets[offsets_n] = offset + 1;
+	  offsets_n++;
+	}
+	m ^= bit;
+      }
+    }
+    i += LS_WIDTH;
+  }
+
+  return linescan_index_update(index, buf, n, lines_n);
+}
+
+int LS_FN(linescan_find_bitmap)(const char* buf, uint64_t cmask, size_t n, linescan_bitmap* bm){
+  const unsigned char* b = (const unsigned char*)buf;
+  unsigned char c_ref = (unsigned char)cmask;
+  const LS_VEC v_c = LS_SET1(c_ref);
+  const LS_VEC v_nl = LS_SET1(NL);
+  size_t i = 0;
+  size_t w = 0;
+
+  if(linescan_bitmap_reserve(bm, n) != 0) return -1;
+  uint64_t* delims = bm->delims;
+  uint64_t* newlines = bm->newlines;
+
+  for(; n - i >= 64; i += 64, w++){
+    uint64_t m_c = 0;
+    uint64_t m_nl = 0;
+    for(int j = 0; j < 64; j += LS_WIDTH){
+      LS_VEC x = LS_LOAD(b + i + j);
+      m_c |= LS_EQ(x, v_c) << j;
+      m_nl |= LS_EQ(x, v_nl) << j;
+    }
+    delims[w] = m_c;
+    newlines[w] = m_nl & ~m_c;
+  }
+
+  if(i < n){
+    uint64_t m_c = 0;
+    uint64_t m_nl = 0;
+    if(LS_FN(linescan_partial)(b, i, n - i, n, 64, v_c, v_nl, &m_c, &m_nl)){
+      m_nl &= ~m_c;
+    } else {
+      // Less than 64 bytes left close to the end of a page, build the last word byte by byte
+      for(size_t k = 0; k < n - i; k++){
+	unsigned char c = b[i + k];
+	if(c == c_ref) m_c |= ((uint64_t)1) << k;
+	else if(c == NL) m_nl |= ((uint64_t)1) << k;
+      }
+    }
+    delims[w] = m_c;
+    newlines[w] = m_nl;
+  }
+
+  return linescan_bitmap_update(bm, buf, n);
+}
+
+int LS_FN(linescan_count_all)(const char* buf, uint64_t cmask, size_t n, linescan_counts* counts){
+  const unsigned char* b = (const unsigned char*)buf;
+  unsigned char c_ref = (unsigned char)cmask;
+  const LS_VEC v_c = LS_SET1(c_ref);
+  const LS_VEC v_nl = LS_SET1(NL);
+  size_t lines_n = 0;
+  size_t delims_n = 0;
+  size_t fields = 0;
+  size_t fields_max = 0;
+  size_t i = 0;
+
+  for(; n - i >= 64; i += 64){
+    LINESCAN_COUNT(bytes_body, 64)
+    uint64_t m_c = 0;
+    uint64_t m_nl = 0;
+    for(int j = 0; j < 64; j += LS_WIDTH){
+      LS_VEC x = LS_LOAD(b + i + j);
+      m_c |= LS_EQ(x, v_c) << j;
+      m_nl |= LS_EQ(x, v_nl) << j;
+    }
+    linescan_counts_block(m_c, m_nl & ~m_c, &lines_n, &delims_n, &fields, &fields_max);
+  }
+
+  if(i < n){
+    LINESCAN_COUNT(bytes_tail, n - i)
+    uint64_t m_c = 0;
+    uint64_t m_nl = 0;
+    if(LS_FN(linescan_partial)(b, i, n - i, n, 64, v_c, v_nl, &m_c, &m_nl)){
+      m_nl &= ~m_c;
+    } else {
+      // Less than 64 bytes left close to the end of a page, build the last block byte by byte
+      for(size_t k = 0; k < n - i; k++){
+	unsigned char c = b[i + k];
+	if(c == c_ref) m_c |= ((uint64_t)1) << k;
+	else if(c == NL) m_nl |= ((uint64_t)1) << k;
+      }
+    }
+    linescan_counts_block(m_c, m_nl, &lines_n, &delims_n, &fields, &fields_max);
+  }
+
+  int ends_nl = n > 0 && b[n - 1] == NL && c_ref != NL;
+  return linescan_counts_update(counts, buf, n, lines_n, delims_n, fields, fields_max, ends_nl);
+}
+
+void LS_FN(linescan_block)(const char* buf, uint64_t cmask, size_t n,
+			   uint64_t* m_c, uint64_t* m_nl){
+  const unsigned char* b = (const unsigned char*)buf;
+  unsigned char c_ref = (unsigned char)cmask;
+  const LS_VEC v_c = LS_SET1(c_ref);
+  const LS_VEC v_nl = LS_SET1(NL);
+  uint64_t c = 0;
+  uint64_t nl = 0;
+
+  if(n == 64){
+    for(int j = 0; j < 64; j += LS_WIDTH){
+      LS_VEC x = LS_LOAD(b + j);
+      c |= LS_EQ(x, v_c) << j;
+      nl |= LS_EQ(x, v_nl) << j;
+    }
+  } else if(!LS_FN(linescan_partial)(b, 0, n, n, 64, v_c, v_nl, &c, &nl)){
+    for(size_t k = 0; k < n; k++){
+      if(b[k] == c_ref) c |= ((uint64_t)1) << k;
+      else if(b[k] == NL) nl |= ((uint64_t)1) << k;
+    }
+  }
+  *m_c = c;
+  *m_nl = nl & ~c;
+}
+
+void LS_FN(linescan_block_quoted)(const char* buf, uint64_t cmask, uint64_t qmask, size_t n,
+				  uint64_t* m_c, uint64_t* m_nl, uint64_t* m_q){
+  const unsigned char* b = (const unsigned char*)buf;
+  unsigned char c_ref = (unsigned char)cmask;
+  unsigned char q_ref = (unsigned char)qmask;
+  const LS_VEC v_c = LS_SET1(c_ref);
+  const LS_VEC v_nl = LS_SET1(NL);
+  const LS_VEC v_q = LS_SET1(q_ref);
+  uint64_t c = 0;
+  uint64_t nl = 0;
+  uint64_t q = 0;
+  uint64_t unused;
+
+  if(n == 64){
+    for(int j = 0; j < 64; j += LS_WIDTH){
+      LS_VEC x = LS_LOAD(b + j);
+      c |= LS_EQ(x, v_c) << j;
+      nl |= LS_EQ(x, v_nl) << j;
+      q |= LS_EQ(x, v_q) << j;
+    }
+  } else if(LS_FN(linescan_partial)(b, 0, n, n, 64, v_c, v_nl, &c, &nl)){
+    // Same loads as above, succeeds as well
+    LS_FN(linescan_partial)(b, 0, n, n, 64, v_q, v_q, &q, &unused);
+  } else {
+    for(size_t k = 0; k < n; k++){
+      if(b[k] == c_ref) c |= ((uint64_t)1) << k;
+      else if(b[k] == NL) nl |= ((uint64_t)1) << k;
+      else if(b[k] == q_ref) q |= ((uint64_t)1) << k;
+    }
+  }
+  *m_c = c;
+  *m_nl = nl & ~c;
+  *m_q = q & ~(c | nl);
+}
+
+#ifdef LS_SHUFFLE
+
+/* Bitmap of the 64 characters at p in the set of cl: low and high nibbles of
+   every byte look up one table each, and the byte is in the set if both
+   lookups share a bit. */
+static inline __attribute__((always_inline))
+uint64_t LS_FN(linescan_classify)(const unsigned char* p, const LS_VEC* lo, const LS_VEC* hi, size_t tables){
+  const LS_VEC v_0f = LS_SET1(0x0f);
+  const LS_VEC v_zero = LS_SET1(0);
+  uint64_t m = 0;
+  for(int j = 0; j < 64; j += LS_WIDTH){
+    LS_VEC x = LS_LOAD(p + j);
+    LS_VEC x_lo = LS_AND(x, v_0f);
+    LS_VEC x_hi = LS_AND(LS_SRL4(x), v_0f);
+    LS_VEC t = LS_AND(LS_SHUFFLE(lo[0], x_lo), LS_SHUFFLE(hi[0], x_hi));
+    if(tables > 1) t = LS_OR(t, LS_AND(LS_SHUFFLE(lo[1], x_lo), LS_SHUFFLE(hi[1], x_hi)));
+    m |= (~LS_EQ(t, v_zero) & LS_LANES) << j;
+  }
+  return m;
+}
+
+int LS_FN(linescan_find_class)(const char* buf, const linescan_class* cl, size_t n, linescan_hits* hits){
+  const unsigned char* b = (const unsigned char*)buf;
+  const LS_VEC lo[2] = {LS_TABLE(cl->lo[0]), LS_TABLE(cl->lo[1])};
+  const LS_VEC hi[2] = {LS_TABLE(cl->hi[0]), LS_TABLE(cl->hi[1])};
+  size_t hits_n = 0;
+
+  for(size_t i = 0; i < n; i += 64){
+    size_t k = n - i < 64 ? n - i : 64;
+    uint64_t m;
+    if(k == 64){
+      m = LS_FN(linescan_classify)(b + i, lo, hi, cl->tables);
+    } else if(n >= 64){
+      // Overlaps characters classified before
+      m = LS_FN(linescan_classify)(b + n - 64, lo, hi, cl->tables) >> (64 - k);
+    } else if(((uintptr_t)(b + i) & (LINESCAN_PAGE_SIZE - 1)) <= LINESCAN_PAGE_SIZE - 64){
+      m = LS_FN(linescan_classify)(b + i, lo, hi, cl->tables) & ((((uint64_t)1) << k) - 1);
+    } else {
+      m = 0;
+      for(size_t j = 0; j < k; j++)
+	if(cl->classes[b[i + j]] != 0) m |= ((uint64_t)1) << j;
+    }
+
+    if(m == 0) continue;
+    if(linescan_hits_reserve(hits, hits_n, 64) != 0) return -1;
+    while(m != 0){
+      size_t offset = i + __builtin_ctzll(m);
+      hits->offsets[hits_n] = offset;
+      hits->classes[hits_n] = cl->classes[b[offset]] - 1;
+      hits_n++;
+      m &= m - 1;
+    }
+  }
+  return linescan_hits_update(hits, buf, n, hits_n);
+}
+
+#endif
+
+#undef LS_LANES
+#undef LS_FN
+#undef LS_CAT
+#undef LS_CAT_
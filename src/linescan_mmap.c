@@ -0,0 +1,191 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define _GNU_SOURCE
+
+#include <linescan_mmap.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Number of characters searched per linescan_find call, bounds the offsets array
+static const size_t LINESCAN_MMAP_STEP = 1 << 16;
+
+struct linescan_mmap {
+  int fd;
+  size_t file_size;
+  uint64_t cmask;
+  size_t window_size;
+  int flags;
+  size_t page_size;
+
+  // Current window
+  char* map;
+  size_t map_offset;
+  size_t map_len;
+
+  // File offset of the next line
+  size_t pos;
+
+  // Results of a search step
+  linescan* step;
+  // Line assembled from several search steps
+  linescan* line;
+};
+
+linescan_mmap* linescan_mmap_open(const char* path, uint64_t cmask, size_t window_size, int flags){
+  LINESCAN_CHECK(path != NULL, NULL)
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return NULL;
+  struct stat st;
+  if(fstat(fd, &st) != 0){
+    close(fd);
+    return NULL;
+  }
+
+  linescan_mmap* m = calloc(1, sizeof(linescan_mmap));
+  if(m == NULL){
+    close(fd);
+    return NULL;
+  }
+  m->fd = fd;
+  m->file_size = (size_t)st.st_size;
+  m->cmask = cmask;
+  m->page_size = (size_t)sysconf(_SC_PAGESIZE);
+  m->window_size = window_size == 0 ? m->file_size : window_size;
+  // Windows start on a page boundary and span whole pages
+  m->window_size = (m->window_size + m->page_size - 1) / m->page_size * m->page_size;
+  if(m->window_size == 0) m->window_size = m->page_size;
+  m->flags = flags;
+  m->map = NULL;
+  m->step = linescan_create(LINESCAN_MMAP_STEP + 2);
+  m->line = linescan_create(LINESCAN_MMAP_STEP + 2);
+  return m;
+}
+
+void linescan_mmap_close(linescan_mmap* m){
+  if(m->map != NULL) munmap(m->map, m->map_len);
+  close(m->fd);
+  linescan_free(m->step);
+  linescan_free(m->line);
+  free(m);
+}
+
+size_t linescan_mmap_tell(const linescan_mmap* m){
+  return m->pos;
+}
+
+/* Maps len bytes of the file, starting at the page containing offset.
+   @returns 0 on success, -1 on error. */
+static int linescan_mmap_window(linescan_mmap* m, size_t offset, size_t len){
+  size_t base = offset / m->page_size * m->page_size;
+  if(len > m->file_size - base) len = m->file_size - base;
+
+  if(m->map != NULL){
+    munmap(m->map, m->map_len);
+    m->map = NULL;
+  }
+  int map_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  if(m->flags & LINESCAN_MMAP_POPULATE) map_flags |= MAP_POPULATE;
+#endif
+  void* map = mmap(NULL, len, PROT_READ, map_flags, m->fd, (off_t)base);
+  if(map == MAP_FAILED) return -1;
+
+  // Hints only, failures are not fatal
+  madvise(map, len, MADV_SEQUENTIAL);
+  madvise(map, len, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+  if(m->flags & LINESCAN_MMAP_HUGEPAGES) madvise(map, len, MADV_HUGEPAGE);
+#endif
+
+  m->map = map;
+  m->map_offset = base;
+  m->map_len = len;
+  return 0;
+}
+
+/* Appends the offsets of a search step starting at position base of the line.
+   @returns 0 on success, -1 if memory could not be allocated. */
+static int linescan_mmap_append(linescan* line, const linescan* step, size_t base){
+  if(line->offsets_n + step->offsets_n > line->offsets_size){
+    size_t size = line->offsets_size * 2 + step->offsets_n;
+    size_t* offsets = realloc(line->offsets, size * sizeof(size_t));
+    if(offsets == NULL) return -1;
+    line->offsets = offsets;
+    line->offsets_size = size;
+  }
+  size_t offsets_n = line->offsets_n;
+  if(offsets_n == 0){
+    line->offsets[0] = 0;
+    offsets_n = 1;
+  }
+  for(size_t i = 1; i < step->offsets_n; i++){
+    line->offsets[offsets_n] = base + step->offsets[i];
+    offsets_n++;
+  }
+  line->offsets_n = offsets_n;
+  line->size = base + step->size;
+  return 0;
+}
+
+int linescan_mmap_next(linescan_mmap* m, const linescan** line){
+  LINESCAN_CHECK(m != NULL, -1)
+  LINESCAN_CHECK(line != NULL, -1)
+  if(m->pos >= m->file_size) return 0;
+
+  for(;;){
+    if(m->map == NULL || m->pos >= m->map_offset + m->map_len){
+      if(linescan_mmap_window(m, m->pos, m->window_size) != 0) return -1;
+    }
+    const char* buf = m->map + (m->pos - m->map_offset);
+    size_t avail = m->map_offset + m->map_len - m->pos;
+    int at_eof = m->map_offset + m->map_len == m->file_size;
+    size_t done = 0;
+    int rc = 0;
+
+    linescan_reset(m->line);
+    while(done < avail){
+      size_t n = avail - done < LINESCAN_MMAP_STEP ? avail - done : LINESCAN_MMAP_STEP;
+      rc = linescan_find(buf + done, m->cmask, n, m->step);
+      if(rc == 1 && done == 0){
+	// Line within the first step, hand out the step directly
+	m->pos += m->step->size;
+	*line = m->step;
+	return 1;
+      }
+      if(linescan_mmap_append(m->line, m->step, done) != 0) return -1;
+      done += m->step->size;
+      if(rc == 1) break;
+    }
+
+    if(rc == 1 || at_eof){
+      m->line->buf = buf;
+      m->pos += m->line->size;
+      *line = m->line;
+      return 1;
+    }
+
+    // The line crosses the end of the window; map a window starting at the line
+    size_t base = m->pos / m->page_size * m->page_size;
+    size_t len = m->map_offset + m->map_len - base;
+    len = len * 2 > m->window_size ? len * 2 : m->window_size;
+    if(linescan_mmap_window(m, m->pos, len) != 0) return -1;
+  }
+}
@@ -0,0 +1,287 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <linescan_parallel.h>
+#include "linescan_internal.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+typedef struct linescan_worker {
+  linescan_pool* pool;
+  size_t id;
+  pthread_t thread;
+} linescan_worker;
+
+struct linescan_pool {
+  size_t threads;
+  // Workers 1 .. threads-1; worker 0 is the thread calling linescan_pool_run
+  linescan_worker* workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  // Incremented for every job
+  unsigned long generation;
+  // Number of workers still running the current job
+  size_t pending;
+  int stop;
+
+  linescan_job_fn job;
+  void* arg;
+};
+
+static void* linescan_worker_main(void* arg){
+  linescan_worker* worker = arg;
+  linescan_pool* pool = worker->pool;
+  unsigned long generation = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for(;;){
+    while(!pool->stop && pool->generation == generation){
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if(pool->stop) break;
+    generation = pool->generation;
+    linescan_job_fn job = pool->job;
+    void* job_arg = pool->arg;
+    pthread_mutex_unlock(&pool->lock);
+
+    job(job_arg, worker->id);
+
+    pthread_mutex_lock(&pool->lock);
+    if(--pool->pending == 0) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+linescan_pool* linescan_pool_create(size_t threads){
+  LINESCAN_CHECK(threads > 0, NULL)
+  linescan_pool* pool = calloc(1, sizeof(linescan_pool));
+  if(pool == NULL) return NULL;
+  pool->workers = calloc(threads, sizeof(linescan_worker));
+  if(pool->workers == NULL){
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  pool->threads = 1;
+  for(size_t i = 1; i < threads; i++){
+    linescan_worker* worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->id = i;
+    if(pthread_create(&worker->thread, NULL, linescan_worker_main, worker) != 0){
+      linescan_pool_free(pool);
+      return NULL;
+    }
+    pool->threads++;
+  }
+  return pool;
+}
+
+void linescan_pool_free(linescan_pool* pool){
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for(size_t i = 1; i < pool->threads; i++){
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->workers);
+  free(pool);
+}
+
+size_t linescan_pool_threads(const linescan_pool* pool){
+  return pool->threads;
+}
+
+void linescan_pool_run(linescan_pool* pool, linescan_job_fn job, void* arg){
+  pthread_mutex_lock(&pool->lock);
+  pool->job = job;
+  pool->arg = arg;
+  pool->pending = pool->threads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  job(arg, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while(pool->pending > 0){
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Work stealing ranges. Every worker owns a range of chunk numbers, packed as
+   (front << 32 | back) into one atomic word. The owner takes chunks from the
+   front, thieves take them from the back. */
+
+static inline int linescan_range_take(_Atomic uint64_t* range, int steal, size_t* chunk){
+  uint64_t r = atomic_load(range);
+  for(;;){
+    uint64_t front = r >> 32;
+    uint64_t back = r & 0xffffffff;
+    if(front >= back) return 0;
+    uint64_t next = steal ? (front << 32 | (back - 1)) : ((front + 1) << 32 | back);
+    if(atomic_compare_exchange_weak(range, &r, next)){
+      *chunk = steal ? back - 1 : front;
+      return 1;
+    }
+  }
+}
+
+typedef struct linescan_parallel_job {
+  const char* buf;
+  uint64_t cmask;
+  size_t n;
+  size_t chunk_size;
+  linescan_parallel* result;
+  _Atomic uint64_t* ranges;
+  size_t workers;
+  atomic_int error;
+} linescan_parallel_job;
+
+// @returns Start of the first line at or after pos.
+static size_t linescan_parallel_snap(const char* buf, size_t n, size_t pos){
+  if(pos == 0) return 0;
+  if(pos >= n) return n;
+  const char* nl = memchr(buf + pos - 1, '\n', n - pos + 1);
+  return nl == NULL ? n : (size_t)(nl - buf) + 1;
+}
+
+static void linescan_parallel_chunk(linescan_parallel_job* job, size_t chunk){
+  size_t start = linescan_parallel_snap(job->buf, job->n, chunk * job->chunk_size);
+  size_t end = linescan_parallel_snap(job->buf, job->n, (chunk + 1) * job->chunk_size);
+  job->result->starts[chunk] = start;
+  if(linescan_find_all(job->buf + start, job->cmask, end - start, job->result->indexes[chunk]) < 0){
+    atomic_store(&job->error, 1);
+  }
+}
+
+static void linescan_parallel_work(void* arg, size_t worker){
+  linescan_parallel_job* job = arg;
+  size_t chunk;
+
+  while(linescan_range_take(&job->ranges[worker], 0, &chunk)){
+    linescan_parallel_chunk(job, chunk);
+  }
+  for(size_t i = 1; i < job->workers; i++){
+    _Atomic uint64_t* victim = &job->ranges[(worker + i) % job->workers];
+    while(linescan_range_take(victim, 1, &chunk)){
+      linescan_parallel_chunk(job, chunk);
+    }
+  }
+}
+
+linescan_parallel* linescan_parallel_create(void){
+  return calloc(1, sizeof(linescan_parallel));
+}
+
+void linescan_parallel_free(linescan_parallel* result){
+  for(size_t i = 0; i < result->chunks_size; i++){
+    linescan_index_free(result->indexes[i]);
+  }
+  free(result->indexes);
+  free(result->starts);
+  free(result);
+}
+
+size_t linescan_parallel_lines(const linescan_parallel* result){
+  size_t lines = 0;
+  for(size_t i = 0; i < result->chunks_n; i++){
+    lines += result->indexes[i]->lines_n;
+  }
+  return lines;
+}
+
+/* Makes room for chunks_n chunks.
+   @returns 0 on success, -1 if memory could not be allocated. */
+static int linescan_parallel_reserve(linescan_parallel* result, size_t chunks_n, size_t chunk_size){
+  if(chunks_n <= result->chunks_size) return 0;
+  size_t* starts = realloc(result->starts, chunks_n * sizeof(size_t));
+  if(starts == NULL) return -1;
+  result->starts = starts;
+  linescan_index** indexes = realloc(result->indexes, chunks_n * sizeof(linescan_index*));
+  if(indexes == NULL) return -1;
+  result->indexes = indexes;
+  for(; result->chunks_size < chunks_n; result->chunks_size++){
+    indexes[result->chunks_size] = linescan_index_create(chunk_size / 8 + 16, chunk_size / 64 + 16);
+  }
+  return 0;
+}
+
+int linescan_parallel_find_all(linescan_pool* pool, const char* buf, uint64_t cmask, size_t n,
+			       size_t chunk_size, linescan_parallel* result){
+  LINESCAN_CHECK(pool != NULL, -1)
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(result != NULL, -1)
+
+  size_t workers = pool->threads;
+  if(chunk_size == 0){
+    // Several chunks per worker leave room for stealing
+    chunk_size = n / (workers * 8);
+    if(chunk_size < (1 << 16)) chunk_size = 1 << 16;
+  }
+  size_t chunks_n = (n + chunk_size - 1) / chunk_size;
+  if(chunks_n == 0) chunks_n = 1;
+  if(chunks_n > 0xffffffff) return -1;
+  if(linescan_parallel_reserve(result, chunks_n, chunk_size) != 0) return -1;
+
+  // Deal out contiguous ranges, so neighbouring chunks are usually scanned by the same worker
+  _Atomic uint64_t* ranges = malloc(workers * sizeof(_Atomic uint64_t));
+  if(ranges == NULL) return -1;
+  for(size_t i = 0; i < workers; i++){
+    uint64_t front = chunks_n * i / workers;
+    uint64_t back = chunks_n * (i + 1) / workers;
+    atomic_init(&ranges[i], front << 32 | back);
+  }
+
+  linescan_parallel_job job = {
+    .buf = buf,
+    .cmask = cmask,
+    .n = n,
+    .chunk_size = chunk_size,
+    .result = result,
+    .ranges = ranges,
+    .workers = workers,
+  };
+  atomic_init(&job.error, 0);
+  linescan_pool_run(pool, linescan_parallel_work, &job);
+  free(ranges);
+  if(atomic_load(&job.error)) return -1;
+
+  result->buf = buf;
+  result->chunks_n = chunks_n;
+  result->size = 0;
+  for(size_t i = chunks_n; i-- > 0;){
+    if(result->indexes[i]->lines_n > 0){
+      result->size = result->starts[i] + result->indexes[i]->size;
+      break;
+    }
+  }
+  return result->size == n;
+}
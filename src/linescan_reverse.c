@@ -0,0 +1,212 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define _GNU_SOURCE
+
+#include <linescan_reverse.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Number of characters searched per linescan_rfind call, bounds the offsets array
+static const size_t LINESCAN_REVERSE_STEP = 1 << 16;
+
+struct linescan_reverse {
+  // File descriptor; -1 if the reader runs over a caller-supplied buffer
+  int fd;
+  size_t file_size;
+  uint64_t cmask;
+  size_t window_size;
+  size_t page_size;
+
+  // Current window; the whole buffer if fd is -1
+  char* map;
+  size_t map_offset;
+  size_t map_len;
+
+  // Offset behind the line handed out next
+  size_t pos;
+
+  // Results of a search step
+  linescan* step;
+  // Line handed out
+  linescan* line;
+  // cmask matches of the line in descending order, relative to the start of the input
+  size_t* matches;
+  size_t matches_size;
+};
+
+static linescan_reverse* linescan_reverse_alloc(size_t file_size, uint64_t cmask){
+  linescan_reverse* r = calloc(1, sizeof(linescan_reverse));
+  if(r == NULL) return NULL;
+  r->fd = -1;
+  r->file_size = file_size;
+  r->cmask = cmask;
+  r->pos = file_size;
+  r->step = linescan_create(LINESCAN_REVERSE_STEP + 2);
+  r->line = linescan_create(LINESCAN_REVERSE_STEP + 2);
+  r->matches_size = LINESCAN_REVERSE_STEP;
+  r->matches = malloc(r->matches_size * sizeof(size_t));
+  if(r->matches == NULL){
+    linescan_reverse_free(r);
+    return NULL;
+  }
+  return r;
+}
+
+linescan_reverse* linescan_reverse_open(const char* path, uint64_t cmask, size_t window_size){
+  LINESCAN_CHECK(path != NULL, NULL)
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return NULL;
+  struct stat st;
+  if(fstat(fd, &st) != 0){
+    close(fd);
+    return NULL;
+  }
+
+  linescan_reverse* r = linescan_reverse_alloc((size_t)st.st_size, cmask);
+  if(r == NULL){
+    close(fd);
+    return NULL;
+  }
+  r->fd = fd;
+  r->page_size = (size_t)sysconf(_SC_PAGESIZE);
+  r->window_size = window_size == 0 ? r->file_size : window_size;
+  // Windows start on a multiple of the window size and span whole pages
+  r->window_size = (r->window_size + r->page_size - 1) / r->page_size * r->page_size;
+  if(r->window_size == 0) r->window_size = r->page_size;
+  return r;
+}
+
+linescan_reverse* linescan_reverse_create(const char* buf, size_t n, uint64_t cmask){
+  LINESCAN_CHECK(buf != NULL, NULL)
+  linescan_reverse* r = linescan_reverse_alloc(n, cmask);
+  if(r == NULL) return NULL;
+  r->map = (char*)buf;
+  r->map_len = n;
+  return r;
+}
+
+void linescan_reverse_free(linescan_reverse* r){
+  if(r->fd >= 0){
+    if(r->map != NULL) munmap(r->map, r->map_len);
+    close(r->fd);
+  }
+  linescan_free(r->step);
+  linescan_free(r->line);
+  free(r->matches);
+  free(r);
+}
+
+size_t linescan_reverse_tell(const linescan_reverse* r){
+  return r->pos;
+}
+
+/* Maps the file from base (a multiple of the page size) up to end.
+   @returns 0 on success, -1 on error. */
+static int linescan_reverse_window(linescan_reverse* r, size_t base, size_t end){
+  if(r->map != NULL){
+    munmap(r->map, r->map_len);
+    r->map = NULL;
+  }
+  void* map = mmap(NULL, end - base, PROT_READ, MAP_PRIVATE, r->fd, (off_t)base);
+  if(map == MAP_FAILED) return -1;
+  // Hint only; readahead does not help when walking backwards
+  madvise(map, end - base, MADV_WILLNEED);
+  r->map = map;
+  r->map_offset = base;
+  r->map_len = end - base;
+  return 0;
+}
+
+/* Makes sure the window contains the character in front of pos, mapping the
+   aligned window containing it if needed. @returns 0 on success, -1 on error. */
+static int linescan_reverse_cover(linescan_reverse* r, size_t pos){
+  if(r->map != NULL && pos > r->map_offset && pos <= r->map_offset + r->map_len) return 0;
+  size_t base = (pos - 1) / r->window_size * r->window_size;
+  size_t end = base + r->window_size < r->file_size ? base + r->window_size : r->file_size;
+  return linescan_reverse_window(r, base, end);
+}
+
+/* Grows an offsets array to hold at least size entries.
+   @returns 0 on success, -1 if memory could not be allocated. */
+static int linescan_reverse_grow(size_t** offsets, size_t* offsets_size, size_t size){
+  if(size <= *offsets_size) return 0;
+  size = *offsets_size * 2 > size ? *offsets_size * 2 : size;
+  size_t* grown = realloc(*offsets, size * sizeof(size_t));
+  if(grown == NULL) return -1;
+  *offsets = grown;
+  *offsets_size = size;
+  return 0;
+}
+
+int linescan_reverse_next(linescan_reverse* r, const linescan** line){
+  LINESCAN_CHECK(r != NULL, -1)
+  LINESCAN_CHECK(line != NULL, -1)
+  if(r->pos == 0) return 0;
+
+  size_t end = r->pos;
+  if(linescan_reverse_cover(r, end) != 0) return -1;
+  // The newline ending the line is not searched
+  int has_nl = r->map[end - 1 - r->map_offset] == '\n';
+  size_t cur = end - has_nl;
+  size_t start = 0;
+  size_t matches_n = 0;
+
+  while(cur > 0){
+    if(linescan_reverse_cover(r, cur) != 0) return -1;
+    size_t lo = cur - r->map_offset > LINESCAN_REVERSE_STEP ? cur - LINESCAN_REVERSE_STEP : r->map_offset;
+    int rc = linescan_rfind(r->map + (lo - r->map_offset), r->cmask, cur - lo, r->step);
+    if(rc < 0) return -1;
+    // offsets[0] is the search start, the last offset is the newline if rc == 1
+    size_t last = rc == 1 ? r->step->offsets_n - 1 : r->step->offsets_n;
+    if(linescan_reverse_grow(&r->matches, &r->matches_size, matches_n + last) != 0) return -1;
+    for(size_t i = 1; i < last; i++){
+      r->matches[matches_n] = lo + r->step->offsets[i];
+      matches_n++;
+    }
+    if(rc == 1){
+      start = lo + r->step->offsets[last] + 1;
+      break;
+    }
+    cur = lo;
+  }
+
+  // The line crosses the start of the window; map it as a whole
+  if(start < r->map_offset || end > r->map_offset + r->map_len){
+    if(linescan_reverse_window(r, start / r->page_size * r->page_size, end) != 0) return -1;
+  }
+
+  linescan* l = r->line;
+  if(linescan_reverse_grow(&l->offsets, &l->offsets_size, matches_n + 2) != 0) return -1;
+  l->offsets[0] = 0;
+  for(size_t i = 0; i < matches_n; i++){
+    l->offsets[i + 1] = r->matches[matches_n - 1 - i] - start;
+  }
+  l->offsets_n = matches_n + 1;
+  if(has_nl){
+    l->offsets[l->offsets_n] = end - 1 - start;
+    l->offsets_n++;
+  }
+  l->buf = r->map + (start - r->map_offset);
+  l->size = end - start;
+  r->pos = start;
+  *line = l;
+  return 1;
+}
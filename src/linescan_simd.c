@@ -0,0 +1,210 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* x86 vector kernels. Each instruction set is compiled with its own target
+   options, so the library runs on any x86 CPU; linescan.c selects the kernel
+   at load time. */
+
+#include "linescan_internal.h"
+
+#if LINESCAN_HAVE_X86
+
+#include <immintrin.h>
+
+/* Lookup tables of the UTF-8 validator in linescan_kernels.h: error classes of
+   a byte given its predecessor's high nibble, its predecessor's low nibble, and
+   its own high nibble. A pair of bytes is invalid if all three share a bit. */
+#define LS_TOO_SHORT (1 << 0)
+#define LS_TOO_LONG (1 << 1)
+#define LS_OVERLONG_3 (1 << 2)
+#define LS_TOO_LARGE (1 << 3)
+#define LS_SURROGATE (1 << 4)
+#define LS_OVERLONG_2 (1 << 5)
+#define LS_TOO_LARGE_1000 (1 << 6)
+#define LS_OVERLONG_4 (1 << 6)
+#define LS_TWO_CONTS (1 << 7)
+#define LS_CARRY (LS_TOO_SHORT | LS_TOO_LONG | LS_TWO_CONTS)
+
+static const uint8_t linescan_utf8_tables[3][16] = {
+  {
+    // ASCII
+    LS_TOO_LONG, LS_TOO_LONG, LS_TOO_LONG, LS_TOO_LONG,
+    LS_TOO_LONG, LS_TOO_LONG, LS_TOO_LONG, LS_TOO_LONG,
+    // Continuation
+    LS_TWO_CONTS, LS_TWO_CONTS, LS_TWO_CONTS, LS_TWO_CONTS,
+    // Two byte lead
+    LS_TOO_SHORT | LS_OVERLONG_2,
+    LS_TOO_SHORT,
+    // Three byte lead
+    LS_TOO_SHORT | LS_OVERLONG_3 | LS_SURROGATE,
+    // Four byte lead
+    LS_TOO_SHORT | LS_TOO_LARGE | LS_TOO_LARGE_1000 | LS_OVERLONG_4
+  },
+  {
+    LS_CARRY | LS_OVERLONG_3 | LS_OVERLONG_2 | LS_OVERLONG_4,
+    LS_CARRY | LS_OVERLONG_2,
+    LS_CARRY,
+    LS_CARRY,
+    LS_CARRY | LS_TOO_LARGE,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000,
+    // 0xed: surrogates
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000 | LS_SURROGATE,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000,
+    LS_CARRY | LS_TOO_LARGE | LS_TOO_LARGE_1000
+  },
+  {
+    // ASCII
+    LS_TOO_SHORT, LS_TOO_SHORT, LS_TOO_SHORT, LS_TOO_SHORT,
+    LS_TOO_SHORT, LS_TOO_SHORT, LS_TOO_SHORT, LS_TOO_SHORT,
+    // Continuation 0x80 .. 0x8f, 0x90 .. 0x9f, 0xa0 .. 0xbf
+    LS_TOO_LONG | LS_OVERLONG_2 | LS_TWO_CONTS | LS_OVERLONG_3 | LS_TOO_LARGE_1000 | LS_OVERLONG_4,
+    LS_TOO_LONG | LS_OVERLONG_2 | LS_TWO_CONTS | LS_OVERLONG_3 | LS_TOO_LARGE,
+    LS_TOO_LONG | LS_OVERLONG_2 | LS_TWO_CONTS | LS_SURROGATE | LS_TOO_LARGE,
+    LS_TOO_LONG | LS_OVERLONG_2 | LS_TWO_CONTS | LS_SURROGATE | LS_TOO_LARGE,
+    // Lead
+    LS_TOO_SHORT, LS_TOO_SHORT, LS_TOO_SHORT, LS_TOO_SHORT
+  }
+};
+
+/* SSE2: 16 bytes per compare */
+#pragma GCC push_options
+#pragma GCC target("sse2")
+
+static inline __m128i ls_sse2_load(const unsigned char* p){
+  return _mm_loadu_si128((const __m128i*)p);
+}
+
+static inline uint64_t ls_sse2_eq(__m128i x, __m128i v){
+  return (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, v));
+}
+
+#define LINESCAN_ISA sse2
+#define LS_WIDTH 16
+#define LS_VEC __m128i
+#define LS_SET1(c) _mm_set1_epi8((char)(c))
+#define LS_LOAD(p) ls_sse2_load(p)
+#define LS_EQ(x,v) ls_sse2_eq(x,v)
+#include "linescan_kernels.h"
+#undef LINESCAN_ISA
+#undef LS_WIDTH
+#undef LS_VEC
+#undef LS_SET1
+#undef LS_LOAD
+#undef LS_EQ
+
+#pragma GCC pop_options
+
+/* AVX2: 32 bytes per compare */
+#pragma GCC push_options
+#pragma GCC target("avx2,bmi,bmi2")
+
+static inline __m256i ls_avx2_load(const unsigned char* p){
+  return _mm256_loadu_si256((const __m256i*)p);
+}
+
+static inline uint64_t ls_avx2_eq(__m256i x, __m256i v){
+  return (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, v));
+}
+
+#define LINESCAN_ISA avx2
+#define LS_WIDTH 32
+#define LS_VEC __m256i
+#define LS_SET1(c) _mm256_set1_epi8((char)(c))
+#define LS_LOAD(p) ls_avx2_load(p)
+#define LS_EQ(x,v) ls_avx2_eq(x,v)
+#define LS_SHUFFLE(t,x) _mm256_shuffle_epi8(t,x)
+#define LS_AND(x,y) _mm256_and_si256(x,y)
+#define LS_OR(x,y) _mm256_or_si256(x,y)
+#define LS_SRL4(x) _mm256_srli_epi16(x,4)
+#define LS_TABLE(p) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(p)))
+#define LS_PREV(x,prev,k) _mm256_alignr_epi8(x, _mm256_permute2x128_si256(prev, x, 0x21), 16 - (k))
+#define LS_SUBS(x,y) _mm256_subs_epu8(x,y)
+#define LS_XOR(x,y) _mm256_xor_si256(x,y)
+#include "linescan_kernels.h"
+#undef LINESCAN_ISA
+#undef LS_WIDTH
+#undef LS_VEC
+#undef LS_SET1
+#undef LS_LOAD
+#undef LS_EQ
+#undef LS_SHUFFLE
+#undef LS_AND
+#undef LS_OR
+#undef LS_SRL4
+#undef LS_TABLE
+#undef LS_PREV
+#undef LS_SUBS
+#undef LS_XOR
+
+#pragma GCC pop_options
+
+/* AVX-512BW: 64 bytes per compare, results directly in mask registers */
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,bmi,bmi2")
+
+static inline __m512i ls_avx512bw_load(const unsigned char* p){
+  return _mm512_loadu_si512((const void*)p);
+}
+
+static inline uint64_t ls_avx512bw_eq(__m512i x, __m512i v){
+  return (uint64_t)_mm512_cmpeq_epi8_mask(x, v);
+}
+
+#define LINESCAN_ISA avx512bw
+#define LS_WIDTH 64
+#define LS_VEC __m512i
+#define LS_SET1(c) _mm512_set1_epi8((char)(c))
+#define LS_LOAD(p) ls_avx512bw_load(p)
+#define LS_EQ(x,v) ls_avx512bw_eq(x,v)
+#define LS_SHUFFLE(t,x) _mm512_shuffle_epi8(t,x)
+#define LS_AND(x,y) _mm512_and_si512(x,y)
+#define LS_OR(x,y) _mm512_or_si512(x,y)
+#define LS_SRL4(x) _mm512_srli_epi16(x,4)
+#define LS_TABLE(p) _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)(p)))
+#define LS_PREV(x,prev,k) _mm512_alignr_epi8(x, _mm512_alignr_epi64(x, prev, 6), 16 - (k))
+#define LS_SUBS(x,y) _mm512_subs_epu8(x,y)
+#define LS_XOR(x,y) _mm512_xor_si512(x,y)
+#include "linescan_kernels.h"
+#undef LINESCAN_ISA
+#undef LS_WIDTH
+#undef LS_VEC
+#undef LS_SET1
+#undef LS_LOAD
+#undef LS_EQ
+#undef LS_SHUFFLE
+#undef LS_AND
+#undef LS_OR
+#undef LS_SRL4
+#undef LS_TABLE
+#undef LS_PREV
+#undef LS_SUBS
+#undef LS_XOR
+
+#pragma GCC pop_options
+
+#else
+// ISO C forbids an empty translation unit
+typedef int linescan_simd_unavailable;
+#endif
@@ -0,0 +1,159 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <linescan_stats.h>
+#include "linescan_internal.h"
+
+void linescan_stats_add(linescan_stats* to, const linescan_stats* from){
+  uint64_t* t = (uint64_t*)to;
+  const uint64_t* f = (const uint64_t*)from;
+  for(size_t i = 0; i < sizeof(linescan_stats) / sizeof(uint64_t); i++){
+    t[i] += f[i];
+  }
+}
+
+#ifdef LINESCAN_STATS
+
+#include <pthread.h>
+
+_Static_assert(sizeof(linescan_stats) % sizeof(uint64_t) == 0, "linescan_stats must only hold uint64_t");
+
+_Thread_local linescan_stats_counters linescan_stats_tls;
+
+/* Registry of the counters of all running threads. Counters of exiting threads
+   are folded into linescan_stats_retired by the key destructor. */
+static pthread_mutex_t linescan_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t linescan_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t linescan_stats_key;
+static linescan_stats_counters* linescan_stats_threads = NULL;
+static linescan_stats linescan_stats_retired;
+static int linescan_stats_rdtsc = 0;
+
+// Reads counters which may be written by another thread
+static void linescan_stats_load(linescan_stats* to, const linescan_stats* from){
+  uint64_t* t = (uint64_t*)to;
+  const uint64_t* f = (const uint64_t*)from;
+  for(size_t i = 0; i < sizeof(linescan_stats) / sizeof(uint64_t); i++){
+    t[i] = __atomic_load_n(&f[i], __ATOMIC_RELAXED);
+  }
+}
+
+static void linescan_stats_unregister(void* arg){
+  linescan_stats_counters* c = arg;
+  linescan_stats s;
+  pthread_mutex_lock(&linescan_stats_lock);
+  linescan_stats_load(&s, &c->stats);
+  linescan_stats_add(&linescan_stats_retired, &s);
+  linescan_stats_counters** p = &linescan_stats_threads;
+  while(*p != c) p = &(*p)->next;
+  *p = c->next;
+  pthread_mutex_unlock(&linescan_stats_lock);
+}
+
+static void linescan_stats_init(void){
+  pthread_key_create(&linescan_stats_key, linescan_stats_unregister);
+}
+
+void linescan_stats_register(void){
+  linescan_stats_counters* c = &linescan_stats_tls;
+  pthread_once(&linescan_stats_once, linescan_stats_init);
+  pthread_mutex_lock(&linescan_stats_lock);
+  c->next = linescan_stats_threads;
+  linescan_stats_threads = c;
+  pthread_mutex_unlock(&linescan_stats_lock);
+  pthread_setspecific(linescan_stats_key, c);
+  c->registered = 1;
+}
+
+uint64_t linescan_stats_clock(void){
+#if LINESCAN_HAVE_X86
+  if(__atomic_load_n(&linescan_stats_rdtsc, __ATOMIC_RELAXED)) return __builtin_ia32_rdtsc();
+#endif
+  return 0;
+}
+
+int linescan_stats_enabled(void){
+  return 1;
+}
+
+void linescan_stats_cycles(int enable){
+  __atomic_store_n(&linescan_stats_rdtsc, enable != 0, __ATOMIC_RELAXED);
+}
+
+void linescan_stats_thread(linescan_stats* stats){
+  linescan_stats_load(stats, &linescan_stats_tls.stats);
+}
+
+void linescan_stats_total(linescan_stats* stats){
+  pthread_mutex_lock(&linescan_stats_lock);
+  *stats = linescan_stats_retired;
+  for(linescan_stats_counters* c = linescan_stats_threads; c != NULL; c = c->next){
+    linescan_stats s;
+    linescan_stats_load(&s, &c->stats);
+    linescan_stats_add(stats, &s);
+  }
+  // The calling thread may not have searched yet
+  if(!linescan_stats_tls.registered){
+    linescan_stats s;
+    linescan_stats_load(&s, &linescan_stats_tls.stats);
+    linescan_stats_add(stats, &s);
+  }
+  pthread_mutex_unlock(&linescan_stats_lock);
+}
+
+static void linescan_stats_clear(linescan_stats* stats){
+  uint64_t* s = (uint64_t*)stats;
+  for(size_t i = 0; i < sizeof(linescan_stats) / sizeof(uint64_t); i++){
+    __atomic_store_n(&s[i], 0, __ATOMIC_RELAXED);
+  }
+}
+
+void linescan_stats_reset(void){
+  pthread_mutex_lock(&linescan_stats_lock);
+  memset(&linescan_stats_retired, 0, sizeof(linescan_stats));
+  for(linescan_stats_counters* c = linescan_stats_threads; c != NULL; c = c->next){
+    linescan_stats_clear(&c->stats);
+  }
+  linescan_stats_clear(&linescan_stats_tls.stats);
+  pthread_mutex_unlock(&linescan_stats_lock);
+}
+
+#else
+
+int linescan_stats_enabled(void){
+  return 0;
+}
+
+void linescan_stats_cycles(int enable){
+  (void)enable;
+}
+
+void linescan_stats_thread(linescan_stats* stats){
+  memset(stats, 0, sizeof(linescan_stats));
+}
+
+void linescan_stats_total(linescan_stats* stats){
+  memset(stats, 0, sizeof(linescan_stats));
+}
+
+void linescan_stats_reset(void){
+}
+
+#endif
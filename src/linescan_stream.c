@@ -0,0 +1,262 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <linescan_stream.h>
+#include <pthread.h>
+#include <unistd.h>
+
+enum linescan_chunk_state {
+  // Owned by the reader thread
+  LINESCAN_CHUNK_EMPTY,
+  // Owned by the consumer
+  LINESCAN_CHUNK_FULL
+};
+
+typedef struct linescan_chunk {
+  char* buf;
+  // Number of characters read; 0 at end of input
+  size_t len;
+  // Set if read() failed
+  int error;
+  enum linescan_chunk_state state;
+} linescan_chunk;
+
+struct linescan_stream {
+  int fd;
+  uint64_t cmask;
+  size_t chunk_size;
+
+  // Double buffer; the consumer scans chunks[cur] while the reader fills the other one
+  linescan_chunk chunks[2];
+  int cur;
+  // Chunk chunks[cur] is owned by the consumer
+  int have_chunk;
+  // Scan position in chunks[cur]
+  size_t pos;
+  int eof;
+
+  pthread_t reader;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int stop;
+
+  // Results of the last search in chunks[cur]
+  linescan* scan;
+  // Line spanning chunk boundaries, assembled in carry_buf
+  linescan* carry;
+  char* carry_buf;
+  size_t carry_size;
+  // Set after the carried line was handed out
+  int carry_done;
+};
+
+static void* linescan_stream_read(void* arg){
+  linescan_stream* s = arg;
+  int next = 0;
+
+  pthread_mutex_lock(&s->lock);
+  while(!s->stop){
+    linescan_chunk* chunk = &s->chunks[next];
+    if(chunk->state != LINESCAN_CHUNK_EMPTY){
+      pthread_cond_wait(&s->cond, &s->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    ssize_t r;
+    do {
+      r = read(s->fd, chunk->buf, s->chunk_size);
+    } while(r < 0 && errno == EINTR);
+
+    pthread_mutex_lock(&s->lock);
+    chunk->len = r > 0 ? (size_t)r : 0;
+    chunk->error = r < 0;
+    chunk->state = LINESCAN_CHUNK_FULL;
+    pthread_cond_broadcast(&s->cond);
+    // Nothing follows end of input or an error
+    if(r <= 0) break;
+    next ^= 1;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+linescan_stream* linescan_stream_create(int fd, uint64_t cmask, size_t chunk_size){
+  LINESCAN_CHECK(chunk_size > 0, NULL)
+  linescan_stream* s = calloc(1, sizeof(linescan_stream));
+  if(s == NULL) return NULL;
+  s->fd = fd;
+  s->cmask = cmask;
+  s->chunk_size = chunk_size;
+  for(int i = 0; i < 2; i++){
+    s->chunks[i].buf = malloc(chunk_size);
+    s->chunks[i].state = LINESCAN_CHUNK_EMPTY;
+  }
+  // A chunk holds at most chunk_size matches plus start and end
+  s->scan = linescan_create(chunk_size + 2);
+  s->carry = linescan_create(chunk_size + 2);
+  s->carry_size = chunk_size;
+  s->carry_buf = malloc(chunk_size);
+  if(s->chunks[0].buf == NULL || s->chunks[1].buf == NULL || s->carry_buf == NULL){
+    free(s->chunks[0].buf);
+    free(s->chunks[1].buf);
+    free(s->carry_buf);
+    linescan_free(s->scan);
+    linescan_free(s->carry);
+    free(s);
+    return NULL;
+  }
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  if(pthread_create(&s->reader, NULL, linescan_stream_read, s) != 0){
+    s->stop = 1;
+    s->reader = pthread_self();
+    linescan_stream_free(s);
+    return NULL;
+  }
+  return s;
+}
+
+void linescan_stream_free(linescan_stream* s){
+  pthread_mutex_lock(&s->lock);
+  s->stop = 1;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+  if(!pthread_equal(s->reader, pthread_self())) pthread_join(s->reader, NULL);
+
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->cond);
+  free(s->chunks[0].buf);
+  free(s->chunks[1].buf);
+  free(s->carry_buf);
+  linescan_free(s->scan);
+  linescan_free(s->carry);
+  free(s);
+}
+
+static linescan_chunk* linescan_stream_acquire(linescan_stream* s){
+  linescan_chunk* chunk = &s->chunks[s->cur];
+  pthread_mutex_lock(&s->lock);
+  while(chunk->state != LINESCAN_CHUNK_FULL){
+    pthread_cond_wait(&s->cond, &s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  s->have_chunk = 1;
+  s->pos = 0;
+  return chunk;
+}
+
+// Hands chunks[cur] back to the reader and moves on to the other chunk
+static void linescan_stream_release(linescan_stream* s){
+  pthread_mutex_lock(&s->lock);
+  s->chunks[s->cur].state = LINESCAN_CHUNK_EMPTY;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+  s->have_chunk = 0;
+  s->cur ^= 1;
+}
+
+/* Appends the results of the last search to the carried line, shifting the
+   offsets behind the characters carried so far.
+   @returns 0 on success, -1 if memory could not be allocated. */
+static int linescan_stream_carry(linescan_stream* s){
+  linescan* carry = s->carry;
+  linescan* scan = s->scan;
+  size_t carry_len = carry->size;
+
+  if(carry_len + scan->size > s->carry_size){
+    size_t size = s->carry_size * 2 > carry_len + scan->size ? s->carry_size * 2 : carry_len + scan->size;
+    char* buf = realloc(s->carry_buf, size);
+    if(buf == NULL) return -1;
+    s->carry_buf = buf;
+    s->carry_size = size;
+  }
+  if(carry->offsets_n + scan->offsets_n > carry->offsets_size){
+    size_t size = carry->offsets_size * 2 > carry->offsets_n + scan->offsets_n ?
+      carry->offsets_size * 2 : carry->offsets_n + scan->offsets_n;
+    size_t* offsets = realloc(carry->offsets, size * sizeof(size_t));
+    if(offsets == NULL) return -1;
+    carry->offsets = offsets;
+    carry->offsets_size = size;
+  }
+
+  size_t offsets_n = carry->offsets_n;
+  if(offsets_n == 0){
+    carry->offsets[0] = 0;
+    offsets_n = 1;
+  }
+  for(size_t i = 1; i < scan->offsets_n; i++){
+    carry->offsets[offsets_n] = carry_len + scan->offsets[i];
+    offsets_n++;
+  }
+  memcpy(s->carry_buf + carry_len, scan->buf, scan->size);
+  carry->buf = s->carry_buf;
+  carry->size = carry_len + scan->size;
+  carry->offsets_n = offsets_n;
+  return 0;
+}
+
+int linescan_stream_next(linescan_stream* s, const linescan** line){
+  LINESCAN_CHECK(s != NULL, -1)
+  LINESCAN_CHECK(line != NULL, -1)
+
+  if(s->carry_done){
+    linescan_reset(s->carry);
+    s->carry_done = 0;
+  }
+
+  for(;;){
+    if(s->eof) return 0;
+    if(!s->have_chunk){
+      linescan_chunk* chunk = linescan_stream_acquire(s);
+      if(chunk->error){
+	s->eof = 1;
+	return -1;
+      }
+      if(chunk->len == 0){
+	s->eof = 1;
+	if(s->carry->offsets_n == 0) return 0;
+	// Last line without newline
+	s->carry_done = 1;
+	*line = s->carry;
+	return 1;
+      }
+    }
+
+    linescan_chunk* chunk = &s->chunks[s->cur];
+    if(s->pos < chunk->len){
+      int rc = linescan_find(chunk->buf + s->pos, s->cmask, chunk->len - s->pos, s->scan);
+      s->pos += s->scan->size;
+      if(rc == 1 && s->carry->offsets_n == 0){
+	// Line within the chunk, no copy needed
+	*line = s->scan;
+	return 1;
+      }
+      if(linescan_stream_carry(s) != 0) return -1;
+      if(rc == 1){
+	s->carry_done = 1;
+	*line = s->carry;
+	return 1;
+      }
+    }
+    linescan_stream_release(s);
+  }
+}
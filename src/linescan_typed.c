@@ -0,0 +1,308 @@
+/* linescan - fast character and newline search in buffers
+   Copyright (C) 2020 Markus Schneider
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define _GNU_SOURCE
+
+#include <linescan_typed.h>
+#include "linescan_internal.h"
+
+// Longest field passed to strtod without allocating
+#define LINESCAN_STRTOD_BUF 128
+
+// Powers of ten which are exact doubles
+static const double linescan_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int linescan_is_digit(char c){
+  return (unsigned int)((unsigned char)c - '0') <= 9;
+}
+
+/* @returns 1 if all 8 characters of v are ASCII digits. */
+static inline int linescan_is_eight_digits(uint64_t v){
+  return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+	  (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+/* Value of 8 ASCII digits loaded in little-endian order: adjacent digits are
+   combined into pairs, pairs into quadruples and quadruples into the result. */
+static inline uint64_t linescan_parse_eight_digits(uint64_t v){
+  v -= 0x3030303030303030ULL;
+  v = v * 10 + (v >> 8);
+  return (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+	  (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+}
+
+/* Parses the digits in [*p, end) into *v, stopping at the first non-digit.
+   @returns 0 on success, -1 on overflow. */
+static inline int linescan_parse_digits(const char** p, const char* end, uint64_t* v){
+  const char* s = *p;
+  while(end - s >= 8){
+    uint64_t w;
+    memcpy(&w, s, 8);
+    if(!linescan_is_eight_digits(w)) break;
+    if(__builtin_mul_overflow(*v, 100000000, v) ||
+       __builtin_add_overflow(*v, linescan_parse_eight_digits(w), v)) return -1;
+    s += 8;
+  }
+  for(; s < end; s++){
+    unsigned int d = (unsigned char)*s - '0';
+    if(d > 9) break;
+    if(__builtin_mul_overflow(*v, 10, v) || __builtin_add_overflow(*v, d, v)) return -1;
+  }
+  *p = s;
+  return 0;
+}
+
+/* @returns 0 if [p, end) is an integer within range, -1 otherwise. */
+static int linescan_parse_int64(const char* p, const char* end, int64_t* value){
+  int neg = 0;
+  if(p < end && (*p == '-' || *p == '+')){
+    neg = *p == '-';
+    p++;
+  }
+  if(p == end) return -1;
+  uint64_t v = 0;
+  if(linescan_parse_digits(&p, end, &v) != 0 || p != end) return -1;
+  if(v > (uint64_t)INT64_MAX + neg) return -1;
+  *value = neg ? -(int64_t)(v - 1) - 1 : (int64_t)v;
+  return 0;
+}
+
+/* Parses [s, end) with strtod, which rounds correctly in all cases.
+   @returns 0 on success, -1 on error. */
+static int linescan_parse_strtod(const char* s, const char* end, double* value){
+  size_t len = (size_t)(end - s);
+  char local[LINESCAN_STRTOD_BUF];
+  char* copy = len < LINESCAN_STRTOD_BUF ? local : malloc(len + 1);
+  if(copy == NULL) return -1;
+  memcpy(copy, s, len);
+  copy[len] = 0;
+  char* stop;
+  *value = strtod(copy, &stop);
+  int rc = stop == copy + len ? 0 : -1;
+  if(copy != local) free(copy);
+  return rc;
+}
+
+/* Parses [p, end) as a decimal number. Up to 19 significant digits are
+   collected into an integer mantissa; if it is below 2^53 and the decimal
+   exponent is within the exact powers of ten, one multiplication or division
+   rounds correctly. @returns 0 on success, -1 if [p, end) is not a number. */
+static int linescan_parse_double(const char* p, const char* end, double* value){
+  const char* s = p;
+  int neg = 0;
+  if(p < end && (*p == '-' || *p == '+')){
+    neg = *p == '-';
+    p++;
+  }
+  uint64_t m = 0;
+  int digits = 0;
+  int digits_any = 0;
+  int truncated = 0;
+  int64_t e10 = 0;
+
+  for(; p < end && linescan_is_digit(*p); p++){
+    digits_any = 1;
+    if(digits < 19){
+      m = m * 10 + (unsigned char)(*p - '0');
+      digits += m != 0;
+    } else {
+      truncated = 1;
+      e10++;
+    }
+  }
+  if(p < end && *p == '.'){
+    for(p++; p < end && linescan_is_digit(*p); p++){
+      digits_any = 1;
+      if(digits < 19){
+	m = m * 10 + (unsigned char)(*p - '0');
+	digits += m != 0;
+	e10--;
+      } else {
+	truncated = 1;
+      }
+    }
+  }
+  if(!digits_any) return -1;
+  if(p < end && (*p == 'e' || *p == 'E')){
+    p++;
+    int e_neg = 0;
+    if(p < end && (*p == '-' || *p == '+')){
+      e_neg = *p == '-';
+      p++;
+    }
+    if(p == end || !linescan_is_digit(*p)) return -1;
+    int64_t e = 0;
+    for(; p < end && linescan_is_digit(*p); p++){
+      // Larger exponents over- or underflow anyway
+      if(e < 100000) e = e * 10 + (*p - '0');
+    }
+    e10 += e_neg ? -e : e;
+  }
+  if(p != end) return -1;
+
+  if(!truncated && m <= (1ULL << 53) && e10 >= -22 && e10 <= 22){
+    double d = (double)m;
+    d = e10 < 0 ? d / linescan_pow10[-e10] : d * linescan_pow10[e10];
+    *value = neg ? -d : d;
+    return 0;
+  }
+  return linescan_parse_strtod(s, end, value);
+}
+
+static inline void linescan_column_null(linescan_column* c, size_t row, int null){
+  uint64_t bit = 1ULL << (row % 64);
+  c->nulls[row / 64] = null ? c->nulls[row / 64] | bit : c->nulls[row / 64] & ~bit;
+}
+
+// Parses the field [start, end) of buf into column c.
+static inline void linescan_column_field(linescan_column* c, size_t row, const char* buf,
+					 size_t start, size_t end){
+  int null = 0;
+  switch(c->type){
+  case LINESCAN_INT64:
+    null = linescan_parse_int64(buf + start, buf + end, &c->ints[row]) != 0;
+    if(null) c->ints[row] = 0;
+    break;
+  case LINESCAN_DOUBLE:
+    null = linescan_parse_double(buf + start, buf + end, &c->doubles[row]) != 0;
+    if(null) c->doubles[row] = 0;
+    break;
+  case LINESCAN_STRING:
+    c->spans[2 * row] = start;
+    c->spans[2 * row + 1] = end;
+    null = start == end;
+    break;
+  case LINESCAN_SKIP:
+    return;
+  }
+  linescan_column_null(c, row, null);
+}
+
+/* Grows the column arrays to hold at least rows_size rows.
+   @returns 0 on success, -1 if memory could not be allocated. */
+static int linescan_table_grow(linescan_table* t, size_t rows_size){
+  for(size_t k = 0; k < t->columns_n; k++){
+    linescan_column* c = &t->columns[k];
+    if(c->type == LINESCAN_SKIP) continue;
+    void* values;
+    switch(c->type){
+    case LINESCAN_INT64:
+      values = realloc(c->ints, rows_size * sizeof(int64_t));
+      if(values == NULL) return -1;
+      c->ints = values;
+      break;
+    case LINESCAN_DOUBLE:
+      values = realloc(c->doubles, rows_size * sizeof(double));
+      if(values == NULL) return -1;
+      c->doubles = values;
+      break;
+    case LINESCAN_STRING:
+      values = realloc(c->spans, 2 * rows_size * sizeof(size_t));
+      if(values == NULL) return -1;
+      c->spans = values;
+      break;
+    default:
+      break;
+    }
+    uint64_t* nulls = realloc(c->nulls, (rows_size + 63) / 64 * sizeof(uint64_t));
+    if(nulls == NULL) return -1;
+    c->nulls = nulls;
+  }
+  t->rows_size = rows_size;
+  return 0;
+}
+
+linescan_table* linescan_table_create(const linescan_type* types, size_t columns_n, size_t rows_size){
+  LINESCAN_CHECK(types != NULL || columns_n == 0, NULL)
+  linescan_table* t = calloc(1, sizeof(linescan_table));
+  if(t == NULL) return NULL;
+  t->columns = calloc(columns_n + 1, sizeof(linescan_column));
+  if(t->columns == NULL){
+    free(t);
+    return NULL;
+  }
+  t->columns_n = columns_n;
+  for(size_t k = 0; k < columns_n; k++) t->columns[k].type = types[k];
+  if(linescan_table_grow(t, rows_size > 0 ? rows_size : 1) != 0){
+    linescan_table_free(t);
+    return NULL;
+  }
+  linescan_table_reset(t);
+  return t;
+}
+
+void linescan_table_free(linescan_table* t){
+  for(size_t k = 0; k < t->columns_n; k++){
+    free(t->columns[k].ints);
+    free(t->columns[k].doubles);
+    free(t->columns[k].spans);
+    free(t->columns[k].nulls);
+  }
+  free(t->columns);
+  free(t);
+}
+
+void linescan_table_reset(linescan_table* t){
+  t->buf = NULL;
+  t->size = 0;
+  t->rows_n = 0;
+}
+
+int linescan_scan_typed(const char* buf, uint64_t cmask, size_t n, linescan_table* t){
+  LINESCAN_CHECK(buf != NULL, -1)
+  LINESCAN_CHECK(t != NULL, -1)
+  linescan_column* columns = t->columns;
+  size_t columns_n = t->columns_n;
+  size_t rows_n = 0;
+  size_t field = 0;
+  size_t start = 0;
+
+  t->buf = buf;
+  t->size = 0;
+  for(size_t i = 0; i < n; i += 64){
+    size_t len = n - i < 64 ? n - i : 64;
+    uint64_t m_c;
+    uint64_t m_nl;
+    linescan_block_impl(buf + i, cmask, len, &m_c, &m_nl);
+
+    for(uint64_t m = m_c | m_nl; m != 0; m &= m - 1){
+      size_t pos = i + __builtin_ctzll(m);
+      if(field < columns_n) linescan_column_field(&columns[field], rows_n, buf, start, pos);
+      field++;
+      start = pos + 1;
+      if(!(m_nl & m & -m)) continue;
+
+      // Missing fields of the line
+      for(; field < columns_n; field++){
+	linescan_column_field(&columns[field], rows_n, buf, pos, pos);
+      }
+      rows_n++;
+      field = 0;
+      t->size = pos + 1;
+      if(rows_n == t->rows_size && linescan_table_grow(t, 2 * t->rows_size) != 0){
+	t->rows_n = rows_n;
+	return -1;
+      }
+    }
+  }
+  t->rows_n = rows_n;
+  return t->size == n;
+}
@@ -0,0 +1,201 @@
+#include <cxxtest/TestSuite.h>
+
+#include <linescan_fileindex.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+class LinescanFileindexTestSuite : public CxxTest::TestSuite {
+
+  uint64_t cmask = linescan_create_mask(',');
+  char path[32];
+  char index_path[32];
+
+public:
+
+  void setUp(){
+    strcpy(path,"/tmp/linescan_file_XXXXXX");
+    close(mkstemp(path));
+    strcpy(index_path,"/tmp/linescan_idx_XXXXXX");
+    close(mkstemp(index_path));
+    unlink(index_path);
+  }
+
+  void tearDown(){
+    unlink(path);
+    unlink(index_path);
+  }
+
+  void write_input(const std::string& text, const char* mode){
+    FILE* f = fopen(path,mode);
+    fwrite(text.data(),1,text.size(),f);
+    fclose(f);
+  }
+
+  std::string random_text(std::mt19937& rng, size_t n){
+    std::string text;
+    for(size_t i=0;i<n;i++){
+      unsigned int x = rng() % 128;
+      text.push_back(x < 6 ? ',' : (x < 9 ? '\n' : (char)(97 + x % 26)));
+    }
+    return text;
+  }
+
+  // Every complete line of text must be found in the index
+  void check_index(const std::string& text){
+    linescan* r = linescan_create(text.size() + 2);
+    linescan_fileindex* fi = linescan_fileindex_open(path,index_path);
+    TS_ASSERT(fi != NULL);
+    if(fi == NULL) return;
+    const linescan* line;
+    size_t pos = 0;
+    size_t k = 0;
+    while(linescan_find(text.data() + pos,cmask,text.size() - pos,r) == 1){
+      TS_ASSERT_EQUALS(pos,linescan_fileindex_offset(fi,k));
+      TS_ASSERT_EQUALS(1,linescan_fileindex_line(fi,k,&line));
+      TS_ASSERT_EQUALS(text.substr(pos,r->size),std::string(line->buf,line->size));
+      TS_ASSERT_EQUALS(std::vector<size_t>(r->offsets,r->offsets + r->offsets_n),
+		       std::vector<size_t>(line->offsets,line->offsets + line->offsets_n));
+      pos += r->size;
+      k++;
+    }
+    TS_ASSERT_EQUALS(k,linescan_fileindex_lines(fi));
+    TS_ASSERT_EQUALS(SIZE_MAX,linescan_fileindex_offset(fi,k));
+    TS_ASSERT_EQUALS(0,linescan_fileindex_line(fi,k,&line));
+    linescan_fileindex_close(fi);
+    linescan_free(r);
+  }
+
+  void test_linescan_fileindex(){
+    write_input("a,b,c\nd,e\n\nlast,line","w");
+    TS_ASSERT_EQUALS(0,linescan_fileindex_update(path,index_path,cmask,LINESCAN_FILEINDEX_FIELDS));
+    check_index("a,b,c\nd,e\n\nlast,line");
+
+    // The incomplete last line is indexed once it ends
+    write_input(",x\nmore\n","a");
+    TS_ASSERT_EQUALS(0,linescan_fileindex_update(path,index_path,cmask,LINESCAN_FILEINDEX_FIELDS));
+    check_index("a,b,c\nd,e\n\nlast,line,x\nmore\n");
+
+    write_input("","w");
+    TS_ASSERT(linescan_fileindex_open(path,index_path) == NULL);
+    TS_ASSERT_EQUALS(ESTALE,errno);
+    TS_ASSERT_EQUALS(0,linescan_fileindex_update(path,index_path,cmask,0));
+    check_index("");
+  }
+
+  void test_linescan_fileindex_append(){
+    std::mt19937 rng(10);
+    for(int flags=0;flags<=LINESCAN_FILEINDEX_FIELDS;flags++){
+      std::string text;
+      write_input(text,"w");
+      unlink(index_path);
+      for(int round=0;round<6;round++){
+	std::string tail = random_text(rng,rng() % 40000);
+	text += tail;
+	write_input(tail,"a");
+	TS_ASSERT_EQUALS(0,linescan_fileindex_update(path,index_path,cmask,flags));
+	check_index(text);
+      }
+      struct stat st;
+      stat(index_path,&st);
+      // Varints take much less space than offsets
+      TS_ASSERT((size_t)st.st_size < text.size() / 2);
+    }
+  }
+
+  void test_linescan_fileindex_rewrite(){
+    std::mt19937 rng(11);
+    std::string text = random_text(rng,10000);
+    write_input(text,"w");
+    TS_ASSERT_EQUALS(0,linescan_fileindex_update(path,index_path,cmask,LINESCAN_FILEINDEX_FIELDS));
+
+    // Same size, different content close to the end: the index is rebuilt
+    text[9000] = text[9000] == '\n' ? 'a' : '\n';
+    write_input(text,"w");
+    TS_ASSERT(linescan_fileindex_open(path,index_path) == NULL);
+    TS_ASSERT_EQUALS(0,linescan_fileindex_update(path,index_path,cmask,LINESCAN_FILEINDEX_FIELDS));
+    check_index(text);
+
+    // Other flags rebuild the index as well
+    TS_ASSERT_EQUALS(0,linescan_fileindex_update(path,index_path,cmask,0));
+    check_index(text);
+  }
+
+  void test_linescan_fileindex_corrupt(){
+    // Lookups must fail with EINVAL instead of decoding past a block or the mapping
+    std::mt19937 rng(12);
+    std::string text = random_text(rng,10000);
+    write_input(text,"w");
+    // Header: magic and 9 fields; data_end and dir_offset are the last two
+    uint64_t data_end;
+    uint64_t dir_offset;
+    uint64_t dir[4];
+    int fd = -1;
+    auto rebuild = [&]{
+      if(fd >= 0) close(fd);
+      unlink(index_path);
+      TS_ASSERT_EQUALS(0,linescan_fileindex_update(path,index_path,cmask,LINESCAN_FILEINDEX_FIELDS));
+      fd = open(index_path,O_RDWR);
+      TS_ASSERT_EQUALS(8,pread(fd,&data_end,8,64));
+      TS_ASSERT_EQUALS(8,pread(fd,&dir_offset,8,72));
+      TS_ASSERT_EQUALS(32,pread(fd,dir,32,dir_offset));
+    };
+    rebuild();
+    const linescan* line;
+    linescan_fileindex* fi = linescan_fileindex_open(path,index_path);
+    TS_ASSERT(linescan_fileindex_lines(fi) > 200);
+    linescan_fileindex_close(fi);
+
+    // Continuation bits on every byte of the first line
+    std::string ones(16,'\xff');
+    TS_ASSERT_EQUALS(16,pwrite(fd,ones.data(),16,dir[1]));
+    fi = linescan_fileindex_open(path,index_path);
+    TS_ASSERT_EQUALS(-1,linescan_fileindex_line(fi,0,&line));
+    TS_ASSERT_EQUALS(EINVAL,errno);
+    TS_ASSERT_EQUALS(SIZE_MAX,linescan_fileindex_offset(fi,1));
+    TS_ASSERT_EQUALS(EINVAL,errno);
+    // The second block is intact
+    TS_ASSERT_EQUALS(1,linescan_fileindex_line(fi,200,&line));
+    linescan_fileindex_close(fi);
+
+    // The first block ends after 5 bytes
+    rebuild();
+    uint64_t cut[2] = {dir[2],dir[1] + 5};
+    TS_ASSERT_EQUALS(16,pwrite(fd,cut,16,dir_offset + 16));
+    fi = linescan_fileindex_open(path,index_path);
+    TS_ASSERT_EQUALS(-1,linescan_fileindex_line(fi,100,&line));
+    TS_ASSERT_EQUALS(EINVAL,errno);
+    TS_ASSERT_EQUALS(SIZE_MAX,linescan_fileindex_offset(fi,127));
+    linescan_fileindex_close(fi);
+
+    // A block behind the end of the data
+    rebuild();
+    uint64_t behind[2] = {dir[2],data_end + 1};
+    TS_ASSERT_EQUALS(16,pwrite(fd,behind,16,dir_offset + 16));
+    fi = linescan_fileindex_open(path,index_path);
+    TS_ASSERT_EQUALS(-1,linescan_fileindex_line(fi,0,&line));
+    TS_ASSERT_EQUALS(-1,linescan_fileindex_line(fi,200,&line));
+    TS_ASSERT_EQUALS(EINVAL,errno);
+    linescan_fileindex_close(fi);
+
+    // A directory behind the end of the index file
+    uint64_t far = ~(uint64_t)0 - 8;
+    TS_ASSERT_EQUALS(8,pwrite(fd,&far,8,72));
+    TS_ASSERT(linescan_fileindex_open(path,index_path) == NULL);
+    TS_ASSERT_EQUALS(EINVAL,errno);
+    close(fd);
+  }
+
+  void test_linescan_fileindex_error(){
+    TS_ASSERT_EQUALS(-1,linescan_fileindex_update("/nonexistent/linescan",index_path,cmask,0));
+    TS_ASSERT(linescan_fileindex_open(path,"/nonexistent/linescan") == NULL);
+    // Not an index
+    write_input("a,b\n","w");
+    TS_ASSERT(linescan_fileindex_open(path,path) == NULL);
+    TS_ASSERT_EQUALS(EINVAL,errno);
+  }
+
+};
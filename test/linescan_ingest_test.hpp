@@ -0,0 +1,160 @@
+#include <cxxtest/TestSuite.h>
+
+#include <linescan_ingest.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <unistd.h>
+
+class LinescanIngestTestSuite : public CxxTest::TestSuite {
+
+  uint64_t cmask = linescan_create_mask(',');
+  std::vector<std::string> paths;
+
+  typedef std::pair<std::string,std::vector<size_t>> line_t;
+
+public:
+
+  void tearDown(){
+    for(const std::string& path : paths) unlink(path.c_str());
+    paths.clear();
+  }
+
+  std::string write_input(const std::string& text){
+    char path[32];
+    strcpy(path,"/tmp/linescan_ingest_XXXXXX");
+    int fd = mkstemp(path);
+    TS_ASSERT_EQUALS((ssize_t)text.size(),write(fd,text.data(),text.size()));
+    close(fd);
+    paths.push_back(path);
+    return path;
+  }
+
+  std::string random_text(std::mt19937& rng, size_t n){
+    std::string text;
+    for(size_t i=0;i<n;i++){
+      unsigned int x = rng() % 512;
+      text.push_back(x < 24 ? ',' : (x < 26 ? '\n' : (char)(97 + x % 26)));
+    }
+    return text;
+  }
+
+  // Lines of text with offsets relative to the line start, as linescan_find reports them
+  std::vector<line_t> split(const std::string& text){
+    std::vector<line_t> lines;
+    linescan* r = linescan_create(text.size() + 2);
+    for(size_t pos=0;pos<text.size();pos += r->size){
+      linescan_find(text.data() + pos,cmask,text.size() - pos,r);
+      lines.push_back(line_t(text.substr(pos,r->size),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n)));
+    }
+    linescan_free(r);
+    return lines;
+  }
+
+  void check_ingest(size_t buffers, size_t buffer_size, int flags, const std::vector<std::string>& texts){
+    linescan_ingest* in = linescan_ingest_create(buffers,buffer_size,cmask,flags);
+    TS_ASSERT(in != NULL);
+    if(in == NULL) return;
+    for(size_t f=0;f<texts.size();f++){
+      TS_ASSERT_EQUALS((int)f,linescan_ingest_add(in,write_input(texts[f]).c_str()));
+    }
+
+    std::vector<std::vector<line_t>> lines(texts.size());
+    std::vector<size_t> offsets(texts.size(),0);
+    const linescan_ingest_chunk* chunk;
+    int rc;
+    while((rc = linescan_ingest_next(in,&chunk)) == 1){
+      TS_ASSERT(chunk->file < texts.size());
+      // Buffers of one file arrive in order
+      TS_ASSERT_EQUALS(offsets[chunk->file],chunk->offset);
+      TS_ASSERT_EQUALS(texts[chunk->file].substr(chunk->offset,chunk->len),std::string(chunk->buf,chunk->len));
+      offsets[chunk->file] += chunk->len;
+      std::vector<line_t>& file_lines = lines[chunk->file];
+      if(chunk->head != NULL){
+	const linescan* h = chunk->head;
+	file_lines.push_back(line_t(std::string(h->buf,h->size),std::vector<size_t>(h->offsets,h->offsets + h->offsets_n)));
+      }
+      const linescan_index* index = chunk->index;
+      for(size_t i=0;i<index->lines_n;i++){
+	const size_t* o = index->offsets + index->lines[i];
+	size_t o_n = index->lines[i+1] - index->lines[i];
+	std::vector<size_t> rel;
+	for(size_t j=0;j<o_n;j++) rel.push_back(o[j] - o[0]);
+	file_lines.push_back(line_t(std::string(index->buf + o[0],o[o_n-1] - o[0] + 1),rel));
+      }
+    }
+    TS_ASSERT_EQUALS(0,rc);
+    for(size_t f=0;f<texts.size();f++){
+      TS_ASSERT_EQUALS(texts[f].size(),offsets[f]);
+      TS_ASSERT(split(texts[f]) == lines[f]);
+    }
+    linescan_ingest_free(in);
+  }
+
+  void test_linescan_ingest(){
+    std::vector<std::string> texts = {"a,b,c\nd,e\n\nlast,line","",",\n,\n","no newline"};
+    check_ingest(2,4096,0,texts);
+    check_ingest(1,4096,LINESCAN_INGEST_PREAD,texts);
+  }
+
+  void test_linescan_ingest_random(){
+    std::mt19937 rng(12);
+    for(int flags : {0,LINESCAN_INGEST_PREAD,LINESCAN_INGEST_DIRECT,LINESCAN_INGEST_DIRECT | LINESCAN_INGEST_PREAD}){
+      for(int round=0;round<4;round++){
+	std::vector<std::string> texts;
+	size_t files_n = 1 + rng() % 5;
+	for(size_t f=0;f<files_n;f++) texts.push_back(random_text(rng,rng() % 60000));
+	// Lines longer than a buffer
+	texts.push_back(std::string(20000,'x') + "," + std::string(10000,'y') + "\nz");
+	check_ingest(1 + rng() % 8,4096 * (1 + rng() % 3),flags,texts);
+      }
+    }
+  }
+
+  void test_linescan_ingest_free_reading(){
+    // Free while reads are in flight
+    std::mt19937 rng(5);
+    std::string path = write_input(random_text(rng,1 << 20));
+    for(int flags : {0,LINESCAN_INGEST_PREAD,LINESCAN_INGEST_DIRECT}){
+      linescan_ingest* in = linescan_ingest_create(8,4096,cmask,flags);
+      TS_ASSERT_EQUALS(0,linescan_ingest_add(in,path.c_str()));
+      const linescan_ingest_chunk* chunk;
+      TS_ASSERT_EQUALS(1,linescan_ingest_next(in,&chunk));
+      linescan_ingest_free(in);
+    }
+  }
+
+  void test_linescan_ingest_truncated(){
+    // The file shrinks after it was added: the error sticks instead of ending the data
+    std::mt19937 rng(7);
+    for(int flags : {0,LINESCAN_INGEST_PREAD}){
+      std::string path = write_input(random_text(rng,64 * 1024));
+      linescan_ingest* in = linescan_ingest_create(2,4096,cmask,flags);
+      TS_ASSERT_EQUALS(0,linescan_ingest_add(in,path.c_str()));
+      TS_ASSERT_EQUALS(0,truncate(path.c_str(),10000));
+      const linescan_ingest_chunk* chunk;
+      int rc;
+      size_t chunks_n = 0;
+      while((rc = linescan_ingest_next(in,&chunk)) == 1) chunks_n++;
+      TS_ASSERT_EQUALS(-1,rc);
+      TS_ASSERT_EQUALS(EIO,errno);
+      TS_ASSERT_EQUALS(2u,chunks_n);
+      TS_ASSERT_EQUALS(-1,linescan_ingest_next(in,&chunk));
+      TS_ASSERT_EQUALS(-1,linescan_ingest_next(in,&chunk));
+      linescan_ingest_free(in);
+    }
+  }
+
+  void test_linescan_ingest_error(){
+    linescan_ingest* in = linescan_ingest_create(4,4096,cmask,0);
+    TS_ASSERT_EQUALS(-1,linescan_ingest_add(in,"/nonexistent/linescan"));
+    const linescan_ingest_chunk* chunk;
+    TS_ASSERT_EQUALS(0,linescan_ingest_next(in,&chunk));
+    linescan_ingest_free(in);
+
+    in = linescan_ingest_create(4,4096,cmask,LINESCAN_INGEST_PREAD);
+    TS_ASSERT_EQUALS(0,linescan_ingest_uring(in));
+    linescan_ingest_free(in);
+  }
+
+};
@@ -0,0 +1,115 @@
+#include <cxxtest/TestSuite.h>
+
+#include <linescan_mmap.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <unistd.h>
+#include <sys/mman.h>
+
+class LinescanMmapTestSuite : public CxxTest::TestSuite {
+
+  uint64_t cmask = linescan_create_mask(',');
+  char path[32];
+
+public:
+
+  void setUp(){
+    strcpy(path,"/tmp/linescan_mmap_XXXXXX");
+    close(mkstemp(path));
+  }
+
+  void tearDown(){
+    unlink(path);
+  }
+
+  void write_input(const std::string& text){
+    FILE* f = fopen(path,"w");
+    fwrite(text.data(),1,text.size(),f);
+    fclose(f);
+  }
+
+  void check_mmap(const std::string& text, size_t window_size, int flags){
+    write_input(text);
+    linescan* r = linescan_create(text.size() + 2);
+    linescan_mmap* m = linescan_mmap_open(path,cmask,window_size,flags);
+    TS_ASSERT(m != NULL);
+    const linescan* line;
+    size_t pos = 0;
+    int rc;
+    while((rc = linescan_mmap_next(m,&line)) == 1){
+      TS_ASSERT(pos < text.size());
+      if(pos >= text.size()) break;
+      int rc_expected = linescan_find(text.data() + pos,cmask,text.size() - pos,r);
+      TS_ASSERT_EQUALS(rc_expected,line->buf[line->size-1] == '\n');
+      TS_ASSERT_EQUALS(text.substr(pos,r->size),std::string(line->buf,line->size));
+      TS_ASSERT_EQUALS(std::vector<size_t>(r->offsets,r->offsets + r->offsets_n),
+		       std::vector<size_t>(line->offsets,line->offsets + line->offsets_n));
+      pos += r->size;
+      TS_ASSERT_EQUALS(pos,linescan_mmap_tell(m));
+    }
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(text.size(),pos);
+    TS_ASSERT_EQUALS(0,linescan_mmap_next(m,&line));
+    linescan_mmap_close(m);
+    linescan_free(r);
+  }
+
+  void test_linescan_mmap(){
+    check_mmap("a,b,c\nd,e\n\nlast,line",0,0);
+    check_mmap("",0,0);
+    check_mmap("no newline",4096,LINESCAN_MMAP_POPULATE);
+  }
+
+  void test_linescan_mmap_windows(){
+    std::mt19937 rng(9);
+    std::string text;
+    for(size_t i=0;i<300000;i++){
+      unsigned int x = rng() % 128;
+      text.push_back(x < 6 ? ',' : (x < 7 ? '\n' : (char)(97 + x % 26)));
+    }
+    // Lines longer than a window and longer than a search step
+    text.insert(5000,std::string(20000,'x'));
+    text.insert(100000,std::string(150000,','));
+    check_mmap(text,4096,0);
+    check_mmap(text,1 << 16,LINESCAN_MMAP_POPULATE | LINESCAN_MMAP_HUGEPAGES);
+    check_mmap(text,0,0);
+  }
+
+  void test_linescan_mmap_error(){
+    TS_ASSERT(linescan_mmap_open("/nonexistent/linescan",cmask,0,0) == NULL);
+  }
+
+  void test_linescan_kernels_mapping_end(){
+    // Kernels must not read into the page behind the buffer, even if it does not end
+    // on a word or vector boundary. The page behind the buffer is inaccessible.
+    size_t page = sysconf(_SC_PAGESIZE);
+    char* map = (char*)mmap(NULL,2 * page,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    TS_ASSERT(map != MAP_FAILED);
+    mprotect(map + page,page,PROT_NONE);
+    memset(map,'a',page);
+    linescan* r = linescan_create(page + 2);
+    linescan_index* index = linescan_index_create(page + 2,page + 2);
+    linescan_bitmap* bm = linescan_bitmap_create(page);
+    linescan_bounded* br = linescan_bounded_create(page + 2,LINESCAN_WIDTH_32,NULL);
+
+    for(int k=LINESCAN_KERNEL_SWAR;k<LINESCAN_KERNEL_N;k++){
+      if(linescan_set_kernel((linescan_kernel)k) != 0) continue;
+      for(size_t n=0;n<200;n++){
+	const char* buf = map + page - n;
+	TS_ASSERT_EQUALS(0,linescan_find(buf,cmask,n,r));
+	TS_ASSERT_EQUALS(0,linescan_rfind(buf,cmask,n,r));
+	TS_ASSERT_EQUALS(n == 0,linescan_find_all(buf,cmask,n,index));
+	TS_ASSERT_EQUALS(0,linescan_find_bitmap(buf,cmask,n,bm));
+	TS_ASSERT_EQUALS(0,linescan_find_bounded(buf,cmask,n,br));
+      }
+    }
+    linescan_set_kernel(LINESCAN_KERNEL_AUTO);
+    linescan_free(r);
+    linescan_index_free(index);
+    linescan_bitmap_free(bm);
+    linescan_bounded_free(br);
+    munmap(map,2 * page);
+  }
+
+};
@@ -0,0 +1,76 @@
+#include <cxxtest/TestSuite.h>
+
+#include <linescan_parallel.h>
+#include <string>
+#include <vector>
+#include <random>
+
+class LinescanParallelTestSuite : public CxxTest::TestSuite {
+
+  uint64_t cmask = linescan_create_mask(',');
+
+public:
+
+  // Chunk indexes must add up to the index of the whole buffer
+  void check_parallel(linescan_pool* pool, const std::string& text, size_t chunk_size){
+    linescan_index* expected = linescan_index_create(16,16);
+    int rc_expected = linescan_find_all(text.data(),cmask,text.size(),expected);
+    linescan_parallel* result = linescan_parallel_create();
+    int rc = linescan_parallel_find_all(pool,text.data(),cmask,text.size(),chunk_size,result);
+    TS_ASSERT_EQUALS(rc_expected,rc);
+    TS_ASSERT_EQUALS(text.data(),result->buf);
+    TS_ASSERT_EQUALS(expected->size,result->size);
+    TS_ASSERT_EQUALS(expected->lines_n,linescan_parallel_lines(result));
+
+    std::vector<size_t> offsets;
+    std::vector<size_t> lines;
+    for(size_t i=0;i<result->chunks_n;i++){
+      linescan_index* index = result->indexes[i];
+      if(i > 0) TS_ASSERT(result->starts[i] >= result->starts[i-1]);
+      TS_ASSERT(result->starts[i] == 0 || text[result->starts[i] - 1] == '\n');
+      for(size_t j=0;j<index->lines_n;j++) lines.push_back(offsets.size() + index->lines[j]);
+      for(size_t j=0;j<index->offsets_n;j++) offsets.push_back(result->starts[i] + index->offsets[j]);
+    }
+    lines.push_back(offsets.size());
+    TS_ASSERT_EQUALS(std::vector<size_t>(expected->offsets,expected->offsets + expected->offsets_n),offsets);
+    TS_ASSERT_EQUALS(std::vector<size_t>(expected->lines,expected->lines + expected->lines_n + 1),lines);
+    linescan_parallel_free(result);
+    linescan_index_free(expected);
+  }
+
+  void test_linescan_parallel(){
+    std::mt19937 rng(13);
+    std::string text;
+    for(size_t i=0;i<200000;i++){
+      unsigned int x = rng() % 128;
+      text.push_back(x < 8 ? ',' : (x < 9 ? '\n' : (char)(97 + x % 26)));
+    }
+    // Line spanning several chunks
+    text.insert(1000,std::string(5000,'y'));
+
+    for(size_t threads : {1,2,5}){
+      linescan_pool* pool = linescan_pool_create(threads);
+      TS_ASSERT_EQUALS(threads,linescan_pool_threads(pool));
+      check_parallel(pool,text,1000);
+      check_parallel(pool,text,0);
+      check_parallel(pool,text + "\n",777);
+      check_parallel(pool,"",0);
+      check_parallel(pool,"\n\n",1);
+      linescan_pool_free(pool);
+    }
+  }
+
+  void test_linescan_parallel_reuse(){
+    // Results and pools can be reused
+    linescan_pool* pool = linescan_pool_create(3);
+    linescan_parallel* result = linescan_parallel_create();
+    std::string text = "a,b\nc\n";
+    for(int i=0;i<100;i++){
+      TS_ASSERT_EQUALS(1,linescan_parallel_find_all(pool,text.data(),cmask,text.size(),1 + i % 4,result));
+      TS_ASSERT_EQUALS(2,linescan_parallel_lines(result));
+    }
+    linescan_parallel_free(result);
+    linescan_pool_free(pool);
+  }
+
+};
@@ -0,0 +1,89 @@
+#include <cxxtest/TestSuite.h>
+
+#include <linescan_reverse.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <unistd.h>
+
+class LinescanReverseTestSuite : public CxxTest::TestSuite {
+
+  uint64_t cmask = linescan_create_mask(',');
+  char path[32];
+
+public:
+
+  void setUp(){
+    strcpy(path,"/tmp/linescan_reverse_XXXXXX");
+    close(mkstemp(path));
+  }
+
+  void tearDown(){
+    unlink(path);
+  }
+
+  void write_input(const std::string& text){
+    FILE* f = fopen(path,"w");
+    fwrite(text.data(),1,text.size(),f);
+    fclose(f);
+  }
+
+  // Lines must be handed out as linescan_find reports them, in reverse order
+  void check_reverse(linescan_reverse* rev, const std::string& text){
+    TS_ASSERT(rev != NULL);
+    if(rev == NULL) return;
+    std::vector<size_t> starts;
+    for(size_t pos=0;pos<text.size();pos = text.find('\n',pos) == std::string::npos ? text.size() : text.find('\n',pos) + 1){
+      starts.push_back(pos);
+    }
+    linescan* r = linescan_create(text.size() + 2);
+    const linescan* line;
+    for(size_t k=starts.size();k-->0;){
+      TS_ASSERT_EQUALS(1,linescan_reverse_next(rev,&line));
+      size_t end = k + 1 < starts.size() ? starts[k+1] : text.size();
+      linescan_find(text.data() + starts[k],cmask,end - starts[k],r);
+      TS_ASSERT_EQUALS(text.substr(starts[k],end - starts[k]),std::string(line->buf,line->size));
+      TS_ASSERT_EQUALS(std::vector<size_t>(r->offsets,r->offsets + r->offsets_n),
+		       std::vector<size_t>(line->offsets,line->offsets + line->offsets_n));
+      TS_ASSERT_EQUALS(starts[k],linescan_reverse_tell(rev));
+    }
+    TS_ASSERT_EQUALS(0,linescan_reverse_next(rev,&line));
+    linescan_reverse_free(rev);
+    linescan_free(r);
+  }
+
+  void check_file(const std::string& text, size_t window_size){
+    write_input(text);
+    check_reverse(linescan_reverse_open(path,cmask,window_size),text);
+  }
+
+  void test_linescan_reverse(){
+    check_file("a,b,c\nd,e\n\nlast,line",0);
+    check_file("a,b,c\nd,e\n\nlast,line\n",0);
+    check_file("",0);
+    check_file("\n\n",4096);
+    std::string text = "x,y\n,\nz";
+    check_reverse(linescan_reverse_create(text.data(),text.size(),cmask),text);
+  }
+
+  void test_linescan_reverse_windows(){
+    std::mt19937 rng(12);
+    std::string text;
+    for(size_t i=0;i<300000;i++){
+      unsigned int x = rng() % 128;
+      text.push_back(x < 6 ? ',' : (x < 7 ? '\n' : (char)(97 + x % 26)));
+    }
+    // Lines longer than a window and longer than a search step
+    text.insert(5000,std::string(20000,'x'));
+    text.insert(100000,std::string(150000,','));
+    check_file(text,4096);
+    check_file(text,1 << 16);
+    check_file(text,0);
+    check_reverse(linescan_reverse_create(text.data(),text.size(),cmask),text);
+  }
+
+  void test_linescan_reverse_error(){
+    TS_ASSERT(linescan_reverse_open("/nonexistent/linescan",cmask,0) == NULL);
+  }
+
+};
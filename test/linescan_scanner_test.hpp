@@ -0,0 +1,81 @@
+#include <cxxtest/TestSuite.h>
+
+#include <linescan.hpp>
+#include <string>
+#include <vector>
+#include <random>
+
+class LinescanScannerTestSuite : public CxxTest::TestSuite {
+
+public:
+
+  void test_linescan_scanner_find(){
+    std::string text = "ab,,cde,f\nnext,line";
+    linescanpp::line<8> l;
+    TS_ASSERT(linescanpp::scanner<','>::find(text, l));
+    TS_ASSERT(l.terminated());
+    TS_ASSERT_EQUALS(std::string_view("ab,,cde,f\n"),l.text());
+    TS_ASSERT_EQUALS(4u,l.size());
+    TS_ASSERT_EQUALS(std::string_view("ab"),l[0]);
+    TS_ASSERT_EQUALS(std::string_view(""),l[1]);
+    TS_ASSERT_EQUALS(std::string_view("cde"),l[2]);
+    TS_ASSERT_EQUALS(std::string_view("f"),l[3]);
+
+    std::string_view rest = std::string_view(text).substr(l.text().size());
+    TS_ASSERT(!linescanpp::scanner<','>::find(rest, l));
+    TS_ASSERT_EQUALS(rest,l.text());
+    TS_ASSERT_EQUALS(2u,l.size());
+    TS_ASSERT_EQUALS(std::string_view("line"),l[1]);
+
+    // Fields beyond the capacity are counted only
+    linescanpp::line<2> small;
+    linescanpp::scanner<','>::find(text, small);
+    TS_ASSERT_EQUALS(4u,small.size());
+    TS_ASSERT_EQUALS(2u,small.stored());
+    TS_ASSERT_EQUALS(2,small.end() - small.begin());
+
+    constexpr uint64_t semicolons = linescanpp::scanner<';','\r'>::delim_mask;
+    static_assert(semicolons == 0x3b3b3b3b3b3b3b3bull, "constexpr mask");
+    linescanpp::line<4> tab;
+    bool found = linescanpp::scanner<'\t','\0'>::find(std::string_view("x\ty\0z",5),tab);
+    TS_ASSERT(found);
+    TS_ASSERT_EQUALS(2u,tab.size());
+    TS_ASSERT_EQUALS(std::string_view("y"),tab[1]);
+  }
+
+  // Fields must match a byte by byte split
+  void test_linescan_scanner_differential(){
+    std::mt19937 rng(10);
+    const char alphabet[] = "a,\n";
+    for(int iter=0;iter<300;iter++){
+      std::string text(rng() % 300, 'a');
+      for(char& c : text) c = alphabet[rng() % (iter % 2 ? 3 : 2)];
+
+      std::vector<std::string_view> expected;
+      size_t lines = 0;
+      size_t start = 0;
+      size_t line_start = 0;
+      for(size_t i=0;i<=text.size();i++){
+	// Text after the last newline forms a line only if it is not empty
+	if(i == text.size() && line_start == i) break;
+	if(i == text.size() || text[i] == ',' || text[i] == '\n'){
+	  expected.push_back(std::string_view(text.data() + start, i - start));
+	  start = i + 1;
+	  if(i == text.size() || text[i] == '\n'){
+	    line_start = i + 1;
+	    lines++;
+	  }
+	}
+      }
+
+      std::vector<std::string_view> fields;
+      auto collect = [&](const linescanpp::line<512>& l){
+	for(auto f : l) fields.push_back(f);
+      };
+      size_t n = linescanpp::scanner<','>::for_each_line<512>(text, collect);
+      TS_ASSERT_EQUALS(lines,n);
+      TS_ASSERT_EQUALS(expected,fields);
+    }
+  }
+
+};
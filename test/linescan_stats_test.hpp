@@ -0,0 +1,170 @@
+#include <cxxtest/TestSuite.h>
+
+#include <linescan_stats.h>
+#include <string>
+#include <thread>
+
+class LinescanStatsTestSuite : public CxxTest::TestSuite {
+
+  uint64_t cmask = linescan_create_mask(',');
+
+public:
+
+  void setUp(){
+    linescan_stats_reset();
+  }
+
+  void tearDown(){
+    linescan_stats_cycles(0);
+    linescan_set_kernel(LINESCAN_KERNEL_AUTO);
+  }
+
+  void test_linescan_stats_disabled(){
+    if(linescan_stats_enabled()) return;
+    linescan* r = linescan_create(16);
+    std::string text = "a,b\nc";
+    linescan_find(text.data(),cmask,text.size(),r);
+    linescan_stats s;
+    linescan_stats_total(&s);
+    TS_ASSERT_EQUALS(0u,s.calls);
+    TS_ASSERT_EQUALS(0u,s.lines);
+    TS_ASSERT_EQUALS(0u,s.bytes_body);
+    linescan_free(r);
+  }
+
+  /* Every compared character is counted in exactly one phase. The whole word
+     or vector containing the newline may be compared. */
+  void check_phases(size_t size, const linescan_stats& s){
+    size_t compared = s.bytes_head+s.bytes_body+s.bytes_tail;
+    TS_ASSERT(compared >= size);
+    TS_ASSERT(compared < size + 64);
+  }
+
+  void test_linescan_stats_phases(){
+    if(!linescan_stats_enabled()) return;
+    std::string text = std::string(37,'a') + ",b,c" + std::string(70,'d') + "\n" + std::string(100,'e');
+    linescan* r = linescan_create(16);
+    linescan_index* index = linescan_index_create(16,16);
+    for(int k=LINESCAN_KERNEL_SWAR;k<LINESCAN_KERNEL_N;k++){
+      if(linescan_set_kernel((linescan_kernel)k) != 0) continue;
+      for(size_t start=0;start<8;start++){
+	linescan_stats_reset();
+	linescan_stats s;
+	linescan_find(text.data()+start,cmask,text.size()-start,r);
+	linescan_stats_thread(&s);
+	TS_ASSERT_EQUALS(1u,s.calls);
+	check_phases(r->size,s);
+	TS_ASSERT_EQUALS(1u,s.lines);
+	if(k != LINESCAN_KERNEL_SWAR) TS_ASSERT_EQUALS(0u,s.bytes_head);
+
+	linescan_stats_reset();
+	linescan_rfind(text.data()+start,cmask,text.size()-start,r);
+	linescan_stats_thread(&s);
+	check_phases(r->size,s);
+
+	linescan_stats_reset();
+	linescan_find_all(text.data()+start,cmask,text.size()-start,index);
+	linescan_stats_thread(&s);
+	TS_ASSERT_EQUALS(text.size()-start,s.bytes_head+s.bytes_body+s.bytes_tail);
+	TS_ASSERT_EQUALS(1u,s.lines);
+      }
+    }
+    // The portable kernel searches words with delimiters again
+    linescan_set_kernel(LINESCAN_KERNEL_SWAR);
+    linescan_stats_reset();
+    linescan_stats s;
+    linescan_find(text.data(),cmask,text.size(),r);
+    linescan_stats_thread(&s);
+    TS_ASSERT(s.slow_words > 0);
+    linescan_index_free(index);
+    linescan_free(r);
+  }
+
+  void test_linescan_stats_lines(){
+    if(!linescan_stats_enabled()) return;
+    std::string text = "\na,b\n" + std::string(99,'x') + "\nrest";
+    linescan_index* index = linescan_index_create(16,16);
+    linescan_find_all(text.data(),cmask,text.size(),index);
+    linescan_stats s;
+    linescan_stats_thread(&s);
+    TS_ASSERT_EQUALS(3u,s.lines);
+    TS_ASSERT_EQUALS(1u,s.line_lengths[1]);
+    TS_ASSERT_EQUALS(1u,s.line_lengths[3]);
+    TS_ASSERT_EQUALS(1u,s.line_lengths[7]);
+    linescan_index_free(index);
+  }
+
+  void test_linescan_stats_adaptive(){
+    if(!linescan_stats_enabled()) return;
+    std::string text = std::string(300,'x') + "\n";
+    linescan* r = linescan_create(16);
+    linescan_adaptive a;
+    linescan_adaptive_init(&a);
+    for(int i=0;i<1000;i++) linescan_find_adaptive(text.data(),cmask,text.size(),r,&a);
+    linescan_stats s;
+    linescan_stats_thread(&s);
+    TS_ASSERT_EQUALS(1000u,s.calls);
+    // Every supported kernel runs one trial window of 64 calls, the rest runs on the chosen one
+    uint64_t trials = 0;
+    for(int k=LINESCAN_KERNEL_SWAR;k<LINESCAN_KERNEL_N;k++){
+      if(!linescan_kernel_supported((linescan_kernel)k)) continue;
+      trials += 64;
+      if(k != a.kernel) TS_ASSERT_EQUALS(64u,s.adaptive_kernels[k]);
+    }
+    TS_ASSERT_EQUALS(1000u - trials + 64,s.adaptive_kernels[a.kernel]);
+    TS_ASSERT(s.adaptive_switches <= 1);
+
+    // A pinned kernel runs every call
+    linescan_stats_reset();
+    linescan_set_kernel(LINESCAN_KERNEL_SWAR);
+    for(int i=0;i<100;i++) linescan_find_adaptive(text.data(),cmask,text.size(),r,&a);
+    linescan_stats_thread(&s);
+    TS_ASSERT_EQUALS(100u,s.adaptive_kernels[LINESCAN_KERNEL_SWAR]);
+    TS_ASSERT_EQUALS(0u,s.adaptive_switches);
+    linescan_free(r);
+  }
+
+  // Counters of other threads, running or exited, add up in the total
+  void test_linescan_stats_total(){
+    if(!linescan_stats_enabled()) return;
+    std::string text = "a,b\nc,d\n";
+    std::thread worker([&](){
+	linescan_index* index = linescan_index_create(16,16);
+	linescan_find_all(text.data(),cmask,text.size(),index);
+	linescan_index_free(index);
+      });
+    worker.join();
+    linescan* r = linescan_create(16);
+    linescan_find(text.data(),cmask,text.size(),r);
+    linescan_stats s;
+    linescan_stats_thread(&s);
+    TS_ASSERT_EQUALS(1u,s.calls);
+    linescan_stats_total(&s);
+    TS_ASSERT_EQUALS(2u,s.calls);
+    TS_ASSERT_EQUALS(3u,s.lines);
+
+    linescan_stats sum = s;
+    linescan_stats_add(&sum,&s);
+    TS_ASSERT_EQUALS(4u,sum.calls);
+    TS_ASSERT_EQUALS(6u,sum.line_lengths[3]);
+    linescan_free(r);
+  }
+
+  void test_linescan_stats_cycles(){
+    if(!linescan_stats_enabled()) return;
+    linescan* r = linescan_create(16);
+    std::string text = "a,b\n";
+    linescan_stats s;
+    linescan_find(text.data(),cmask,text.size(),r);
+    linescan_stats_thread(&s);
+    TS_ASSERT_EQUALS(0u,s.cycles);
+#if defined(__x86_64__) || defined(__i386__)
+    linescan_stats_cycles(1);
+    for(int i=0;i<100;i++) linescan_find(text.data(),cmask,text.size(),r);
+    linescan_stats_thread(&s);
+    TS_ASSERT(s.cycles > 0);
+#endif
+    linescan_free(r);
+  }
+
+};
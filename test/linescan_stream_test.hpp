@@ -0,0 +1,107 @@
+#include <cxxtest/TestSuite.h>
+
+#include <linescan_stream.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <unistd.h>
+
+class LinescanStreamTestSuite : public CxxTest::TestSuite {
+
+  uint64_t cmask = linescan_create_mask(',');
+
+public:
+
+  // @returns Temporary file containing text
+  FILE* write_input(const std::string& text){
+    FILE* f = tmpfile();
+    fwrite(text.data(),1,text.size(),f);
+    fflush(f);
+    rewind(f);
+    return f;
+  }
+
+  // Lines and their offsets as reported by linescan_find on the whole input
+  std::vector<std::pair<std::string,std::vector<size_t>>> expected_lines(const std::string& text){
+    std::vector<std::pair<std::string,std::vector<size_t>>> lines;
+    linescan* r = linescan_create(text.size() + 2);
+    size_t pos = 0;
+    while(pos < text.size()){
+      linescan_find(text.data() + pos,cmask,text.size() - pos,r);
+      lines.emplace_back(text.substr(pos,r->size),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+      pos += r->size;
+    }
+    linescan_free(r);
+    return lines;
+  }
+
+  void check_stream(const std::string& text, size_t chunk_size){
+    FILE* f = write_input(text);
+    auto expected = expected_lines(text);
+    linescan_stream* s = linescan_stream_create(fileno(f),cmask,chunk_size);
+    const linescan* line;
+    size_t i = 0;
+    int rc;
+    while((rc = linescan_stream_next(s,&line)) == 1){
+      TS_ASSERT(i < expected.size());
+      if(i >= expected.size()) break;
+      TS_ASSERT_EQUALS(expected[i].first,std::string(line->buf,line->size));
+      TS_ASSERT_EQUALS(expected[i].second,std::vector<size_t>(line->offsets,line->offsets + line->offsets_n));
+      i++;
+    }
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(expected.size(),i);
+    // End of input is sticky
+    TS_ASSERT_EQUALS(0,linescan_stream_next(s,&line));
+    linescan_stream_free(s);
+    fclose(f);
+  }
+
+  void test_linescan_stream(){
+    check_stream("a,b,c\nd,e\n\nlonger,line,spanning,several,chunks\nf",8);
+  }
+
+  void test_linescan_stream_empty(){
+    check_stream("",16);
+  }
+
+  void test_linescan_stream_random(){
+    std::mt19937 rng(3);
+    std::string text;
+    for(size_t i=0;i<100000;i++){
+      unsigned int x = rng() % 64;
+      text.push_back(x < 6 ? ',' : (x < 7 ? '\n' : (char)(97 + x % 26)));
+    }
+    text.push_back('\n');
+    check_stream(text,1);
+    check_stream(text,61);
+    check_stream(text,4096);
+  }
+
+  void test_linescan_stream_pipe(){
+    int fds[2];
+    TS_ASSERT_EQUALS(0,pipe(fds));
+    std::string text = "x,y\nlast";
+    TS_ASSERT_EQUALS((ssize_t)text.size(),write(fds[1],text.data(),text.size()));
+    close(fds[1]);
+    linescan_stream* s = linescan_stream_create(fds[0],cmask,3);
+    const linescan* line;
+    TS_ASSERT_EQUALS(1,linescan_stream_next(s,&line));
+    TS_ASSERT_EQUALS("x,y\n",std::string(line->buf,line->size));
+    TS_ASSERT_EQUALS(1,linescan_stream_next(s,&line));
+    TS_ASSERT_EQUALS("last",std::string(line->buf,line->size));
+    TS_ASSERT_EQUALS(1,line->offsets_n);
+    TS_ASSERT_EQUALS(0,linescan_stream_next(s,&line));
+    linescan_stream_free(s);
+    close(fds[0]);
+  }
+
+  void test_linescan_stream_error(){
+    linescan_stream* s = linescan_stream_create(-1,cmask,16);
+    const linescan* line;
+    TS_ASSERT_EQUALS(-1,linescan_stream_next(s,&line));
+    TS_ASSERT_EQUALS(0,linescan_stream_next(s,&line));
+    linescan_stream_free(s);
+  }
+
+};
@@ -2,6 +2,9 @@
 
 #include <linescan.h>
 #include <algorithm>
+#include <random>
+#include <sys/mman.h>
+#include <unistd.h>
 
 class LinescanTestSuite : public CxxTest::TestSuite {
 
@@ -11,6 +14,8 @@ class LinescanTestSuite : public CxxTest::TestSuite {
   char c = 'd'; // charcode 100
   uint64_t cmask = linescan_create_mask(c);
   linescan* r;
+  // Pages of characters between two inaccessible pages
+  char* guarded;
 
 public:
 
@@ -18,11 +23,19 @@ public:
     init_buffer();
 
     r = linescan_create(size);
+    // Step counts below describe the 8-byte word kernel
+    linescan_set_kernel(LINESCAN_KERNEL_SWAR);
+
+    guarded = (char*)mmap(NULL,data_n + 2 * page,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    mprotect(guarded,page,PROT_NONE);
+    mprotect(guarded + page + data_n,page,PROT_NONE);
   }
 
   void tearDown(){
+    munmap(guarded,data_n + 2 * page);
     free(b);
     linescan_free(r);
+    linescan_set_kernel(LINESCAN_KERNEL_AUTO);
   }
 
   void init_buffer(){
@@ -251,4 +264,1176 @@ public:
 #endif
   }
   
+  void test_linescan_kernels(){
+    TS_ASSERT_EQUALS(1,linescan_kernel_supported(LINESCAN_KERNEL_SWAR));
+    TS_ASSERT_EQUALS(LINESCAN_KERNEL_SWAR,linescan_get_kernel());
+    TS_ASSERT_EQUALS(-1,linescan_set_kernel(LINESCAN_KERNEL_N));
+    TS_ASSERT_EQUALS(0,linescan_set_kernel(LINESCAN_KERNEL_AUTO));
+    TS_ASSERT_DIFFERS(LINESCAN_KERNEL_AUTO,linescan_get_kernel());
+    TS_ASSERT_EQUALS(1,linescan_kernel_supported(linescan_get_kernel()));
+    TS_ASSERT_EQUALS(std::string("avx2"),std::string(linescan_kernel_name(LINESCAN_KERNEL_AVX2)));
+  }
+
+  // Characters between the guard pages of guarded
+  static constexpr size_t page = 4096;
+  static constexpr size_t data_n = 3 * page;
+
+  // Start of n characters ending right in front of the rear guard page, or starting right behind the front one
+  char* at_guard(size_t n, bool end){
+    return end ? guarded + page + data_n - n : guarded + page;
+  }
+
+  /* Fills n characters and their surroundings with draw(rng) and returns their start.
+     Depending on the round, they start close to a 64-byte boundary, anywhere, or right
+     next to a guard page, so loads past either end of the window fault. */
+  template<typename D>
+  char* window(std::mt19937& rng, int round, size_t n, D draw){
+    TS_ASSERT(n <= data_n - 64);
+    char* data = at_guard(0,false);
+    size_t start = round % 4 == 0 ? rng() % 64 : (round % 4 == 2 ? rng() % (data_n - n + 1) : at_guard(n,round % 4 == 1) - data);
+    for(size_t i=start < 128 ? 0 : start - 128;i<std::min(data_n,start + n + 128);i++) data[i] = draw(rng);
+    return data + start;
+  }
+
+  // Calls check() with every supported kernel selected; the portable kernel is selected afterwards
+  template<typename F>
+  void for_kernels(F check){
+    for(int k=LINESCAN_KERNEL_SWAR;k<LINESCAN_KERNEL_N;k++){
+      if(linescan_set_kernel((linescan_kernel)k) != 0) continue;
+      check();
+    }
+    linescan_set_kernel(LINESCAN_KERNEL_SWAR);
+  }
+
+  // Checks that run() returns the same with every supported kernel as with the portable kernel
+  template<typename F>
+  void compare_kernels(F run){
+    linescan_set_kernel(LINESCAN_KERNEL_SWAR);
+    std::vector<size_t> expected = run();
+    for_kernels([&]{ TS_ASSERT_EQUALS(expected,run()); });
+  }
+
+  // Return code, size and offsets of a search
+  static std::vector<size_t> found(int rc, const linescan* l){
+    std::vector<size_t> v = {(size_t)rc,l->size};
+    v.insert(v.end(),l->offsets,l->offsets + l->offsets_n);
+    return v;
+  }
+
+  void test_linescan_kernels_find(){
+    // Every kernel must produce the same results as the portable kernel
+    std::mt19937 rng(42);
+    linescan* line = linescan_create(1026);
+    for(int round=0;round<200;round++){
+      char newline = round % 8 < 4 ? '\n' : 'a';
+      size_t n = rng() % 1024;
+      const char* buf = window(rng,round,n,[&](std::mt19937& g){
+	  unsigned int x = g() % 64;
+	  return x < 8 ? 'd' : (x < 9 ? newline : (char)(97 + x % 26));
+	});
+      compare_kernels([&]{ return found(linescan_find(buf,cmask,n,line),line); });
+      compare_kernels([&]{ return found(linescan_rfind(buf,cmask,n,line),line); });
+    }
+    linescan_free(line);
+  }
+
+  void test_linescan_kernels_edges(){
+    // A delimiter and newline at every position of up to 130 characters next to a guard page
+    linescan* line = linescan_create(8);
+    linescan* expected = linescan_create(8);
+    linescan_index* index = linescan_index_create(8,2);
+    linescan_batch* batch = linescan_batch_create(8,1);
+    for(size_t n=0;n<=130;n++){
+      for(size_t p=0;p<=n;p++){
+	for(bool end : {false,true}){
+	  char* buf = at_guard(n,end);
+	  memset(buf,'a',n);
+	  if(p < n) buf[p] = '\n';
+	  if(p > 0) buf[p - 1] = c;
+	  std::vector<size_t> offsets = {0};
+	  if(p > 0) offsets.push_back(p - 1);
+	  if(p < n) offsets.push_back(p);
+	  for_kernels([&]{
+	      TS_ASSERT_EQUALS(p < n ? 1 : 0,linescan_find(buf,cmask,n,line));
+	      TS_ASSERT_EQUALS(p < n ? p + 1 : n,line->size);
+	      TS_ASSERT_EQUALS(offsets,std::vector<size_t>(line->offsets,line->offsets + line->offsets_n));
+	      const char* bufs[] = {buf};
+	      TS_ASSERT_EQUALS(0,linescan_find_batch(bufs,&n,1,cmask,batch));
+	      TS_ASSERT_EQUALS(offsets,std::vector<size_t>(batch->offsets,batch->offsets + batch->offsets_n));
+	    });
+	  compare_kernels([&]{ return found(linescan_rfind(buf,cmask,n,expected),expected); });
+	  compare_kernels([&]{
+	      linescan_find_all(buf,cmask,n,index);
+	      std::vector<size_t> v(index->offsets,index->offsets + index->offsets_n);
+	      v.push_back(index->size);
+	      return v;
+	    });
+	}
+      }
+    }
+    linescan_batch_free(batch);
+    linescan_index_free(index);
+    linescan_free(expected);
+    linescan_free(line);
+  }
+
+  void test_linescan_kernels_find_term(){
+    // Searching for a terminator must equal searching the newline in a translated copy
+    std::mt19937 rng(11);
+    linescan* expected = linescan_create(514);
+    linescan* actual = linescan_create(514);
+    const char terms[] = { '\0', 0x1e, '|' };
+
+    for(int round=0;round<150;round++){
+      char term = terms[round % 3];
+      uint64_t tmask = linescan_create_mask(term);
+      size_t n = rng() % 512;
+      const char* buf = window(rng,round,n,[&](std::mt19937& g){
+	  unsigned int x = g() % 64;
+	  return x < 8 ? 'd' : (x < 9 ? term : (x < 10 ? '\n' : (char)(97 + x % 26)));
+	});
+      std::string translated(buf,n);
+      for(char& x : translated) x = x == term ? '\n' : (x == '\n' ? 'a' : x);
+
+      for_kernels([&]{
+	  TS_ASSERT_EQUALS(found(linescan_find(translated.data(),cmask,n,expected),expected),
+			   found(linescan_find_term(buf,cmask,tmask,n,actual),actual));
+	  TS_ASSERT_EQUALS(found(linescan_rfind(translated.data(),cmask,n,expected),expected),
+			   found(linescan_rfind_term(buf,cmask,tmask,n,actual),actual));
+	});
+    }
+    linescan_free(expected);
+    linescan_free(actual);
+  }
+
+  void test_linescan_find_crlf(){
+    const char* text = "ab,c\r\nde\n\r\nrest\r";
+    uint64_t comma = linescan_create_mask(',');
+    linescan* r = linescan_create(16);
+    int rc = linescan_find_crlf(text,comma,strlen(text),r);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(6u,r->size);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,2,4}),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+
+    // Bare newline
+    rc = linescan_find_crlf(text+6,comma,strlen(text+6),r);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(3u,r->size);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,2}),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+
+    // Empty line
+    rc = linescan_find_crlf(text+9,comma,strlen(text+9),r);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(2u,r->size);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,0}),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+
+    // No newline, the \r stays part of the line
+    rc = linescan_find_crlf(text+11,comma,strlen(text+11),r);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(5u,r->size);
+    linescan_free(r);
+  }
+
+  void test_linescan_kernels_steps(){
+    if(!linescan_kernel_supported(LINESCAN_KERNEL_AVX2)) return;
+    linescan_set_kernel(LINESCAN_KERNEL_AVX2);
+    b[size-1] = '\n';
+    b[size-3] = '\n';
+    int rc = linescan_find(b+1,cmask,size-1,r);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(size-3,r->size);
+    {
+      auto offsets = std::vector<size_t>{0,2,28,54,80,106,124};
+      TS_ASSERT_EQUALS(offsets,std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+    }
+#ifdef LINESCAN_DEBUG
+    TS_ASSERT_EQUALS(r->debug_steps_1, 0); // Unaligned loads, no steps necessary
+    TS_ASSERT_EQUALS(r->debug_steps_2, 3); // 3 * 32 = 96, 31 bytes left
+    TS_ASSERT_EQUALS(r->debug_steps_3, 1); // Newline found in tail, one overlapping load
+#endif
+    rc = linescan_rfind(b,cmask,size-1,r);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(2,r->size);
+    TS_ASSERT_EQUALS(2,r->offsets_n);
+#ifdef LINESCAN_DEBUG
+    TS_ASSERT_EQUALS(r->debug_steps_1, 0);
+    TS_ASSERT_EQUALS(r->debug_steps_2, 1);
+    TS_ASSERT_EQUALS(r->debug_steps_3, 0);
+#endif
+  }
+  
+  void test_linescan_find_all(){
+    const char* text = "ad,d\n\nxd\ndd";
+    linescan_index* index = linescan_index_create(1,1);
+    int rc = linescan_find_all(text,cmask,strlen(text),index);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(text,index->buf);
+    TS_ASSERT_EQUALS(9,index->size);
+    TS_ASSERT_EQUALS(3,index->lines_n);
+    {
+      auto lines = std::vector<size_t>{0,4,6,9};
+      auto offsets = std::vector<size_t>{0,1,3,4, 5,5, 6,7,8};
+      TS_ASSERT_EQUALS(lines,std::vector<size_t>(index->lines,index->lines + index->lines_n + 1));
+      TS_ASSERT_EQUALS(offsets,std::vector<size_t>(index->offsets,index->offsets + index->offsets_n));
+    }
+    TS_ASSERT(index->offsets_size >= index->offsets_n);
+    TS_ASSERT(index->lines_size > index->lines_n);
+
+    // Buffer ends with newline
+    rc = linescan_find_all(text,cmask,9,index);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(9,index->size);
+    TS_ASSERT_EQUALS(3,index->lines_n);
+
+    // No newline at all
+    rc = linescan_find_all(b,cmask,size,index);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(0,index->size);
+    TS_ASSERT_EQUALS(0,index->lines_n);
+    TS_ASSERT_EQUALS(0,index->offsets_n);
+    linescan_index_free(index);
+  }
+
+  void test_linescan_kernels_find_all(){
+    // Lines in the index must match repeated calls to linescan_find
+    std::mt19937 rng(7);
+    linescan_index* index = linescan_index_create(16,4);
+    linescan* line = linescan_create(4098);
+
+    for(int round=0;round<50;round++){
+      unsigned int newlines = round % 8;
+      size_t n = rng() % 4096;
+      const char* buf = window(rng,round,n,[&](std::mt19937& g){
+	  unsigned int x = g() % 128;
+	  return x < 16 ? 'd' : (x < 16 + newlines ? '\n' : (char)(97 + x % 26));
+	});
+      std::vector<std::vector<size_t>> lines;
+      size_t pos = 0;
+      while(linescan_find(buf+pos,cmask,n-pos,line) == 1){
+	std::vector<size_t> offsets;
+	for(size_t j=0;j<line->offsets_n;j++) offsets.push_back(pos + line->offsets[j]);
+	lines.push_back(offsets);
+	pos += line->size;
+      }
+
+      for_kernels([&]{
+	  TS_ASSERT_EQUALS(pos == n,linescan_find_all(buf,cmask,n,index));
+	  TS_ASSERT_EQUALS(lines.size(),index->lines_n);
+	  TS_ASSERT_EQUALS(pos,index->size);
+	  for(size_t l=0;l<lines.size() && l<index->lines_n;l++){
+	    TS_ASSERT_EQUALS(lines[l],std::vector<size_t>(index->offsets + index->lines[l],
+							   index->offsets + index->lines[l+1]));
+	  }
+	});
+    }
+    linescan_free(line);
+    linescan_index_free(index);
+  }
+  
+  void test_linescan_find_bitmap(){
+    const char* text = "ad,d\n\nxd\ndd";
+    linescan_bitmap* bm = linescan_bitmap_create(1);
+    int rc = linescan_find_bitmap(text,cmask,strlen(text),bm);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(text,bm->buf);
+    TS_ASSERT_EQUALS(strlen(text),bm->size);
+    TS_ASSERT_EQUALS(0x68a,bm->delims[0]);
+    TS_ASSERT_EQUALS(0x130,bm->newlines[0]);
+
+    TS_ASSERT_EQUALS(5,linescan_bitmap_count(bm,0,bm->size));
+    TS_ASSERT_EQUALS(2,linescan_bitmap_count(bm,0,4));
+    TS_ASSERT_EQUALS(0,linescan_bitmap_count(bm,4,7));
+    TS_ASSERT_EQUALS(1,linescan_bitmap_select(bm,0,0));
+    TS_ASSERT_EQUALS(7,linescan_bitmap_select(bm,2,1));
+    TS_ASSERT_EQUALS(bm->size,linescan_bitmap_select(bm,2,4));
+    TS_ASSERT_EQUALS(4,linescan_bitmap_next_line(bm,0));
+    TS_ASSERT_EQUALS(8,linescan_bitmap_next_line(bm,6));
+    TS_ASSERT_EQUALS(bm->size,linescan_bitmap_next_line(bm,9));
+    TS_ASSERT_EQUALS(3,linescan_bitmap_next_field(bm,2));
+    TS_ASSERT_EQUALS(4,linescan_bitmap_next_field(bm,4));
+
+    size_t start, end;
+    TS_ASSERT_EQUALS(1,linescan_bitmap_field(bm,0,1,&start,&end));
+    TS_ASSERT_EQUALS(2,start);
+    TS_ASSERT_EQUALS(3,end);
+    TS_ASSERT_EQUALS(1,linescan_bitmap_field(bm,0,2,&start,&end));
+    TS_ASSERT_EQUALS(4,start);
+    TS_ASSERT_EQUALS(4,end);
+    TS_ASSERT_EQUALS(0,linescan_bitmap_field(bm,0,3,&start,&end));
+    TS_ASSERT_EQUALS(0,linescan_bitmap_field(bm,5,1,&start,&end));
+    TS_ASSERT_EQUALS(1,linescan_bitmap_field(bm,9,2,&start,&end));
+    TS_ASSERT_EQUALS(11,start);
+    TS_ASSERT_EQUALS(11,end);
+
+    rc = linescan_find_bitmap(text,cmask,9,bm);
+    TS_ASSERT_EQUALS(1,rc);
+    linescan_bitmap_free(bm);
+  }
+
+  void test_linescan_kernels_find_bitmap(){
+    // Bitmaps must match the offsets found by linescan_find_all
+    std::mt19937 rng(11);
+    linescan_bitmap* bm = linescan_bitmap_create(16);
+    linescan_index* index = linescan_index_create(4096,4096);
+
+    for(int round=0;round<50;round++){
+      size_t n = 1 + rng() % 4096;
+      char* buf = window(rng,round,n,[](std::mt19937& g){
+	  unsigned int x = g() % 64;
+	  return x < 8 ? 'd' : (x < 10 ? '\n' : (char)(97 + x % 26));
+	});
+      buf[n - 1] = '\n';
+      linescan_find_all(buf,cmask,n,index);
+
+      for_kernels([&]{
+	  TS_ASSERT_EQUALS(1,linescan_find_bitmap(buf,cmask,n,bm));
+	  std::vector<size_t> offsets;
+	  for(size_t pos=0;pos<bm->size;pos++){
+	    size_t next = linescan_bitmap_next_field(bm,pos);
+	    if(next == bm->size) break;
+	    if(pos == 0 || buf[pos - 1] == '\n') offsets.push_back(pos);
+	    offsets.push_back(next);
+	    pos = next;
+	  }
+	  TS_ASSERT_EQUALS(std::vector<size_t>(index->offsets,index->offsets + index->offsets_n),offsets);
+	  TS_ASSERT_EQUALS(index->offsets_n - 2 * index->lines_n,linescan_bitmap_count(bm,0,bm->size));
+	});
+    }
+    linescan_bitmap_free(bm);
+    linescan_index_free(index);
+  }
+  
+  std::vector<size_t> bounded_offsets(const linescan_bounded* br){
+    std::vector<size_t> offsets;
+    for(size_t i=0;i<br->offsets_n;i++) offsets.push_back(linescan_bounded_offset(br,i));
+    return offsets;
+  }
+
+  void test_linescan_find_bounded(){
+    b[size-1] = '\n';
+    linescan_bounded* br = linescan_bounded_create(4,LINESCAN_WIDTH_16,NULL);
+
+    // Stop after the last stored match and resume behind it
+    int rc = linescan_find_bounded(b,cmask,size,br);
+    TS_ASSERT_EQUALS(LINESCAN_FULL,rc);
+    TS_ASSERT_EQUALS(4,br->offsets_n);
+    TS_ASSERT_EQUALS(56,br->size);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,3,29,55}),bounded_offsets(br));
+
+    rc = linescan_find_bounded(b+56,cmask,size-56,br);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(size-56,br->size);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,25,51,71}),bounded_offsets(br));
+
+    // Newline fits exactly
+    rc = linescan_find_bounded(b+100,cmask,size-100,br);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,7,27}),bounded_offsets(br));
+    linescan_bounded_free(br);
+
+    // Grow from arena, 32 bit offsets
+    std::vector<char> memory(256);
+    linescan_arena arena;
+    linescan_arena_init(&arena,memory.data(),memory.size());
+    br = linescan_bounded_create(2,LINESCAN_WIDTH_32,&arena);
+    rc = linescan_find_bounded(b,cmask,size,br);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(size,br->size);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,3,29,55,81,107,127}),bounded_offsets(br));
+    TS_ASSERT(br->offsets_size >= 7);
+    TS_ASSERT((char*)br->offsets >= memory.data() && (char*)br->offsets < memory.data() + memory.size());
+    linescan_bounded_free(br);
+
+    // Arena exhausted
+    linescan_arena_init(&arena,memory.data(),24);
+    br = linescan_bounded_create(2,LINESCAN_WIDTH_64,&arena);
+    rc = linescan_find_bounded(b,cmask,size,br);
+    TS_ASSERT_EQUALS(LINESCAN_FULL,rc);
+    TS_ASSERT_EQUALS(4,br->size);
+    TS_ASSERT(linescan_arena_alloc(&arena,16,1) == NULL);
+    TS_ASSERT(linescan_arena_alloc(&arena,8,1) != NULL);
+    linescan_bounded_free(br);
+
+    // No room for the initial offsets
+    TS_ASSERT(linescan_bounded_create(2,LINESCAN_WIDTH_64,&arena) == NULL);
+    linescan_arena_init(&arena,memory.data(),8);
+    TS_ASSERT(linescan_bounded_create(2,LINESCAN_WIDTH_64,&arena) == NULL);
+    TS_ASSERT_EQUALS(0u,arena.used);
+  }
+
+  void test_linescan_find_bounded_range(){
+    // 16 bit offsets cannot describe lines longer than 64 KiB
+    size_t n = 100000;
+    std::vector<char> buf(n,'a');
+    buf[10] = 'd';
+    buf[70000] = 'd';
+    buf[n-1] = '\n';
+    linescan_bounded* br = linescan_bounded_create(16,LINESCAN_WIDTH_16,NULL);
+    int rc = linescan_find_bounded(buf.data(),cmask,n,br);
+    TS_ASSERT_EQUALS(LINESCAN_FULL,rc);
+    TS_ASSERT_EQUALS(11,br->size);
+    rc = linescan_find_bounded(buf.data()+11,cmask,n-11,br);
+    TS_ASSERT_EQUALS(LINESCAN_FULL,rc);
+    TS_ASSERT_EQUALS(65536,br->size);
+    TS_ASSERT_EQUALS(1,br->offsets_n);
+    rc = linescan_find_bounded(buf.data()+11+65536,cmask,n-11-65536,br);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,70000-11-65536,n-1-11-65536}),bounded_offsets(br));
+    linescan_bounded_free(br);
+  }
+
+  void test_linescan_kernels_find_bounded(){
+    // Resumed searches must report the same matches as linescan_find
+    std::mt19937 rng(5);
+    linescan* line = linescan_create(2050);
+    linescan_bounded* br = linescan_bounded_create(3,LINESCAN_WIDTH_32,NULL);
+
+    for(int round=0;round<100;round++){
+      size_t n = rng() % 2048;
+      const char* buf = window(rng,round,n,[](std::mt19937& g){
+	  unsigned int x = g() % 256;
+	  return x < 16 ? 'd' : (x < 17 ? '\n' : (char)(97 + x % 26));
+	});
+      int rc_expected = linescan_find(buf,cmask,n,line);
+
+      for_kernels([&]{
+	  std::vector<size_t> offsets{0};
+	  size_t pos = 0;
+	  int rc;
+	  while((rc = linescan_find_bounded(buf+pos,cmask,n-pos,br)) == LINESCAN_FULL){
+	    for(size_t i=1;i<br->offsets_n;i++) offsets.push_back(pos + linescan_bounded_offset(br,i));
+	    pos += br->size;
+	  }
+	  for(size_t i=1;i<br->offsets_n;i++) offsets.push_back(pos + linescan_bounded_offset(br,i));
+	  TS_ASSERT_EQUALS(rc_expected,rc);
+	  TS_ASSERT_EQUALS(line->size,pos + br->size);
+	  TS_ASSERT_EQUALS(std::vector<size_t>(line->offsets,line->offsets + line->offsets_n),offsets);
+	});
+    }
+    linescan_free(line);
+    linescan_bounded_free(br);
+  }
+
+  std::vector<size_t> projection_spans(const linescan_projection* p){
+    return std::vector<size_t>(p->spans,p->spans + 2 * p->spans_n);
+  }
+
+  void test_linescan_find_projection(){
+    b[size-1] = '\n';
+    size_t columns[] = {4,1,4};
+    linescan_projection* p = linescan_projection_create(columns,3);
+    TS_ASSERT_EQUALS(2,p->columns_n);
+
+    int rc = linescan_find_projection(b,cmask,size,p);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(b,p->buf);
+    TS_ASSERT_EQUALS(size,p->size);
+    TS_ASSERT_EQUALS((std::vector<size_t>{4,29,82,107}),projection_spans(p));
+
+    // Last field ends at the newline
+    linescan_projection_free(p);
+    columns[0] = 5;
+    p = linescan_projection_create(columns,1);
+    rc = linescan_find_projection(b,cmask,size,p);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS((std::vector<size_t>{108,127}),projection_spans(p));
+
+    // No newline, the last field ends at n
+    rc = linescan_find_projection(b,cmask,size-1,p);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(size-1,p->size);
+    TS_ASSERT_EQUALS((std::vector<size_t>{108,127}),projection_spans(p));
+
+    // Line has fewer fields
+    rc = linescan_find_projection(b,cmask,60,p);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(0,p->spans_n);
+    linescan_projection_free(p);
+
+    // No wanted fields, newline search only
+    p = linescan_projection_create(NULL,0);
+    rc = linescan_find_projection(b,cmask,size,p);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(size,p->size);
+    TS_ASSERT_EQUALS(0,p->spans_n);
+    linescan_projection_free(p);
+  }
+
+  void test_linescan_kernels_find_projection(){
+    // Projected spans must match the fields reported by linescan_find
+    std::mt19937 rng(6);
+    linescan* line = linescan_create(2050);
+
+    for(int round=0;round<100;round++){
+      bool newlines = round % 8 >= 4;
+      size_t n = rng() % 2048;
+      const char* buf = window(rng,round,n,[&](std::mt19937& g){
+	  unsigned int x = g() % 256;
+	  return x < 16 ? 'd' : (x < 17 && newlines ? '\n' : (char)(97 + x % 26));
+	});
+      std::vector<size_t> columns;
+      for(int i=0;i<4;i++) columns.push_back(rng() % 24);
+      linescan_projection* p = linescan_projection_create(columns.data(),columns.size());
+      int rc_expected = linescan_find(buf,cmask,n,line);
+      // Without newline, the last field ends at n
+      std::vector<size_t> offsets(line->offsets,line->offsets + line->offsets_n);
+      if(rc_expected == 0) offsets.push_back(n);
+      std::vector<size_t> spans;
+      for(size_t i=0;i<p->columns_n && p->columns[i] + 1 < offsets.size();i++){
+	size_t k = p->columns[i];
+	spans.push_back(k == 0 ? 0 : offsets[k] + 1);
+	spans.push_back(offsets[k + 1]);
+      }
+
+      for_kernels([&]{
+	  TS_ASSERT_EQUALS(rc_expected,linescan_find_projection(buf,cmask,n,p));
+	  TS_ASSERT_EQUALS(line->size,p->size);
+	  TS_ASSERT_EQUALS(spans,projection_spans(p));
+	});
+      linescan_projection_free(p);
+    }
+    linescan_free(line);
+  }
+
+  void test_linescan_count(){
+    b[size-1] = '\n';
+    linescan_counts counts;
+    int rc = linescan_count(b,cmask,size,&counts);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(size,counts.size);
+    TS_ASSERT_EQUALS(1,counts.lines_n);
+    TS_ASSERT_EQUALS(5,counts.delims_n);
+    TS_ASSERT_EQUALS(6,counts.fields_max);
+
+    rc = linescan_count(b+65,cmask,size-66,&counts);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(size-66,counts.size);
+    TS_ASSERT_EQUALS(0,counts.lines_n);
+    TS_ASSERT_EQUALS(2,counts.delims_n);
+
+    // Three lines, the last one unterminated and the widest
+    b[10] = '\n';
+    b[60] = '\n';
+    rc = linescan_count_all(b,cmask,size-1,&counts);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(2,counts.lines_n);
+    TS_ASSERT_EQUALS(5,counts.delims_n);
+    TS_ASSERT_EQUALS(3,counts.fields_max);
+    rc = linescan_count_all(b,cmask,size,&counts);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(3,counts.lines_n);
+
+    rc = linescan_count_all(b,cmask,0,&counts);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS(0,counts.fields_max);
+  }
+
+  void test_linescan_kernels_count_all(){
+    // Counts must match the index built by linescan_find_all
+    std::mt19937 rng(7);
+    linescan_index* index = linescan_index_create(16,4);
+    linescan_counts counts;
+
+    for(int round=0;round<50;round++){
+      unsigned int density = 1 + rng() % 64;
+      size_t n = rng() % 4096;
+      const char* buf = window(rng,round,n,[&](std::mt19937& g){
+	  unsigned int x = g() % 256;
+	  return x < density ? 'd' : (x < density + 4 ? '\n' : (char)(97 + x % 26));
+	});
+      linescan_find_all(buf,cmask,n,index);
+      size_t delims_n = index->offsets_n - 2 * index->lines_n;
+      size_t fields_max = 0;
+      for(size_t i=0;i<index->lines_n;i++){
+	fields_max = std::max(fields_max,index->lines[i+1] - index->lines[i] - 1);
+      }
+      // Matches after the last newline
+      size_t fields = 1;
+      for(size_t i=index->size;i<n;i++) fields += buf[i] == 'd';
+      delims_n += fields - 1;
+      if(index->size < n) fields_max = std::max(fields_max,fields);
+
+      for_kernels([&]{
+	  TS_ASSERT_EQUALS(index->size == n ? 1 : 0,linescan_count_all(buf,cmask,n,&counts));
+	  TS_ASSERT_EQUALS(n,counts.size);
+	  TS_ASSERT_EQUALS(index->lines_n,counts.lines_n);
+	  TS_ASSERT_EQUALS(delims_n,counts.delims_n);
+	  TS_ASSERT_EQUALS(fields_max,counts.fields_max);
+	});
+    }
+    linescan_index_free(index);
+  }
+
+  void test_linescan_find_quoted(){
+    const char* csv = "a,\"b,\nc\",\"d\"\"e\"\nf,g\n";
+    size_t n = strlen(csv);
+    uint64_t comma = linescan_create_mask(',');
+    linescan_quote q;
+    linescan_quote_init(&q,'"');
+
+    int rc = linescan_find_quoted(csv,comma,n,r,&q);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(16,r->size);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,1,8,15}),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+    TS_ASSERT_EQUALS(0,q.inside);
+
+    // Line continued in the next buffer
+    rc = linescan_find_quoted(csv,comma,5,r,&q);
+    TS_ASSERT_EQUALS(0,rc);
+    TS_ASSERT_EQUALS((uint64_t)-1,q.inside);
+    rc = linescan_find_quoted(csv+5,comma,n-5,r,&q);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,3,10}),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+
+    linescan_index* index = linescan_index_create(4,2);
+    rc = linescan_find_all_quoted(csv,comma,n,index,&q);
+    TS_ASSERT_EQUALS(1,rc);
+    TS_ASSERT_EQUALS(2,index->lines_n);
+    TS_ASSERT_EQUALS((std::vector<size_t>{0,1,8,15,16,17,19}),std::vector<size_t>(index->offsets,index->offsets + index->offsets_n));
+    linescan_index_free(index);
+  }
+
+  void test_linescan_kernels_find_quoted(){
+    // Compare with a character by character CSV scanner, splitting the bitmap search at random positions
+    std::mt19937 rng(8);
+    linescan_index* index = linescan_index_create(16,4);
+    linescan_bitmap* bm = linescan_bitmap_create(64);
+    linescan* line = linescan_create(2050);
+    linescan_quote q;
+
+    for(int round=0;round<100;round++){
+      size_t n = rng() % 2048;
+      const char* buf = window(rng,round,n,[](std::mt19937& g){
+	  unsigned int x = g() % 256;
+	  return x < 16 ? 'd' : (x < 24 ? '\n' : (x < 28 ? '"' : (char)(97 + x % 26)));
+	});
+      std::vector<size_t> delims;
+      std::vector<size_t> newlines;
+      bool inside = false;
+      for(size_t i=0;i<n;i++){
+	if(buf[i] == '"') inside = !inside;
+	else if(!inside && buf[i] == 'd') delims.push_back(i);
+	else if(!inside && buf[i] == '\n') newlines.push_back(i);
+      }
+
+      for_kernels([&]{
+	  linescan_quote_init(&q,'"');
+	  std::vector<size_t> bm_delims;
+	  std::vector<size_t> bm_newlines;
+	  for(size_t pos=0;pos<n;){
+	    size_t len = std::min(n - pos,(size_t)(1 + rng() % 200));
+	    linescan_find_bitmap_quoted(buf+pos,cmask,len,bm,&q);
+	    for(size_t i=0;i<len;i++){
+	      if(linescan_bitmap_next(bm->delims,len,i) == i) bm_delims.push_back(pos + i);
+	      if(linescan_bitmap_next_line(bm,i) == i) bm_newlines.push_back(pos + i);
+	    }
+	    pos += len;
+	  }
+	  TS_ASSERT_EQUALS(delims,bm_delims);
+	  TS_ASSERT_EQUALS(newlines,bm_newlines);
+	  TS_ASSERT_EQUALS(inside ? ~(uint64_t)0 : 0,q.inside);
+
+	  linescan_quote_init(&q,'"');
+	  linescan_find_all_quoted(buf,cmask,n,index,&q);
+	  TS_ASSERT_EQUALS(newlines.size(),index->lines_n);
+	  std::vector<size_t> index_delims;
+	  for(size_t l=0;l<index->lines_n;l++){
+	    for(size_t i=index->lines[l]+1;i<index->lines[l+1]-1;i++) index_delims.push_back(index->offsets[i]);
+	  }
+	  size_t end = newlines.empty() ? 0 : newlines.back();
+	  TS_ASSERT_EQUALS(std::vector<size_t>(delims.begin(),std::lower_bound(delims.begin(),delims.end(),end)),index_delims);
+
+	  // Line by line
+	  linescan_quote_init(&q,'"');
+	  size_t pos = 0;
+	  for(size_t l=0;l<newlines.size();l++){
+	    TS_ASSERT_EQUALS(1,linescan_find_quoted(buf+pos,cmask,n-pos,line,&q));
+	    TS_ASSERT_EQUALS(newlines[l],pos + line->size - 1);
+	    pos += line->size;
+	  }
+	  TS_ASSERT_EQUALS(0,linescan_find_quoted(buf+pos,cmask,n-pos,line,&q));
+	});
+    }
+    linescan_free(line);
+    linescan_bitmap_free(bm);
+    linescan_index_free(index);
+  }
+
+  void test_linescan_find_delim(){
+    linescan_delim d;
+    TS_ASSERT_EQUALS(-1,linescan_delim_init(&d,"",0));
+    TS_ASSERT_EQUALS(-1,linescan_delim_init(&d,"123456789",9));
+    TS_ASSERT_EQUALS(-1,linescan_delim_init(&d,"|\n",2));
+    TS_ASSERT_EQUALS(0,linescan_delim_init(&d,"||",2));
+
+    // Overlapping matches are skipped
+    const char* buf = "a||b|||c\n||\nx||";
+    size_t n = strlen(buf);
+    TS_ASSERT_EQUALS(1,linescan_find_delim(buf,&d,n,r));
+    TS_ASSERT_EQUALS(std::vector<size_t>({0,2,5,8}),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+    TS_ASSERT_EQUALS(9u,r->size);
+    // Offsets point at the last delimiter character: fields start behind them as with single characters
+    TS_ASSERT_EQUALS(std::string("b"),std::string(buf + r->offsets[1] + 1,buf + r->offsets[2] - d.n + 1));
+    TS_ASSERT_EQUALS(std::string("|c"),std::string(buf + r->offsets[2] + 1,r->offsets[3] - r->offsets[2] - 1));
+    TS_ASSERT_EQUALS(1,linescan_find_delim(buf + 9,&d,n - 9,r));
+    TS_ASSERT_EQUALS(std::vector<size_t>({0,1,2}),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+    TS_ASSERT_EQUALS(0,linescan_find_delim(buf + 12,&d,n - 12,r));
+    TS_ASSERT_EQUALS(std::vector<size_t>({0,2}),std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+    TS_ASSERT_EQUALS(3u,r->size);
+
+    linescan_index* index = linescan_index_create(4,2);
+    TS_ASSERT_EQUALS(0,linescan_find_all_delim(buf,&d,n,index));
+    TS_ASSERT_EQUALS(2u,index->lines_n);
+    TS_ASSERT_EQUALS(std::vector<size_t>({0,2,5,8,9,10,11}),
+		     std::vector<size_t>(index->offsets,index->offsets + index->offsets_n));
+    TS_ASSERT_EQUALS(12u,index->size);
+    linescan_index_free(index);
+  }
+
+  void test_linescan_kernels_find_delim(){
+    // Compare with a naive left-to-right substring search for every delimiter length
+    std::mt19937 rng(9);
+    linescan_index* index = linescan_index_create(16,4);
+    linescan* line = linescan_create(1026);
+    const char* chars = ":|:|::||";
+
+    for(int round=0;round<200;round++){
+      size_t delim_n = 1 + round % 8;
+      linescan_delim d;
+      TS_ASSERT_EQUALS(0,linescan_delim_init(&d,chars,delim_n));
+      size_t n = rng() % 1024;
+      const char* buf = window(rng,round,n,[&](std::mt19937& g){
+	  unsigned int x = g() % 64;
+	  return x < 24 ? chars[g() % delim_n] : (x < 26 ? '\n' : 'a');
+	});
+      std::vector<size_t> delims;
+      std::vector<size_t> newlines;
+      for(size_t i=0;i<n;){
+	if(buf[i] == '\n'){
+	  newlines.push_back(i++);
+	} else if(i + delim_n <= n && memcmp(buf + i,chars,delim_n) == 0){
+	  delims.push_back(i + delim_n - 1);
+	  i += delim_n;
+	} else {
+	  i++;
+	}
+      }
+
+      for_kernels([&]{
+	  linescan_find_all_delim(buf,&d,n,index);
+	  TS_ASSERT_EQUALS(newlines.size(),index->lines_n);
+	  std::vector<size_t> index_delims;
+	  for(size_t l=0;l<index->lines_n;l++){
+	    for(size_t i=index->lines[l]+1;i<index->lines[l+1]-1;i++) index_delims.push_back(index->offsets[i]);
+	  }
+	  size_t end = newlines.empty() ? 0 : newlines.back();
+	  TS_ASSERT_EQUALS(std::vector<size_t>(delims.begin(),std::lower_bound(delims.begin(),delims.end(),end)),index_delims);
+
+	  // Line by line
+	  std::vector<size_t> line_delims;
+	  size_t pos = 0;
+	  int rc;
+	  do {
+	    rc = linescan_find_delim(buf+pos,&d,n-pos,line);
+	    size_t last = rc == 1 ? line->offsets_n - 1 : line->offsets_n;
+	    for(size_t i=1;i<last;i++) line_delims.push_back(pos + line->offsets[i]);
+	    pos += line->size;
+	  } while(rc == 1);
+	  TS_ASSERT_EQUALS(n,pos);
+	  TS_ASSERT_EQUALS(delims,line_delims);
+	});
+    }
+    linescan_free(line);
+    linescan_index_free(index);
+  }
+
+  void test_linescan_find_all_filter(){
+    const char* buf = "a,x1,b\nb,y\nc,x2\nd\ne,xx,\nf,x";
+    size_t n = strlen(buf);
+    linescan_index* index = linescan_index_create(4,2);
+    linescan_predicate p;
+    uint64_t comma = linescan_create_mask(',');
+
+    linescan_predicate_init(&p,1,LINESCAN_PREDICATE_PREFIX,"x",1);
+    TS_ASSERT_EQUALS(0,linescan_find_all_filter(buf,comma,n,&p,index));
+    TS_ASSERT_EQUALS(3u,index->lines_n);
+    TS_ASSERT_EQUALS(std::vector<size_t>({0,1,4,6,11,12,15,18,19,22,23}),
+		     std::vector<size_t>(index->offsets,index->offsets + index->offsets_n));
+    // The incomplete last line is not tested
+    TS_ASSERT_EQUALS(24u,index->size);
+
+    linescan_predicate_init(&p,1,LINESCAN_PREDICATE_EQUAL,"y",1);
+    TS_ASSERT_EQUALS(1,linescan_find_all_filter(buf,comma,24,&p,index));
+    TS_ASSERT_EQUALS(std::vector<size_t>({7,8,10}),
+		     std::vector<size_t>(index->offsets,index->offsets + index->offsets_n));
+
+    // Empty third field
+    linescan_predicate_init(&p,2,LINESCAN_PREDICATE_EQUAL,"",0);
+    TS_ASSERT_EQUALS(1,linescan_find_all_filter(buf,comma,24,&p,index));
+    TS_ASSERT_EQUALS(1u,index->lines_n);
+    TS_ASSERT_EQUALS(18u,index->offsets[0]);
+
+    linescan_predicate_init(&p,0,LINESCAN_PREDICATE_BYTES,"bd",2);
+    TS_ASSERT_EQUALS(1,linescan_find_all_filter(buf,comma,24,&p,index));
+    TS_ASSERT_EQUALS(std::vector<size_t>({7,8,10,16,17}),
+		     std::vector<size_t>(index->offsets,index->offsets + index->offsets_n));
+    linescan_index_free(index);
+  }
+
+  void test_linescan_kernels_find_all_filter(){
+    // Compare with filtering the lines of linescan_find_all
+    std::mt19937 rng(10);
+    linescan_index* all = linescan_index_create(16,4);
+    linescan_index* index = linescan_index_create(16,4);
+    const char* value = "ab";
+    linescan_predicate_op ops[] = {LINESCAN_PREDICATE_EQUAL,LINESCAN_PREDICATE_PREFIX,LINESCAN_PREDICATE_BYTES};
+
+    for(int round=0;round<100;round++){
+      // Long lines and fields in some rounds
+      unsigned int nl_rate = round % 8 < 4 ? 8 : 1;
+      unsigned int c_rate = round % 16 < 8 ? 64 : 4;
+      size_t n = rng() % 4096;
+      const char* buf = window(rng,round,n,[&](std::mt19937& g){
+	  unsigned int x = g() % 1024;
+	  return x < c_rate ? 'd' : (x < c_rate + nl_rate ? '\n' : value[x % 3 == 2 ? g() % 2 : x % 2]);
+	});
+      linescan_predicate p;
+      linescan_predicate_init(&p,rng() % 4,ops[round % 3],value,rng() % 3);
+
+      int rc_all = linescan_find_all(buf,cmask,n,all);
+      std::vector<size_t> expected;
+      for(size_t l=0;l<all->lines_n;l++){
+	const size_t* o = all->offsets + all->lines[l];
+	size_t o_n = all->lines[l+1] - all->lines[l];
+	if(p.field + 1 >= o_n) continue;
+	size_t f_start = p.field == 0 ? o[0] : o[p.field] + 1;
+	std::string f(buf + f_start,o[p.field + 1] - f_start);
+	std::string v(value,p.value_n);
+	bool pass = p.op == LINESCAN_PREDICATE_EQUAL ? f == v :
+	  (p.op == LINESCAN_PREDICATE_PREFIX ? f.compare(0,v.size(),v) == 0 && f.size() >= v.size() :
+	   f.find_first_of(v) != std::string::npos);
+	if(pass) expected.insert(expected.end(),o,o + o_n);
+      }
+
+      for_kernels([&]{
+	  TS_ASSERT_EQUALS(rc_all,linescan_find_all_filter(buf,cmask,n,&p,index));
+	  TS_ASSERT_EQUALS(all->size,index->size);
+	  TS_ASSERT_EQUALS(expected,std::vector<size_t>(index->offsets,index->offsets + index->offsets_n));
+	});
+    }
+    linescan_index_free(index);
+    linescan_index_free(all);
+  }
+
+  void test_linescan_kernels_short(){
+    // Short buffers and tails are loaded past n or overlapping; characters behind n must be ignored
+    std::mt19937 rng(11);
+    linescan* line = linescan_create(256);
+    linescan_index* index = linescan_index_create(16,4);
+
+    for(int round=0;round<2000;round++){
+      size_t n = rng() % 140;
+      const char* buf = window(rng,round,n,[&](std::mt19937& g){
+	  unsigned int x = g() % 16;
+	  return x < 4 ? c : (x < 6 ? '\n' : 'a');
+	});
+      compare_kernels([&]{ return found(linescan_find(buf,cmask,n,line),line); });
+      compare_kernels([&]{ return found(linescan_rfind(buf,cmask,n,line),line); });
+      compare_kernels([&]{
+	  linescan_find_all(buf,cmask,n,index);
+	  std::vector<size_t> v(index->offsets,index->offsets + index->offsets_n);
+	  v.push_back(index->size);
+	  return v;
+	});
+    }
+    linescan_index_free(index);
+    linescan_free(line);
+  }
+
+  void test_linescan_find_class(){
+    linescan_class cl;
+    linescan_class_init(&cl);
+    TS_ASSERT_EQUALS(0,linescan_class_add(&cl,"=",1));
+    TS_ASSERT_EQUALS(1,linescan_class_add(&cl,";&",2));
+    TS_ASSERT_EQUALS(2,linescan_class_add(&cl,"\xff",1));
+    // Already in class 1
+    TS_ASSERT_EQUALS(-1,linescan_class_add(&cl,"x;",2));
+    TS_ASSERT_EQUALS(3u,cl.classes_n);
+    TS_ASSERT_EQUALS(2u,cl.tables);
+
+    std::string text = "a=1;b=2&c\xff=;";
+    linescan_hits* hits = linescan_hits_create(1);
+    TS_ASSERT_EQUALS(0,linescan_find_class(text.data(),&cl,text.size(),hits));
+    TS_ASSERT_EQUALS(text.size(),hits->size);
+    std::vector<size_t> offsets = {1,3,5,7,9,10,11};
+    std::vector<int> classes = {0,1,0,1,2,0,1};
+    TS_ASSERT_EQUALS(offsets,std::vector<size_t>(hits->offsets,hits->offsets + hits->hits_n));
+    TS_ASSERT_EQUALS(classes,std::vector<int>(hits->classes,hits->classes + hits->hits_n));
+    linescan_hits_free(hits);
+  }
+
+  void test_linescan_kernels_find_class(){
+    std::mt19937 rng(23);
+    linescan_hits* hits = linescan_hits_create(4);
+    for(int round=0;round<300;round++){
+      linescan_class cl;
+      linescan_class_init(&cl);
+      std::vector<int> expected_class(256,-1);
+      size_t classes_n = 1 + rng() % 4;
+      for(size_t k=0;k<classes_n;k++){
+	std::string chars;
+	for(size_t j=0;j<1 + rng() % 4;j++){
+	  unsigned char x = (unsigned char)(rng() % 256);
+	  if(expected_class[x] == -1 && chars.find((char)x) == std::string::npos) chars.push_back((char)x);
+	}
+	TS_ASSERT_EQUALS((int)k,linescan_class_add(&cl,chars.data(),chars.size()));
+	for(char x : chars) expected_class[(unsigned char)x] = (int)k;
+      }
+      size_t n = round % 3 == 0 ? rng() % 140 : rng() % page;
+      const char* buf = window(rng,round,n,[](std::mt19937& g){ return (char)(g() % 256); });
+
+      std::vector<size_t> offsets;
+      std::vector<int> classes;
+      for(size_t i=0;i<n;i++){
+	int x = expected_class[(unsigned char)buf[i]];
+	if(x == -1) continue;
+	offsets.push_back(i);
+	classes.push_back(x);
+      }
+      for_kernels([&]{
+	  TS_ASSERT_EQUALS(0,linescan_find_class(buf,&cl,n,hits));
+	  TS_ASSERT_EQUALS(offsets,std::vector<size_t>(hits->offsets,hits->offsets + hits->hits_n));
+	  TS_ASSERT_EQUALS(classes,std::vector<int>(hits->classes,hits->classes + hits->hits_n));
+	});
+    }
+    linescan_hits_free(hits);
+  }
+
+  // Reference for linescan.utf8_invalid: offset of the first invalid or truncated sequence
+  static size_t utf8_invalid(const unsigned char* b, size_t n){
+    size_t i = 0;
+    while(i < n){
+      unsigned char c = b[i];
+      size_t len = c < 0x80 ? 1 : c < 0xc2 ? 0 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : c < 0xf5 ? 4 : 0;
+      if(len == 0 || n - i < len) return i;
+      uint32_t cp = len == 1 ? c : c & (0x7f >> len);
+      for(size_t j=1;j<len;j++){
+	if((b[i + j] & 0xc0) != 0x80) return i;
+	cp = (cp << 6) | (b[i + j] & 0x3f);
+      }
+      uint32_t min[] = {0,0,0x80,0x800,0x10000};
+      if(cp < min[len] || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) return i;
+      i += len;
+    }
+    return n;
+  }
+
+  void test_linescan_find_utf8(){
+    r->utf8 = 1;
+    std::string valid = "a\xc3\xa4" "d\xe2\x82\xac" "d\xf0\x9f\x98\x80\n";
+    TS_ASSERT_EQUALS(1,linescan_find(valid.data(),cmask,valid.size(),r));
+    TS_ASSERT_EQUALS(4u,r->offsets_n);
+    TS_ASSERT_EQUALS(valid.size(),r->utf8_invalid);
+
+    // Overlong, surrogate, above U+10FFFF, stray continuation, truncated by the newline
+    std::vector<std::string> invalid = {"ab\xc0\xaf\n","ab\xed\xa0\x80\n","ab\xf4\x90\x80\x80\n","ab\x80\n","ab\xe2\x82\n"};
+    for(const std::string& line : invalid){
+      TS_ASSERT_EQUALS(1,linescan_find(line.data(),cmask,line.size(),r));
+      TS_ASSERT_EQUALS(2u,r->utf8_invalid);
+    }
+    // Errors behind the newline are not reported
+    std::string behind = "abc\n\xff";
+    TS_ASSERT_EQUALS(1,linescan_find(behind.data(),cmask,behind.size(),r));
+    TS_ASSERT_EQUALS(4u,r->utf8_invalid);
+  }
+
+  void test_linescan_kernels_find_utf8_cut(){
+    // Sequences cut at the end of a buffer without newline, at every vector width and right in front of a guard page
+    std::vector<std::string> cut = {"\xc3","\xe2\x82","\xe2","\xf0\x9f\x98","\xf0\x9f","\xf0"};
+    for(size_t n : {16,32,64,128}){
+      for(const std::string& tail : cut){
+	std::string text = std::string(n - tail.size(),'a') + tail;
+	char* buf = at_guard(n,true);
+	memcpy(buf,text.data(),n);
+	// Valid once the sequence is complete
+	std::string whole = text.substr(0,n - tail.size()) + "\xc3\xa4";
+	for_kernels([&]{
+	    r->utf8 = 1;
+	    TS_ASSERT_EQUALS(0,linescan_find(buf,cmask,n,r));
+	    TS_ASSERT_EQUALS(n - tail.size(),r->utf8_invalid);
+	    TS_ASSERT_EQUALS(0,linescan_find(whole.data(),cmask,whole.size(),r));
+	    TS_ASSERT_EQUALS(whole.size(),r->utf8_invalid);
+	  });
+      }
+    }
+  }
+
+  void test_linescan_kernels_find_utf8(){
+    std::mt19937 rng(29);
+    std::vector<std::string> chars = {"a","d","\n","\xc3\xa4","\xe2\x82\xac","\xf0\x9f\x98\x80","\xed\x9f\xbf","\xf4\x8f\xbf\xbf"};
+    linescan* expected = linescan_create(1024);
+    for(int round=0;round<3000;round++){
+      // Mostly valid lines of random length with a few corrupted bytes
+      std::string text;
+      size_t chars_n = rng() % (round % 8 < 4 ? 40 : 300);
+      for(size_t i=0;i<chars_n;i++){
+	const std::string& x = chars[rng() % chars.size()];
+	text += x == "\n" && rng() % 4 != 0 ? "a" : x;
+      }
+      if(!text.empty() && rng() % 2 == 0) text[rng() % text.size()] = (char)(0x80 + rng() % 128);
+      size_t n = text.size();
+      char* buf = window(rng,round,n,[](std::mt19937& g){ return (char)(g() % 256); });
+      memcpy(buf,text.data(),n);
+
+      int rc = linescan_find(buf,cmask,n,expected);
+      size_t invalid = utf8_invalid((const unsigned char*)buf,expected->size);
+      for_kernels([&]{
+	  r->utf8 = 1;
+	  TS_ASSERT_EQUALS(rc,linescan_find(buf,cmask,n,r));
+	  TS_ASSERT_EQUALS(expected->size,r->size);
+	  TS_ASSERT_EQUALS(expected->offsets_n,r->offsets_n);
+	  TS_ASSERT_EQUALS(invalid,r->utf8_invalid);
+	  TS_ASSERT_EQUALS(rc,linescan_find_term(buf,cmask,linescan_create_mask('\n'),n,r));
+	  TS_ASSERT_EQUALS(invalid,r->utf8_invalid);
+	});
+    }
+    linescan_free(expected);
+  }
+
+  void test_linescan_find_batch(){
+    uint64_t comma = linescan_create_mask(',');
+    std::vector<std::string> messages = {"a,b\nc","","x","1,2,3\n",",\n"};
+    std::vector<const char*> bufs;
+    std::vector<size_t> ns;
+    for(const std::string& m : messages){
+      bufs.push_back(m.data());
+      ns.push_back(m.size());
+    }
+    linescan_batch* batch = linescan_batch_create(1,1);
+    TS_ASSERT_EQUALS(0,linescan_find_batch(bufs.data(),ns.data(),bufs.size(),comma,batch));
+    TS_ASSERT_EQUALS(5u,batch->buffers_n);
+    std::vector<size_t> starts = {0,3,4,5,9,12};
+    std::vector<size_t> offsets = {0,1,3, 0, 0, 0,1,3,5, 0,0,1};
+    std::vector<size_t> sizes = {4,0,1,6,2};
+    std::vector<int> status = {1,0,0,1,1};
+    TS_ASSERT_EQUALS(starts,std::vector<size_t>(batch->starts,batch->starts + batch->buffers_n + 1));
+    TS_ASSERT_EQUALS(offsets,std::vector<size_t>(batch->offsets,batch->offsets + batch->offsets_n));
+    TS_ASSERT_EQUALS(sizes,std::vector<size_t>(batch->sizes,batch->sizes + batch->buffers_n));
+    TS_ASSERT_EQUALS(status,std::vector<int>(batch->status,batch->status + batch->buffers_n));
+
+    linescan_batch_reset(batch);
+    TS_ASSERT_EQUALS(0,linescan_find_batch(bufs.data(),ns.data(),0,comma,batch));
+    TS_ASSERT_EQUALS(0u,batch->buffers_n);
+    TS_ASSERT_EQUALS(0u,batch->offsets_n);
+    linescan_batch_free(batch);
+  }
+
+  void test_linescan_kernels_find_batch(){
+    std::mt19937 rng(31);
+    linescan* expected = linescan_create(1024);
+    linescan_batch* batch = linescan_batch_create(4,16);
+    for(int round=0;round<50;round++){
+      std::vector<std::string> messages(rng() % 200);
+      for(std::string& m : messages){
+	size_t n = rng() % (rng() % 8 == 0 ? 600 : 80);
+	for(size_t i=0;i<n;i++){
+	  unsigned int x = rng() % 16;
+	  m.push_back(x < 3 ? c : (x < 4 ? '\n' : 'a'));
+	}
+      }
+      // Lines ending at and right behind the first 64 characters, which are searched per group
+      for(size_t n : {63,64,65,127,128}){
+	messages.push_back(std::string(n - 1,'a') + "\n");
+	messages.push_back(std::string(n,c));
+	messages.push_back(std::string(60,'a') + std::string(n - 60,c) + "\n" + c);
+      }
+      std::shuffle(messages.begin(),messages.end(),rng);
+      std::vector<const char*> bufs;
+      std::vector<size_t> ns;
+      for(const std::string& m : messages){
+	bufs.push_back(m.data());
+	ns.push_back(m.size());
+      }
+      for_kernels([&]{
+	  TS_ASSERT_EQUALS(0,linescan_find_batch(bufs.data(),ns.data(),bufs.size(),cmask,batch));
+	  TS_ASSERT_EQUALS(messages.size(),batch->buffers_n);
+	  for(size_t i=0;i<messages.size();i++){
+	    int rc = linescan_find(bufs[i],cmask,ns[i],expected);
+	    TS_ASSERT_EQUALS(rc,batch->status[i]);
+	    TS_ASSERT_EQUALS(expected->size,batch->sizes[i]);
+	    TS_ASSERT_EQUALS(std::vector<size_t>(expected->offsets,expected->offsets + expected->offsets_n),
+			     std::vector<size_t>(batch->offsets + batch->starts[i],batch->offsets + batch->starts[i + 1]));
+	  }
+	});
+    }
+    linescan_batch_free(batch);
+    linescan_free(expected);
+  }
+
+  // Runs lines_n lines of text through an adaptive scanner, comparing with linescan_find
+  void find_adaptive(const std::string& line, size_t lines_n, linescan_adaptive* a){
+    linescan* expected = linescan_create(1024);
+    uint64_t comma = linescan_create_mask(',');
+    for(size_t i=0;i<lines_n;i++){
+      TS_ASSERT_EQUALS(1,linescan_find(line.data(),comma,line.size(),expected));
+      TS_ASSERT_EQUALS(1,linescan_find_adaptive(line.data(),comma,line.size(),r,a));
+      TS_ASSERT_EQUALS(expected->size,r->size);
+      TS_ASSERT_EQUALS(std::vector<size_t>(expected->offsets,expected->offsets + expected->offsets_n),
+		       std::vector<size_t>(r->offsets,r->offsets + r->offsets_n));
+    }
+    linescan_free(expected);
+  }
+
+  void test_linescan_find_adaptive(){
+    size_t supported_n = 0;
+    for(int k=LINESCAN_KERNEL_SWAR;k<LINESCAN_KERNEL_N;k++) supported_n += linescan_kernel_supported((linescan_kernel)k);
+    std::string short_line = "a,b\n";
+    std::string long_line = std::string(100,'x') + "," + std::string(100,'y') + "\n";
+
+    // A pinned kernel is kept (setUp pins the portable kernel)
+    linescan_adaptive a;
+    linescan_adaptive_init(&a);
+    TS_ASSERT_EQUALS(LINESCAN_KERNEL_AUTO,a.trial);
+    find_adaptive(short_line,1000,&a);
+    TS_ASSERT_EQUALS(LINESCAN_KERNEL_SWAR,a.kernel);
+    TS_ASSERT_EQUALS(0u,a.trials);
+
+    // Every supported kernel is timed, starting with the portable one
+    linescan_set_kernel(LINESCAN_KERNEL_AUTO);
+    linescan_adaptive_init(&a);
+    TS_ASSERT_EQUALS(LINESCAN_KERNEL_SWAR,a.trial);
+    find_adaptive(short_line,64 * supported_n,&a);
+    TS_ASSERT_EQUALS(LINESCAN_KERNEL_AUTO,a.trial);
+    TS_ASSERT_EQUALS(1u,a.trials);
+    TS_ASSERT(linescan_kernel_supported(a.kernel));
+    for(int k=LINESCAN_KERNEL_SWAR;k<LINESCAN_KERNEL_N;k++){
+      if(linescan_kernel_supported((linescan_kernel)k)) TS_ASSERT(a.costs[k] > 0);
+    }
+    TS_ASSERT_EQUALS(4u,a.length);
+    TS_ASSERT_EQUALS(256u,a.density);
+
+    // Same data: no new trials
+    find_adaptive(short_line,1024,&a);
+    TS_ASSERT_EQUALS(LINESCAN_KERNEL_AUTO,a.trial);
+    TS_ASSERT_EQUALS(4u,a.windows);
+    // Longer lines: trials start again after the window
+    find_adaptive(long_line,256,&a);
+    TS_ASSERT_EQUALS(LINESCAN_KERNEL_SWAR,a.trial);
+    find_adaptive(long_line,64 * supported_n,&a);
+    TS_ASSERT_EQUALS(2u,a.trials);
+    TS_ASSERT_EQUALS(long_line.size(),a.length);
+    TS_ASSERT(linescan_kernel_supported(a.kernel));
+
+    // Work of the caller between calls is not part of the trial
+    linescan_adaptive_init(&a);
+    find_adaptive(short_line,1,&a);
+    for(int i=0;i<20;i++){
+      usleep(500);
+      find_adaptive(short_line,1,&a);
+    }
+    TS_ASSERT_EQUALS(LINESCAN_KERNEL_SWAR,a.trial);
+    TS_ASSERT(a.elapsed > 0);
+    TS_ASSERT(a.elapsed < 2000000);
+  }
+  
 };
@@ -0,0 +1,117 @@
+#include <cxxtest/TestSuite.h>
+
+#include <linescan_typed.h>
+#include <string>
+#include <vector>
+#include <random>
+
+class LinescanTypedTestSuite : public CxxTest::TestSuite {
+
+  uint64_t cmask = linescan_create_mask(',');
+
+public:
+
+  void test_linescan_scan_typed(){
+    linescan_type types[] = {LINESCAN_INT64,LINESCAN_SKIP,LINESCAN_DOUBLE,LINESCAN_STRING};
+    linescan_table* t = linescan_table_create(types,4,1);
+    std::string text =
+      "12,x,1.5,abc\n"
+      "-9223372036854775808,,-2.5e-3,\n"
+      "9223372036854775808,y,1e400,d,extra,fields\n"
+      "+7\n"
+      "x1,,.5e1x,z\n"
+      "123456789012345678,,0.1000000000000000055511151231257827,q\n"
+      "1,2,3,4";
+
+    TS_ASSERT_EQUALS(0,linescan_scan_typed(text.data(),cmask,text.size(),t));
+    TS_ASSERT_EQUALS(6u,t->rows_n);
+    TS_ASSERT_EQUALS(text.rfind('\n') + 1,t->size);
+
+    const linescan_column* c = t->columns;
+    TS_ASSERT_EQUALS(12,c[0].ints[0]);
+    TS_ASSERT_EQUALS(INT64_MIN,c[0].ints[1]);
+    // Out of range
+    TS_ASSERT_EQUALS(1,linescan_table_null(t,0,2));
+    TS_ASSERT_EQUALS(7,c[0].ints[3]);
+    TS_ASSERT_EQUALS(1,linescan_table_null(t,0,4));
+    TS_ASSERT_EQUALS(123456789012345678,c[0].ints[5]);
+
+    TS_ASSERT_EQUALS(1.5,c[2].doubles[0]);
+    TS_ASSERT_EQUALS(-2.5e-3,c[2].doubles[1]);
+    TS_ASSERT_EQUALS(HUGE_VAL,c[2].doubles[2]);
+    // Missing field
+    TS_ASSERT_EQUALS(1,linescan_table_null(t,2,3));
+    TS_ASSERT_EQUALS(1,linescan_table_null(t,2,4));
+    TS_ASSERT_EQUALS(0.1,c[2].doubles[5]);
+
+    TS_ASSERT_EQUALS("abc",text.substr(c[3].spans[0],c[3].spans[1] - c[3].spans[0]));
+    TS_ASSERT_EQUALS(1,linescan_table_null(t,3,1));
+    TS_ASSERT_EQUALS("d",text.substr(c[3].spans[4],c[3].spans[5] - c[3].spans[4]));
+    for(size_t row : {0,1,3,5}) TS_ASSERT_EQUALS(0,linescan_table_null(t,0,row));
+    linescan_table_free(t);
+  }
+
+  // Every field must be parsed like strtoll and strtod would
+  void test_linescan_kernels_scan_typed(){
+    std::mt19937 rng(13);
+    const char* digits = "0123456789";
+    linescan_type types[] = {LINESCAN_INT64,LINESCAN_DOUBLE,LINESCAN_STRING};
+    for(int round=0;round<20;round++){
+      std::string text;
+      std::vector<std::string> fields;
+      size_t rows_n = rng() % 300;
+      for(size_t row=0;row<rows_n;row++){
+	for(int k=0;k<3;k++){
+	  std::string field;
+	  if(rng() % 4 == 0) field.push_back("+-"[rng() % 2]);
+	  size_t int_n = rng() % 24;
+	  for(size_t i=0;i<int_n;i++) field.push_back(digits[rng() % 10]);
+	  if(rng() % 2 == 0){
+	    field.push_back('.');
+	    size_t frac_n = rng() % 24;
+	    for(size_t i=0;i<frac_n;i++) field.push_back(digits[rng() % 10]);
+	  }
+	  if(rng() % 4 == 0) field += "e" + std::to_string((int)(rng() % 700) - 350);
+	  if(rng() % 16 == 0) field.push_back('x');
+	  fields.push_back(field);
+	  text += field;
+	  text.push_back(k < 2 ? ',' : '\n');
+	}
+      }
+
+      for(int k=LINESCAN_KERNEL_SWAR;k<LINESCAN_KERNEL_N;k++){
+	if(linescan_set_kernel((linescan_kernel)k) != 0) continue;
+	linescan_table* t = linescan_table_create(types,3,1 + rng() % 16);
+	TS_ASSERT_EQUALS(1,linescan_scan_typed(text.data(),cmask,text.size(),t));
+	TS_ASSERT_EQUALS(rows_n,t->rows_n);
+	size_t pos = 0;
+	for(size_t row=0;row<t->rows_n;row++){
+	  for(int col=0;col<3;col++){
+	    const std::string& field = fields[3 * row + col];
+	    const char* s = field.c_str();
+	    char* stop;
+	    errno = 0;
+	    if(col == 0){
+	      long long v = strtoll(s,&stop,10);
+	      bool valid = !field.empty() && *stop == 0 && errno == 0 && isdigit((unsigned char)field.back());
+	      TS_ASSERT_EQUALS(!valid,linescan_table_null(t,0,row));
+	      if(valid) TS_ASSERT_EQUALS(v,t->columns[0].ints[row]);
+	    } else if(col == 1){
+	      double v = strtod(s,&stop);
+	      bool valid = !field.empty() && *stop == 0;
+	      TS_ASSERT_EQUALS(!valid,linescan_table_null(t,1,row));
+	      if(valid) TS_ASSERT_EQUALS(v,t->columns[1].doubles[row]);
+	    } else {
+	      TS_ASSERT_EQUALS(pos,t->columns[2].spans[2 * row]);
+	      TS_ASSERT_EQUALS(pos + field.size(),t->columns[2].spans[2 * row + 1]);
+	    }
+	    pos += field.size() + 1;
+	  }
+	}
+	linescan_table_free(t);
+      }
+    }
+    linescan_set_kernel(LINESCAN_KERNEL_AUTO);
+  }
+
+};